@@ -0,0 +1,85 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_CONTROLLER_ACQUISITION_H__
+#define __POSITION_FINDER_CONTROLLER_ACQUISITION_H__
+
+#define CONTROLLER_ACQUISITION_RING_SIZE 256 /* must be a power of two */
+
+struct _controller_sample_s {
+	int sensor_id;
+	int error;
+	double value;
+	unsigned long long timestamp; /* monotonic, in microseconds */
+};
+typedef struct _controller_sample_s controller_sample_s;
+
+/**
+ * @brief Called on the acquisition thread to read a sensor.
+ * @param[out] out_value The value read from the sensor
+ * @param[in] data The data passed to controller_acquisition_add_sensor()
+ * @return 0 on success, otherwise a negative error value
+ */
+typedef int (*controller_acquisition_read_cb)(double *out_value, void *data);
+
+/**
+ * @brief Called on the Ecore main loop for every sample taken by the acquisition thread.
+ * @param[in] sample The timestamped sample, valid only in the callback
+ * @param[in] data The data passed to controller_acquisition_init()
+ */
+typedef void (*controller_acquisition_sample_cb)(const controller_sample_s *sample, void *data);
+
+/**
+ * @brief Initializes the acquisition, must be called on the Ecore main loop.
+ * @param[in] cb The function to be called on the main loop for each sample
+ * @param[in] data The data to be passed to the callback function
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int controller_acquisition_init(controller_acquisition_sample_cb cb, void *data);
+
+/**
+ * @brief Adds a sensor to be read periodically on the acquisition thread.
+ * @param[in] name The name of the sensor, used for logging
+ * @param[in] period The period to read the sensor in seconds
+ * @param[in] deadline The relative deadline of a read in seconds, 0 to use the period
+ * @param[in] priority The priority used to order reads which have the same deadline
+ * @param[in] read_cb The function to be called on the acquisition thread to read the sensor
+ * @param[in] data The data to be passed to the read function
+ * @return The sensor id reported in samples on success, otherwise a negative error value
+ * @see Sensors must be added before controller_acquisition_start().
+ */
+extern int controller_acquisition_add_sensor(const char *name, double period, double deadline,
+	int priority, controller_acquisition_read_cb read_cb, void *data);
+
+/**
+ * @brief Starts the acquisition thread.
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int controller_acquisition_start(void);
+
+/**
+ * @brief Stops the acquisition thread and waits for it to finish.
+ */
+extern void controller_acquisition_stop(void);
+
+/**
+ * @brief Gets the number of samples dropped because the main loop did not drain the ring in time.
+ * @return The number of dropped samples
+ */
+extern unsigned int controller_acquisition_get_dropped_count(void);
+
+/**
+ * @brief Stops the acquisition thread if it is running and releases all resources.
+ */
+extern void controller_acquisition_fini(void);
+
+#endif /* __POSITION_FINDER_CONTROLLER_ACQUISITION_H__ */
@@ -0,0 +1,72 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_CONTROLLER_GOVERNOR_H__
+#define __POSITION_FINDER_CONTROLLER_GOVERNOR_H__
+
+#include "resource.h"
+
+struct _controller_governor_config_s {
+	double period; /* seconds between two evaluations on the acquisition thread */
+	double stop_distance; /* cm, the motors are stopped at or below this distance */
+	double full_distance; /* cm, full speed is allowed from this distance on */
+	double hysteresis; /* cm, the limit is only raised when the obstacle is this much farther */
+	double ir_distance; /* cm, the distance assumed while the infrared sensor sees an obstacle */
+	double stale_time; /* seconds, an older ultrasonic distance stops forward motion */
+};
+typedef struct _controller_governor_config_s controller_governor_config_s;
+
+struct _controller_governor_stats_s {
+	unsigned long long evaluations;
+	unsigned long long stale_evaluations; /* evaluations without a fresh ultrasonic distance */
+	unsigned long long limit_changes;
+	int limit; /* the current speed limit, see MOTOR_DRIVER_L298N_SPEED_MAX */
+	double distance; /* cm, the nearest obstacle the limit is based on, -1 if none */
+	unsigned long long last_latency; /* us, from the measurement to the lowered limit on the motors */
+	unsigned long long max_latency; /* us, the worst reaction seen so far */
+	unsigned long long last_age; /* us, age of the ultrasonic distance at the last evaluation */
+	unsigned long long max_age; /* us, the oldest ultrasonic distance an evaluation had */
+};
+typedef struct _controller_governor_stats_s controller_governor_stats_s;
+
+/**
+ * @brief Adds the speed governor to the acquisition, must be called before controller_acquisition_start().
+ * @param[in] ir_pin_num The number of the gpio pin connected to the infrared obstacle avoidance sensor, -1 if there is none
+ * @param[in] config The configuration of the governor, NULL to use the defaults
+ * @return The sensor id of the governor in the acquisition samples on success, otherwise a negative error value
+ * @remarks On each evaluation the nearest obstacle ahead is mapped to a forward speed limit of the motors,
+ * the value of the sample is the limit. Lowering the limit slows the running motors at once.
+ * If the ultrasonic distance is older than stale_time, the limit drops to 0 until a fresh one comes.
+ * @see controller_governor_update_ultrasonic() feeds the distances of the ultrasonic array.
+ */
+extern int controller_governor_init(int ir_pin_num, const controller_governor_config_s *config);
+
+/**
+ * @brief Gives the nearest obstacles measured by the ultrasonic array to the governor.
+ * @param[in] obstacle The nearest obstacles, only the front sector is used
+ * @remarks Can be called from resource_ultrasonic_obstacle_cb() on the ultrasonic array thread.
+ */
+extern void controller_governor_update_ultrasonic(const resource_ultrasonic_obstacle_s *obstacle);
+
+/**
+ * @brief Gets the statistics of the governor, including its worst-case reaction latency.
+ * @param[out] out The statistics
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int controller_governor_get_stats(controller_governor_stats_s *out);
+
+/**
+ * @brief Releases the governor, after the acquisition is stopped.
+ */
+extern void controller_governor_fini(void);
+
+#endif /* __POSITION_FINDER_CONTROLLER_GOVERNOR_H__ */
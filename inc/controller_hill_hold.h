@@ -0,0 +1,62 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_CONTROLLER_HILL_HOLD_H__
+#define __POSITION_FINDER_CONTROLLER_HILL_HOLD_H__
+
+#define CONTROLLER_HILL_HOLD_RATE_MIN 100
+
+struct _controller_hill_hold_config_s {
+	unsigned int rate; /* Hz the IMU is sampled at, at least CONTROLLER_HILL_HOLD_RATE_MIN */
+	unsigned int batch; /* samples drained from the IMU FIFO at once, the latency is batch / rate */
+	double gain; /* speed held forward per unit of sin(slope) uphill, for an IMU with x forward and z up, negative if it faces backward */
+	double max_hold; /* the highest speed held, up to MOTOR_DRIVER_L298N_SPEED_MAX */
+	double deadband; /* degrees, flatter slopes are not held */
+	double ramp_time; /* seconds a command from rest takes to reach its value over the hold */
+};
+typedef struct _controller_hill_hold_config_s controller_hill_hold_config_s;
+
+struct _controller_hill_hold_stats_s {
+	double pitch; /* degrees, positive nose down as in resource_get_attitude() */
+	int feedforward; /* the speed held against the slope */
+	unsigned long long samples;
+	unsigned long long updates; /* times the hold was applied to the motors */
+	unsigned long long last_latency; /* us, from the newest IMU sample to the motors */
+	unsigned long long max_latency;
+};
+typedef struct _controller_hill_hold_stats_s controller_hill_hold_stats_s;
+
+/**
+ * @brief Starts the hill-hold on the real-time IMU drain thread.
+ * @param[in] int_pin_num The number of the gpio pin connected to the INT pin of the MPU6050, -1 to poll
+ * @param[in] config The configuration of the hill-hold, NULL to use the defaults
+ * @return 0 on success, otherwise a negative error value
+ * @remarks The pitch is estimated from the FIFO samples of the MPU6050 as they are drained, and the motors
+ * get a feed-forward torque against gravity, so a stopped stroller doesn't roll back and a start
+ * from rest is ramped in on top of it.
+ * @see The FIFO mode of the gyro sensor is used by the hill-hold only.
+ */
+extern int controller_hill_hold_start(int int_pin_num, const controller_hill_hold_config_s *config);
+
+/**
+ * @brief Stops the hill-hold and removes the hold torque from the motors.
+ */
+extern void controller_hill_hold_stop(void);
+
+/**
+ * @brief Gets the statistics of the hill-hold.
+ * @param[out] out The statistics
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int controller_hill_hold_get_stats(controller_hill_hold_stats_s *out);
+
+#endif /* __POSITION_FINDER_CONTROLLER_HILL_HOLD_H__ */
@@ -0,0 +1,75 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_CONTROLLER_SAFETY_H__
+#define __POSITION_FINDER_CONTROLLER_SAFETY_H__
+
+#include <stdbool.h>
+
+#define CONTROLLER_SAFETY_RATE_MIN 200
+#define CONTROLLER_SAFETY_RATE_MAX 2000
+#define CONTROLLER_SAFETY_LATENCY_BUCKETS 16 /* bucket i counts [2^i, 2^(i+1)) us, the last one everything longer */
+
+struct _controller_safety_config_s {
+	unsigned int rate; /* Hz the handle is sampled at */
+	unsigned int grip_threshold; /* the handle is held from this value up */
+	unsigned int release_threshold; /* and released below this one, lower than grip_threshold */
+	double release_time; /* seconds the handle may be released before the motors are braked */
+};
+typedef struct _controller_safety_config_s controller_safety_config_s;
+
+struct _controller_safety_stats_s {
+	unsigned long long ticks;
+	unsigned long long late; /* ticks missed because the loop fell behind */
+	unsigned long long read_errors;
+	unsigned long long brakes;
+	unsigned long long max_latency; /* us */
+	unsigned long long histogram[CONTROLLER_SAFETY_LATENCY_BUCKETS];
+};
+typedef struct _controller_safety_stats_s controller_safety_stats_s;
+
+/**
+ * @brief Called on the Ecore main loop when the safety brake is engaged or released.
+ * @param[in] braked true if the motors were braked, false if the handle is held again
+ * @param[in] timestamp When the sample which decided it was taken, monotonic in microseconds
+ * @param[in] data The data passed to controller_safety_start()
+ */
+typedef void (*controller_safety_brake_cb)(bool braked, unsigned long long timestamp, void *data);
+
+/**
+ * @brief Starts the handle-release safety loop on a dedicated thread.
+ * @param[in] ch_num The channel of the AD converter(MCP3008) connected to the handle pressure sensor
+ * @param[in] config The configuration of the loop, NULL to use the defaults
+ * @param[in] cb The function to be called on the main loop when the brake state changes
+ * @param[in] data The data to be passed to the callback function
+ * @return 0 on success, otherwise a negative error value
+ * @remarks When the handle stays released for release_time, every motor is braked from the loop
+ * itself and motors can't be started until the handle is held again.
+ * The time from the deciding sample to the brake is recorded in the statistics.
+ * @see controller_safety_get_stats()
+ */
+extern int controller_safety_start(int ch_num, const controller_safety_config_s *config,
+	controller_safety_brake_cb cb, void *data);
+
+/**
+ * @brief Stops the safety loop.
+ */
+extern void controller_safety_stop(void);
+
+/**
+ * @brief Gets the statistics of the safety loop, including the sensor-to-brake latency histogram.
+ * @param[out] out The statistics
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int controller_safety_get_stats(controller_safety_stats_s *out);
+
+#endif /* __POSITION_FINDER_CONTROLLER_SAFETY_H__ */
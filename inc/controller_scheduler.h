@@ -0,0 +1,127 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_CONTROLLER_SCHEDULER_H__
+#define __POSITION_FINDER_CONTROLLER_SCHEDULER_H__
+
+#include <stdbool.h>
+
+#define CONTROLLER_SCHEDULER_TASK_MAX 32
+
+typedef struct _controller_scheduler_s controller_scheduler_s;
+
+/**
+ * @brief Called when a task is released. The task must finish before its deadline.
+ * @param[in] data The data passed to controller_scheduler_add_task()
+ */
+typedef void (*controller_scheduler_task_cb)(void *data);
+
+/**
+ * @brief Called after a task has finished past its absolute deadline.
+ * @param[in] task_id The id of the late task
+ * @param[in] name The name of the late task
+ * @param[in] lateness How long the task finished after its deadline, in seconds
+ * @param[in] data The data passed to controller_scheduler_set_deadline_missed_cb()
+ */
+typedef void (*controller_scheduler_miss_cb)(int task_id, const char *name, double lateness, void *data);
+
+struct _controller_scheduler_stats_s {
+	unsigned int released;
+	unsigned int missed;
+	unsigned int skipped;
+	double worst_lateness;
+	double worst_exec_time;
+};
+typedef struct _controller_scheduler_stats_s controller_scheduler_stats_s;
+
+/**
+ * @brief Creates a scheduler which runs periodic tasks in earliest-deadline-first order.
+ * @return A scheduler handle on success, otherwise NULL
+ * @see A scheduler is not thread-safe, every function must be called on the thread which dispatches it.
+ */
+extern controller_scheduler_s *controller_scheduler_create(void);
+
+/**
+ * @brief Stops the scheduler if it is running and releases all tasks.
+ * @param[in] sched The scheduler handle
+ */
+extern void controller_scheduler_destroy(controller_scheduler_s *sched);
+
+/**
+ * @brief Adds a periodic task to the scheduler.
+ * @param[in] sched The scheduler handle
+ * @param[in] name The name of the task, used for logging
+ * @param[in] period The period of the task in seconds
+ * @param[in] deadline The relative deadline of the task in seconds, 0 to use the period
+ * @param[in] priority The priority used to order tasks which have the same deadline, higher runs first
+ * @param[in] cb The function to be called when the task is released
+ * @param[in] data The data to be passed to the callback function
+ * @return The task id on success, otherwise a negative error value
+ * @see The first release of the task happens at the time it is added, also when the scheduler is already started.
+ */
+extern int controller_scheduler_add_task(controller_scheduler_s *sched, const char *name,
+	double period, double deadline, int priority, controller_scheduler_task_cb cb, void *data);
+
+/**
+ * @brief Removes a task from the scheduler.
+ * @param[in] sched The scheduler handle
+ * @param[in] task_id The task id returned by controller_scheduler_add_task()
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int controller_scheduler_remove_task(controller_scheduler_s *sched, int task_id);
+
+/**
+ * @brief Sets a callback function to be invoked when a task misses its deadline.
+ * @param[in] sched The scheduler handle
+ * @param[in] cb The callback function, NULL to only log the missed deadlines
+ * @param[in] data The data to be passed to the callback function
+ */
+extern void controller_scheduler_set_deadline_missed_cb(controller_scheduler_s *sched, controller_scheduler_miss_cb cb, void *data);
+
+/**
+ * @brief Gets the statistics of a task.
+ * @param[in] sched The scheduler handle
+ * @param[in] task_id The task id returned by controller_scheduler_add_task()
+ * @param[out] stats The statistics of the task
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int controller_scheduler_get_stats(controller_scheduler_s *sched, int task_id, controller_scheduler_stats_s *stats);
+
+/**
+ * @brief Runs every released task once in earliest-deadline-first order.
+ * @param[in] sched The scheduler handle
+ * @param[in] now The current time from controller_scheduler_get_time()
+ * @return The time of the next release, or a negative value if there is no task
+ * @see Use this to drive the scheduler from your own loop instead of controller_scheduler_start().
+ */
+extern double controller_scheduler_dispatch(controller_scheduler_s *sched, double now);
+
+/**
+ * @brief Starts to dispatch the scheduler on the Ecore main loop.
+ * @param[in] sched The scheduler handle
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int controller_scheduler_start(controller_scheduler_s *sched);
+
+/**
+ * @brief Stops to dispatch the scheduler on the Ecore main loop.
+ * @param[in] sched The scheduler handle
+ */
+extern void controller_scheduler_stop(controller_scheduler_s *sched);
+
+/**
+ * @brief Gets the monotonic time in seconds used by the scheduler.
+ * @return The current monotonic time
+ */
+extern double controller_scheduler_get_time(void);
+
+#endif /* __POSITION_FINDER_CONTROLLER_SCHEDULER_H__ */
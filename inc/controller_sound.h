@@ -0,0 +1,80 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_CONTROLLER_SOUND_H__
+#define __POSITION_FINDER_CONTROLLER_SOUND_H__
+
+#include <stdbool.h>
+#include "resource/resource_sound_level_dsp.h"
+#include "resource/resource_sound_spectrum.h"
+
+#define CONTROLLER_SOUND_WINDOW_MAX 4096
+#define CONTROLLER_SOUND_DECISION_MAX 64 /* windows remembered by the cry detector */
+
+/**
+ * @brief Called on the Ecore main loop with the level of every window of sound.
+ * @param[in] level The level of the window, valid only in the callback
+ * @param[in] timestamp When the last sample of the window was taken, monotonic in microseconds
+ * @param[in] data The data passed to controller_sound_start()
+ */
+typedef void (*controller_sound_level_cb)(const resource_sound_level_s *level, unsigned long long timestamp, void *data);
+
+struct _controller_cry_detector_config_s {
+	double min_db; /* quieter windows are never a cry */
+	double min_voiced_ratio; /* share of the energy in the pitch and harmonic bands */
+	double min_pitch_prominence; /* the pitch must stand out of the pitch band by this ratio */
+	double min_harmonic_ratio; /* the harmonics of the pitch must stand out of the spectrum by this ratio */
+	double decision_time; /* seconds of windows the decision is made on */
+	double on_fraction; /* crying starts when this fraction of the windows are cry-like */
+	double off_fraction; /* crying stops when at most this fraction of the windows are cry-like */
+};
+typedef struct _controller_cry_detector_config_s controller_cry_detector_config_s;
+
+/**
+ * @brief Called on the Ecore main loop when the baby starts or stops crying.
+ * @param[in] crying true if the baby started crying, false if stopped
+ * @param[in] timestamp When the decision was made, monotonic in microseconds
+ * @param[in] data The data passed to controller_sound_set_cry_detector()
+ */
+typedef void (*controller_sound_cry_cb)(bool crying, unsigned long long timestamp, void *data);
+
+/**
+ * @brief Enables the infant-cry detector on the sound analysis thread.
+ * @param[in] config The configuration of the detector, NULL to use the defaults
+ * @param[in] cb The function to be called on the main loop when the crying state changes
+ * @param[in] data The data to be passed to the callback function
+ * @return 0 on success, otherwise a negative error value
+ * @see Must be called before controller_sound_start(). The window must be a power of 2
+ * up to SOUND_SPECTRUM_FFT_MAX, each window is analyzed by a fixed-point FFT.
+ */
+extern int controller_sound_set_cry_detector(const controller_cry_detector_config_s *config,
+	controller_sound_cry_cb cb, void *data);
+
+/**
+ * @brief Starts to sample the sound level sensor at a high rate and to analyze it on a dedicated thread.
+ * @param[in] ch_num The channel of the AD converter(MCP3008) connected to the sound level sensor
+ * @param[in] rate The sampling rate in Hz
+ * @param[in] window The number of samples of an analysis window, up to CONTROLLER_SOUND_WINDOW_MAX
+ * @param[in] cb The function to be called on the main loop with the level of each window
+ * @param[in] data The data to be passed to the callback function
+ * @return 0 on success, otherwise a negative error value
+ * @see The sound analysis is the only consumer of the ADC stream.
+ */
+extern int controller_sound_start(int ch_num, unsigned int rate, unsigned int window,
+	controller_sound_level_cb cb, void *data);
+
+/**
+ * @brief Stops the sound analysis and the sampling.
+ */
+extern void controller_sound_stop(void);
+
+#endif /* __POSITION_FINDER_CONTROLLER_SOUND_H__ */
@@ -50,7 +50,14 @@
 #include "resource/resource_sound_level_sensor.h"
 #include "resource/resource_motor_driver_L298N.h"
 #include "resource/resource_PCA9685.h"
+#include "resource/resource_servo_motor.h"
 #include "resource/resource_pressure_sensor.h"
 #include "resource/resource_gyro_sensor.h"
+#include "resource/resource_attitude.h"
+#include "resource/resource_gpio_chardev.h"
+#include "resource/resource_ultrasonic_array.h"
+#include "resource/resource_adc_stream.h"
+#include "resource/resource_sound_level_dsp.h"
+#include "resource/resource_sound_spectrum.h"
 
 #endif /* __POSITION_FINDER_RESOURCE_H__ */
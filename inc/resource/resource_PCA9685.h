@@ -21,9 +21,38 @@
 
 #define PCA9685_CH_MAX 15
 
+/**
+ * @brief Counts of bus transactions sent to the chip and of writes dropped
+ * because the register already held the value.
+ */
+typedef struct {
+	unsigned long long issued;
+	unsigned long long skipped;
+} resource_pca9685_stats_s;
+
+/**
+ * @brief A PWM setting for one channel, used by resource_pca9685_set_values().
+ */
+typedef struct {
+	unsigned int channel;
+	int on;
+	int off;
+} resource_pca9685_value_s;
+
 int resource_pca9685_init(unsigned int ch);
 int resource_pca9685_fini(unsigned int ch);
 int resource_pca9685_set_frequency(unsigned int freq_hz);
 int resource_pca9685_set_value_to_channel(unsigned int channel, int on, int off);
 
+/**
+ * @brief Sets several channels at once.
+ * @param[in] values The channel settings, in any order. A later entry for the same channel wins
+ * @param[in] count The number of entries in @a values
+ * @return 0 on success, otherwise a negative error value
+ * @remarks Changed channels are written in as few auto-increment transactions as possible,
+ * normally one, so that they switch within the same I2C frame.
+ */
+int resource_pca9685_set_values(const resource_pca9685_value_s *values, unsigned int count);
+void resource_pca9685_get_stats(resource_pca9685_stats_s *out);
+
 #endif /* __RESOURCE_PCA9685_H__ */
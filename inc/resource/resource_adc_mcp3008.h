@@ -22,8 +22,13 @@
 #ifndef __POSITION_FINDER_RESOURCE_ADC_MCP3008_H__
 #define __POSITION_FINDER_RESOURCE_ADC_MCP3008_H__
 
+#define MCP3008_CH_MAX 8
+
 int resource_adc_mcp3008_init(void);
 int resource_read_adc_mcp3008(int ch_num, unsigned int *out_value);
+
+/* Reads every channel set in ch_mask in one SPI message, out_values is indexed by the channel number */
+int resource_scan_adc_mcp3008(unsigned int ch_mask, unsigned int *out_values);
 void resource_adc_mcp3008_fini(void);
 
 #endif /* __POSITION_FINDER_RESOURCE_ADC_MCP3008_H__ */
@@ -0,0 +1,79 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_RESOURCE_ADC_STREAM_H__
+#define __POSITION_FINDER_RESOURCE_ADC_STREAM_H__
+
+#include "resource/resource_adc_mcp3008.h"
+
+#define ADC_STREAM_RING_FRAMES 4096 /* must be a power of 2, about 200 ms at the highest rate */
+#define ADC_STREAM_RATE_MIN 1000
+#define ADC_STREAM_RATE_MAX 20000
+
+struct _resource_adc_stream_frame_s {
+	unsigned long long timestamp; /* monotonic in nanoseconds */
+	unsigned short value[MCP3008_CH_MAX]; /* indexed by the channel number, only the sampled channels are valid */
+};
+typedef struct _resource_adc_stream_frame_s resource_adc_stream_frame_s;
+
+struct _resource_adc_stream_block_s {
+	const resource_adc_stream_frame_s *frames;
+	unsigned int count;
+};
+typedef struct _resource_adc_stream_block_s resource_adc_stream_block_s;
+
+struct _resource_adc_stream_stats_s {
+	unsigned int requested_rate; /* Hz */
+	double achieved_rate; /* frames taken per second since the start */
+	unsigned long long frames; /* frames taken */
+	unsigned long long overruns; /* frames dropped because the ring was full */
+	unsigned long long late; /* sampling ticks skipped because the thread fell behind */
+};
+typedef struct _resource_adc_stream_stats_s resource_adc_stream_stats_s;
+
+/**
+ * @brief Starts to sample the channels of the MCP3008 continuously on a dedicated thread.
+ * @param[in] ch_mask The channels to sample, one bit per channel number
+ * @param[in] rate The sampling rate in Hz, from ADC_STREAM_RATE_MIN to ADC_STREAM_RATE_MAX
+ * @return 0 on success, otherwise a negative error value
+ * @see All the channels of a frame are read in a single SPI message.
+ */
+extern int resource_adc_stream_start(unsigned int ch_mask, unsigned int rate);
+
+/**
+ * @brief Stops the continuous sampling, the frames not read yet are discarded.
+ */
+extern void resource_adc_stream_stop(void);
+
+/**
+ * @brief Gets the oldest frames not read yet without copying them.
+ * @param[in] max_count The maximum number of frames to get
+ * @param[out] block The frames, contiguous in the ring
+ * @return The number of frames in the block, 0 if there is nothing to read, otherwise a negative error value
+ * @see Only one consumer may read the stream. The frames stay valid until resource_adc_stream_read_end() is called.
+ */
+extern int resource_adc_stream_read_begin(unsigned int max_count, resource_adc_stream_block_s *block);
+
+/**
+ * @brief Releases the frames got by resource_adc_stream_read_begin().
+ * @param[in] count The number of frames consumed, not more than the count of the block
+ */
+extern void resource_adc_stream_read_end(unsigned int count);
+
+/**
+ * @brief Gets the statistics of the continuous sampling.
+ * @param[out] stats The statistics
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_adc_stream_get_stats(resource_adc_stream_stats_s *stats);
+
+#endif /* __POSITION_FINDER_RESOURCE_ADC_STREAM_H__ */
@@ -0,0 +1,97 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_RESOURCE_ATTITUDE_H__
+#define __POSITION_FINDER_RESOURCE_ATTITUDE_H__
+
+#include "resource/resource_gyro_sensor.h"
+
+typedef enum {
+	ATTITUDE_FILTER_COMPLEMENTARY,
+	ATTITUDE_FILTER_MADGWICK,
+	ATTITUDE_FILTER_MAHONY,
+	ATTITUDE_FILTER_MAX
+} resource_attitude_filter_e;
+
+struct _resource_attitude_config_s {
+	resource_attitude_filter_e filter;
+	float time_constant; /* complementary, seconds the gyro is trusted over the accelerometer */
+	float beta; /* Madgwick, gain of the accelerometer correction */
+	float kp; /* Mahony, proportional gain */
+	float ki; /* Mahony, integral gain, estimates the gyro bias */
+};
+typedef struct _resource_attitude_config_s resource_attitude_config_s;
+
+struct _resource_attitude_s {
+	float roll; /* degrees, around the x axis */
+	float pitch; /* degrees, around the y axis, positive nose down with x forward and z up */
+	float yaw; /* degrees, around the z axis, relative to the start as there is no magnetometer */
+	float q[4]; /* w, x, y, z */
+	unsigned long long timestamp; /* of the last sample, monotonic in microseconds */
+};
+typedef struct _resource_attitude_s resource_attitude_s;
+
+typedef struct _resource_attitude_engine_s resource_attitude_engine_s;
+
+/**
+ * @brief Fills the default configuration of an attitude filter.
+ * @param[in] filter The filter
+ * @param[out] config The default configuration of the filter
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_get_attitude_default_config(resource_attitude_filter_e filter, resource_attitude_config_s *config);
+
+/**
+ * @brief Creates an engine which fuses the gyroscope and the accelerometer into an attitude.
+ * @param[in] config The configuration, NULL to use the default complementary filter
+ * @return An engine handle on success, otherwise NULL
+ */
+extern resource_attitude_engine_s *resource_create_attitude_engine(const resource_attitude_config_s *config);
+
+/**
+ * @brief Releases the engine.
+ * @param[in] engine The engine handle
+ */
+extern void resource_destroy_attitude_engine(resource_attitude_engine_s *engine);
+
+/**
+ * @brief Forgets the attitude, the next sample levels the engine from the accelerometer.
+ * @param[in] engine The engine handle
+ */
+extern void resource_reset_attitude_engine(resource_attitude_engine_s *engine);
+
+/**
+ * @brief Updates the attitude with a batch of samples.
+ * @param[in] engine The engine handle
+ * @param[in] samples The samples, oldest first, the time step of each comes from the timestamps
+ * @param[in] count The number of the samples
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_update_attitude(resource_attitude_engine_s *engine, const resource_imu_sample_s *samples, unsigned int count);
+
+/**
+ * @brief Gets the attitude after the last update.
+ * @param[in] engine The engine handle
+ * @param[out] attitude The attitude
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_get_attitude(resource_attitude_engine_s *engine, resource_attitude_s *attitude);
+
+/**
+ * @brief Measures every filter and logs the time per sample of each.
+ * @param[in] count The number of samples of a batch
+ * @param[in] iterations The number of batches to process with each filter
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_benchmark_attitude(unsigned int count, unsigned int iterations);
+
+#endif /* __POSITION_FINDER_RESOURCE_ATTITUDE_H__ */
@@ -0,0 +1,61 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_RESOURCE_FILTER_H__
+#define __POSITION_FINDER_RESOURCE_FILTER_H__
+
+#define RESOURCE_FILTER_WINDOW_MAX 15
+
+struct _resource_filter_config_s {
+	unsigned int window; /* number of samples of the running median, 1 to RESOURCE_FILTER_WINDOW_MAX */
+	double max_rate; /* largest change per second accepted from the last output, 0 to disable the gate */
+	double hold_time; /* how long the last valid output is held while samples are invalid, in seconds */
+};
+typedef struct _resource_filter_config_s resource_filter_config_s;
+
+typedef struct _resource_filter_s resource_filter_s;
+
+/**
+ * @brief Creates a streaming filter which rejects outliers and smooths the samples with a running median.
+ * @param[in] config The configuration of the filter
+ * @return A filter handle on success, otherwise NULL
+ * @remarks Each sample costs O(log window), no memory is allocated after creation.
+ */
+extern resource_filter_s *resource_filter_create(const resource_filter_config_s *config);
+
+/**
+ * @brief Releases the filter.
+ * @param[in] filter The filter handle
+ */
+extern void resource_filter_destroy(resource_filter_s *filter);
+
+/**
+ * @brief Forgets all the samples of the filter.
+ * @param[in] filter The filter handle
+ */
+extern void resource_filter_reset(resource_filter_s *filter);
+
+/**
+ * @brief Puts a sample into the filter and gets the filtered value.
+ * @param[in] filter The filter handle
+ * @param[in] value The sample
+ * @param[in] valid 0 if the sensor could not measure (e.g. out of range), otherwise non-zero
+ * @param[in] timestamp When the sample was measured, monotonic in microseconds
+ * @param[out] out_value The filtered value
+ * @return 1 if out_value is valid, 0 if there is no valid value to output, otherwise a negative error value
+ * @see A sample changing faster than max_rate is rejected and the last valid value is held instead,
+ * unless a whole window of samples is rejected in a row, then the filter follows the new level.
+ */
+extern int resource_filter_update(resource_filter_s *filter, double value, int valid,
+	unsigned long long timestamp, double *out_value);
+
+#endif /* __POSITION_FINDER_RESOURCE_FILTER_H__ */
@@ -32,4 +32,10 @@
  */
 extern int resource_read_flame_sensor(int pin_num, uint32_t *out_value);
 
+/**
+ * @brief Subscribes the changes of gpio connected flame sensor instead of polling it.
+ * @see resource_subscribe_gpio_event(), with both edges
+ */
+extern int resource_subscribe_flame_sensor(int pin_num, resource_gpio_event_cb cb, void *data);
+
 #endif /* __POSITION_FINDER_RESOURCE_FLAME_SENSOR_H__ */
@@ -31,4 +31,10 @@
  */
 extern int resource_read_gas_detection_sensor(int pin_num, uint32_t *out_value);
 
+/**
+ * @brief Subscribes the changes of gpio connected gas detection sensor instead of polling it.
+ * @see resource_subscribe_gpio_event(), with both edges
+ */
+extern int resource_subscribe_gas_detection_sensor(int pin_num, resource_gpio_event_cb cb, void *data);
+
 #endif /* __POSITION_FINDER_RESOURCE_GAS_DETECTION_SENSOR_H__ */
@@ -0,0 +1,74 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_RESOURCE_GPIO_CHARDEV_H__
+#define __POSITION_FINDER_RESOURCE_GPIO_CHARDEV_H__
+
+#include <stdint.h>
+#include <peripheral_io.h>
+
+struct _resource_gpio_line_event_s {
+	int rising;
+	unsigned long long timestamp; /* monotonic, in nanoseconds, taken by the kernel */
+};
+typedef struct _resource_gpio_line_event_s resource_gpio_line_event_s;
+
+/**
+ * @brief Opens a snapshot of digital input gpio pins to be read at once.
+ * @param[in] pins The numbers of the gpio pins to be read
+ * @param[in] count The number of the gpio pins
+ * @return 0 on success, otherwise a negative error value
+ * @remarks The pins are requested as one line handle of the gpio character device,
+ * if it is not available (e.g. a pin is already open), each pin is read with its own gpio handle instead.
+ * @see While the snapshot is open, read the pins only through resource_read_gpio_snapshot().
+ */
+extern int resource_open_gpio_snapshot(const int *pins, unsigned int count);
+
+/**
+ * @brief Reads all the pins of the snapshot at once.
+ * @param[out] out_mask The values of the pins, the bit of the pin number is set if the pin is high
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_read_gpio_snapshot(uint64_t *out_mask);
+
+/**
+ * @brief Releases the pins of the snapshot.
+ */
+extern void resource_close_gpio_snapshot(void);
+
+/**
+ * @brief Requests edge events of a digital input gpio pin from the gpio character device.
+ * @param[in] pin_num The number of the gpio pin
+ * @param[in] edge The edge to be notified
+ * @param[out] out_fd The non-blocking file descriptor which becomes readable when an edge comes
+ * @return 0 on success, otherwise a negative error value
+ * @remarks Edges are timestamped by the kernel in the interrupt handler, unlike peripheral_gpio_set_interrupted_cb().
+ * The v2 line request is tried first, and the v1 line event request if the kernel rejects it.
+ * @see The pin must not be open with peripheral_gpio_open().
+ */
+extern int resource_open_gpio_line_event(int pin_num, peripheral_gpio_edge_e edge, int *out_fd);
+
+/**
+ * @brief Reads an edge event from the file descriptor of resource_open_gpio_line_event().
+ * @param[in] fd The file descriptor
+ * @param[out] event The edge and its kernel timestamp in the monotonic clock
+ * @return 1 if an event is read, 0 if there is no pending event, otherwise a negative error value
+ */
+extern int resource_read_gpio_line_event(int fd, resource_gpio_line_event_s *event);
+
+/**
+ * @brief Releases the file descriptor of resource_open_gpio_line_event().
+ * @param[in] fd The file descriptor
+ */
+extern void resource_close_gpio_line_event(int fd);
+
+#endif /* __POSITION_FINDER_RESOURCE_GPIO_CHARDEV_H__ */
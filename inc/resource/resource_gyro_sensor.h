@@ -32,14 +32,131 @@
 #ifndef __POSITION_FINDER_RESOURCE_GYRO_SENSOR_H__
 #define __POSITION_FINDER_RESOURCE_GYRO_SENSOR_H__
 
+struct _resource_gyro_raw_s {
+	short accel[3]; /* x, y, z in ADC counts */
+	short temperature;
+	short gyro[3]; /* x, y, z in ADC counts */
+};
+typedef struct _resource_gyro_raw_s resource_gyro_raw_s;
+
+struct _resource_imu_sample_s {
+	float accel[3]; /* x, y, z in g */
+	float gyro[3]; /* x, y, z in degrees per second */
+	unsigned long long timestamp; /* monotonic in microseconds */
+};
+typedef struct _resource_imu_sample_s resource_imu_sample_s;
+
+struct _resource_gyro_calibration_s {
+	float gyro_bias[3]; /* deg/s, subtracted from the angular rate */
+	float accel_scale; /* the same for every axis, so that the accelerometer reads 1 g at rest */
+};
+typedef struct _resource_gyro_calibration_s resource_gyro_calibration_s;
+
+#define GYRO_CALIBRATION_SAMPLES 500 /* half a second at the output rate of the sensor */
+
+#define GYRO_FIFO_SAMPLE_MAX 85 /* samples the 1024-byte FIFO of the MPU6050 holds */
+#define GYRO_FIFO_RATE_MIN 4
+#define GYRO_FIFO_RATE_MAX 1000
+
+struct _resource_gyro_sample_s {
+	resource_gyro_raw_s raw; /* the temperature is not sampled into the FIFO */
+	unsigned long long timestamp; /* when the sample was taken, monotonic in microseconds */
+};
+typedef struct _resource_gyro_sample_s resource_gyro_sample_s;
+
+struct _resource_gyro_fifo_stats_s {
+	unsigned int rate; /* the sample rate set to the device in Hz */
+	unsigned long long samples; /* samples drained */
+	unsigned long long batches; /* times the FIFO was drained */
+	unsigned long long overflows; /* times the FIFO overflowed and was reset */
+	unsigned int max_batch; /* the most samples drained at once */
+};
+typedef struct _resource_gyro_fifo_stats_s resource_gyro_fifo_stats_s;
+
+/**
+ * @brief Called on the FIFO drain thread with the samples drained at once.
+ * @param[in] samples The samples, oldest first, valid only in the callback
+ * @param[in] count The number of the samples
+ * @param[in] data The data passed to resource_start_gyro_sensor_fifo()
+ */
+typedef void (*resource_gyro_batch_cb)(const resource_gyro_sample_s *samples, unsigned int count, void *data);
+
 /**
- * @brief Reads the value of gpio connected tilt sensor(SZH-EK084).
- * @param[in] pin_num The number of the gpio pin connected to the tilt sensor
- * @param[out] out_value The vaule of the gpio (zero or non-zero)
+ * @brief Reads the raw accelerometer, temperature and gyroscope values of the MPU6050 at once.
+ * @param[out] raw The raw values
+ * @return 0 on success, otherwise a negative error value
+ * @see The device is configured on the first read only, then a read is a single 14-byte burst.
+ */
+extern int resource_read_gyro_sensor_raw(resource_gyro_raw_s *raw);
+
+/**
+ * @brief Converts raw samples of the MPU6050 to physical units.
+ * @param[in] raw The raw samples
+ * @param[in] count The number of the samples
+ * @param[out] samples The converted samples, the timestamps are left untouched
+ */
+extern void resource_convert_gyro_sensor_raw(const resource_gyro_raw_s *raw, unsigned int count, resource_imu_sample_s *samples);
+
+/**
+ * @brief Reads the gyro sensor(MPU6050) and estimates the tilt around the x axis.
+ * @param[in] interval The time since the previous read in seconds
+ * @param[out] tilt The roll angle in degrees, fused from the gyroscope and the accelerometer
  * @return 0 on success, otherwise a negative error value
- *
- * @see If the gpio pin is not open, creates gpio handle before reading the value of gpio.
  */
 extern int resource_read_gyro_sensor(float interval, float *tilt);
 
-#endif /* __POSITION_FINDER_RESOURCE_TILT_SENSOR_H__ */
+/**
+ * @brief Starts to sample the MPU6050 into its FIFO and to drain it in bursts on a dedicated thread.
+ * @param[in] int_pin_num The number of the gpio pin connected to the INT pin, -1 to drain periodically instead
+ * @param[in] rate The sample rate in Hz, rounded to 1000 / n from GYRO_FIFO_RATE_MIN to GYRO_FIFO_RATE_MAX
+ * @param[in] batch The number of samples to let the FIFO gather after a data-ready interrupt before draining it,
+ * from 1 to GYRO_FIFO_SAMPLE_MAX
+ * @param[in] cb The function to be called with every batch of samples
+ * @param[in] data The data to be passed to the callback function
+ * @return 0 on success, otherwise a negative error value
+ * @remarks The timestamp of each sample is reconstructed from the sample rate,
+ * anchored to the kernel timestamps of the data-ready edges.
+ */
+extern int resource_start_gyro_sensor_fifo(int int_pin_num, unsigned int rate, unsigned int batch,
+	resource_gyro_batch_cb cb, void *data);
+
+/**
+ * @brief Stops the FIFO mode and restores the configuration of the MPU6050.
+ */
+extern void resource_stop_gyro_sensor_fifo(void);
+
+/**
+ * @brief Gets the statistics of the FIFO mode.
+ * @param[out] stats The statistics
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_get_gyro_sensor_fifo_stats(resource_gyro_fifo_stats_s *stats);
+
+/**
+ * @brief Calibrates the gyro sensor(MPU6050) from stationary samples and saves the result under the app data path.
+ * @param[in] count The number of samples to average, at least 50, e.g. GYRO_CALIBRATION_SAMPLES
+ * @param[out] out The calibration, may be NULL
+ * @return 0 on success, otherwise a negative error value (e.g. the device moved)
+ * @remarks Only the gyro bias and a uniform accelerometer scale are calibrated, from a single pose.
+ * The gyro bias is the mean angular rate, the accelerometer is scaled to read 1 g at rest.
+ * Per-axis scales and the accelerometer bias would need several poses and are not calibrated.
+ * Takes about count milliseconds. A calibration that cannot be saved is still used, the failure is only logged.
+ */
+extern int resource_calibrate_gyro_sensor(unsigned int count, resource_gyro_calibration_s *out);
+
+/**
+ * @brief Loads the saved calibration of the gyro sensor(MPU6050), or calibrates it if there is none.
+ * @param[in] count The number of samples to average if a calibration is needed
+ * @return 0 on success, otherwise a negative error value
+ * @remarks A saved calibration is only validated with a few samples,
+ * it is redone if the device is at rest and the gyro bias has changed.
+ * Without a saved calibration, a moving device is found out in a few samples and fails without calibrating.
+ */
+extern int resource_init_gyro_sensor_calibration(unsigned int count);
+
+/**
+ * @brief Releases the gyro sensor(MPU6050).
+ */
+extern void resource_close_gyro_sensor(void);
+
+#endif /* __POSITION_FINDER_RESOURCE_GYRO_SENSOR_H__ */
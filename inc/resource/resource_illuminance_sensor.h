@@ -22,14 +22,33 @@
 #ifndef __POSITION_FINDER_RESOURCE_ILLUMINANCE_SENSOR_H__
 #define __POSITION_FINDER_RESOURCE_ILLUMINANCE_SENSOR_H__
 
+typedef enum {
+	ILLUMINANCE_MODE_CONTINUOUS, /* converts all the time, a read returns the latest conversion */
+	ILLUMINANCE_MODE_ONE_TIME, /* converts once per read then powers down, for slow sampling */
+} resource_illuminance_mode_e;
+
 /**
  * @brief Reads the value of i2c bus connected illuminance sensor.
  * @param[in] i2c_bus The i2c bus number that the slave device is connected
  * @param[out] out_value The value read by the illuminance sensor
  * @return 0 on success, otherwise a negative error value
  * @see If the i2c bus is not open, creates i2c handle before reading data from the i2c slave device.
+ * The continuous mode is set only once, the first read after it waits for the first conversion.
  */
 extern int resource_read_illuminance_sensor(int i2c_bus, uint32_t *out_value);
 
+/**
+ * @brief Reads the value of the illuminance sensor without blocking, once the conversion is complete.
+ * @param[in] i2c_bus The i2c bus number that the slave device is connected
+ * @param[in] mode The measurement mode, ILLUMINANCE_MODE_ONE_TIME powers the sensor down between reads
+ * @param[in] cb The function to be called on the main loop with the value, -1 on failure
+ * @param[in] data The data to be passed to the callback function
+ * @return 0 on success, otherwise a negative error value (e.g. a read is already pending)
+ * @see In the continuous mode the value comes at once unless the conversion is still running,
+ * in the one time mode it comes after a full conversion of about 180 ms.
+ */
+extern int resource_read_illuminance_sensor_async(int i2c_bus, resource_illuminance_mode_e mode,
+	resource_read_cb cb, void *data);
+
 #endif /* __POSITION_FINDER_RESOURCE_ILLUMINANCE_SENSOR_H__ */
 
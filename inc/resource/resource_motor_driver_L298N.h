@@ -57,6 +57,36 @@ typedef enum {
 	MOTOR_ID_MAX
 } motor_id_e;
 
+/* The PWM value of the full speed */
+#define MOTOR_DRIVER_L298N_SPEED_MAX 4095
+
+/* Default differential drive, motors 1 and 3 on the left side, 2 and 4 on the right */
+#define DEFAULT_DRIVE_LEFT_MOTORS ((1U << MOTOR_ID_1) | (1U << MOTOR_ID_3))
+#define DEFAULT_DRIVE_RIGHT_MOTORS ((1U << MOTOR_ID_2) | (1U << MOTOR_ID_4))
+#define DEFAULT_DRIVE_TRACK_WIDTH 0.15 /* m */
+#define DEFAULT_DRIVE_MAX_WHEEL_SPEED 0.5 /* m/s */
+
+/**
+ * @brief Geometry of a differential drive built from the L298N motors.
+ */
+typedef struct {
+	unsigned int left_motors; /* bit mask of motor_id_e */
+	unsigned int right_motors; /* bit mask of motor_id_e */
+	double track_width; /* distance between the left and right wheels, in meters */
+	double max_wheel_speed; /* speed of a wheel at full duty, in meters per second */
+} resource_motor_drive_config_s;
+
+/**
+ * @brief Actuation latency of drive commands, from the call to the last bus write, in microseconds.
+ */
+typedef struct {
+	unsigned long long commands;
+	unsigned long long failures;
+	unsigned long long last_latency;
+	unsigned long long max_latency;
+	unsigned long long total_latency;
+} resource_motor_drive_stats_s;
+
 /**
  * @param[in] id The motor id
  * @param[in] pin1 The first pin number to control motor
@@ -79,4 +109,69 @@ int resource_set_motor_driver_L298N_configuration(motor_id_e id,
  */
 int resource_set_motor_driver_L298N_speed(motor_id_e id, int speed);
 
+/**
+ * @brief Sets which motors drive each side and the geometry used by resource_set_motor_driver_L298N_drive().
+ * @param[in] config The drive configuration
+ * @return 0 on success, otherwise a negative error value
+ * @remarks Without it, DEFAULT_DRIVE_* are used.
+ */
+int resource_set_motor_driver_L298N_drive_config(const resource_motor_drive_config_s *config);
+
+/**
+ * @brief Drives the robot with a linear and an angular velocity.
+ * @param[in] linear The forward velocity in meters per second, negative to go backward
+ * @param[in] angular The turn rate in radians per second, positive to turn left (counterclockwise)
+ * @return 0 on success, otherwise a negative error value
+ * @remarks If a wheel would exceed max_wheel_speed, both sides are scaled down to keep the curvature.
+ * Motors changing direction are disabled first in one PCA9685 transaction, their direction pins are set,
+ * then every PWM value goes out in one PCA9685 transaction.
+ */
+int resource_set_motor_driver_L298N_drive(double linear, double angular);
+
+/**
+ * @brief Brakes and stops every open motor at once and keeps them stopped.
+ * @return 0 on success, otherwise a negative error value
+ * @remarks Until resource_release_motor_driver_L298N_brake() is called,
+ * any command that would start a motor fails. The motors are held by the brake of the driver,
+ * with the enable at full duty and both pins equal, and the torque of resource_set_motor_driver_L298N_hold() is not applied.
+ */
+int resource_brake_motor_driver_L298N_all(void);
+
+/**
+ * @brief Allows the motors to be started again after resource_brake_motor_driver_L298N_all().
+ * @remarks The motors stay stopped until the next command,
+ * but they leave the brake of the driver and the torque of resource_set_motor_driver_L298N_hold() is applied again at once.
+ */
+void resource_release_motor_driver_L298N_brake(void);
+
+/**
+ * @brief Limits the forward speed of every motor.
+ * @param[in] limit The highest forward speed, from 0 to MOTOR_DRIVER_L298N_SPEED_MAX
+ * @return 0 on success, otherwise a negative error value
+ * @remarks A command with a motor going forward faster than the limit is scaled down, every motor
+ * of the command by the same factor. Commands going only backward are not limited,
+ * so the stroller can always back away from an obstacle ahead. Motors already running are scaled at once, and get the speed
+ * they were asked for back when the limit is raised.
+ */
+int resource_set_motor_driver_L298N_speed_limit(int limit);
+
+/**
+ * @brief Sets the torque every open motor holds against a slope, and how commands from rest are ramped in.
+ * @param[in] feedforward The speed added to the command of every open motor, positive to push forward,
+ * from -MOTOR_DRIVER_L298N_SPEED_MAX to MOTOR_DRIVER_L298N_SPEED_MAX, 0 for none
+ * @param[in] ramp_time Seconds a command starting from rest takes to reach its value, 0 to apply it at once
+ * @return 0 on success, otherwise a negative error value
+ * @remarks The hold stays applied to stopped motors, so that they don't roll back when stopped on a slope.
+ * While the brake is engaged or the speed limit is 0, stopped motors are held by the brake of the driver instead.
+ * Otherwise the speed limit applies to commands, not to the hold.
+ * A ramp only moves on when this is called again, so call it periodically while holding.
+ */
+int resource_set_motor_driver_L298N_hold(int feedforward, double ramp_time);
+
+/**
+ * @brief Gets the actuation latency of resource_set_motor_driver_L298N_drive() commands.
+ * @param[out] out The statistics
+ */
+void resource_get_motor_driver_L298N_drive_stats(resource_motor_drive_stats_s *out);
+
 #endif /* __RESOURCE_MOTOR_DRIVER_L298N_H__ */
@@ -19,6 +19,8 @@
 #ifndef __RESOURCE_MOTOR_DRIVER_L298N_INTERNAL_H__
 #define __RESOURCE_MOTOR_DRIVER_L298N_INTERNAL_H__
 
+#include "resource/resource_motor_driver_L298N.h"
+
 void resource_close_motor_driver_L298N(motor_id_e id);
 void resource_close_motor_driver_L298N_all(void);
 
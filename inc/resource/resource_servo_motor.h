@@ -33,4 +33,43 @@
  */
 int resource_set_servo_motor_value(unsigned int motor_id, int value);
 
+/**
+ * @brief The velocity curve of a servo move.
+ */
+typedef enum {
+	SERVO_PROFILE_TRAPEZOIDAL, /* constant acceleration, then cruise, then constant deceleration */
+	SERVO_PROFILE_S_CURVE, /* acceleration ramps up and down smoothly, no jerk steps */
+} resource_servo_profile_e;
+
+/**
+ * @brief Limits of a servo move, in the same units as the servo value.
+ */
+typedef struct {
+	resource_servo_profile_e type;
+	double max_velocity; /* values per second */
+	double acceleration; /* values per second^2, the peak for SERVO_PROFILE_S_CURVE */
+} resource_servo_profile_s;
+
+/**
+ * @brief Moves a servo motor to @a target along a motion profile, instead of jumping to it.
+ * @param[in] motor_id The motor id
+ * @param[in] target The value to end at
+ * @param[in] profile The velocity and acceleration limits of the move
+ * @return 0 on success, otherwise a negative error value
+ * @remarks Returns right away, intermediate values are written by a timer thread.
+ * All moving servos are updated together in one PCA9685 transaction per tick.
+ * A new target sent during a move is queued and started when the servo comes to rest, the latest one wins.
+ * resource_set_servo_motor_value() cancels a move in progress and the queued target.
+ * The first command to a servo is applied directly, its starting position isn't known before.
+ * @see resource_is_servo_motor_moving()
+ */
+int resource_move_servo_motor(unsigned int motor_id, int target, const resource_servo_profile_s *profile);
+
+/**
+ * @brief Checks whether a servo motor is still following a motion profile.
+ * @param[in] motor_id The motor id
+ * @return 1 while moving, 0 when settled, otherwise a negative error value
+ */
+int resource_is_servo_motor_moving(unsigned int motor_id);
+
 #endif /* __RESOURCE_SERVO_MOTOR_H__ */
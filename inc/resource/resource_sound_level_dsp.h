@@ -0,0 +1,65 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_RESOURCE_SOUND_LEVEL_DSP_H__
+#define __POSITION_FINDER_RESOURCE_SOUND_LEVEL_DSP_H__
+
+#define SOUND_LEVEL_COUNT_MAX 65536 /* samples per window, keeps the vector accumulators from overflowing */
+#define SOUND_LEVEL_DB_FLOOR -120.0
+
+typedef enum {
+	SOUND_LEVEL_KERNEL_AUTO,
+	SOUND_LEVEL_KERNEL_SCALAR,
+	SOUND_LEVEL_KERNEL_SSE2,
+	SOUND_LEVEL_KERNEL_AVX2,
+	SOUND_LEVEL_KERNEL_NEON,
+	SOUND_LEVEL_KERNEL_MAX
+} resource_sound_level_kernel_e;
+
+struct _resource_sound_level_s {
+	double mean; /* DC level in ADC counts */
+	double rms; /* DC-removed RMS in ADC counts */
+	double peak; /* largest distance from the DC level in ADC counts */
+	double crest; /* peak / rms, 0 on silence */
+	double db; /* RMS in dB relative to a full-scale sine of the 10-bit ADC, SOUND_LEVEL_DB_FLOOR on silence */
+};
+typedef struct _resource_sound_level_s resource_sound_level_s;
+
+/**
+ * @brief Computes the level of a window of sound samples with the fastest kernel of the CPU.
+ * @param[in] samples The raw ADC samples, each must be below 32768
+ * @param[in] count The number of the samples, from 1 to SOUND_LEVEL_COUNT_MAX
+ * @param[out] level The level of the window
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_compute_sound_level(const unsigned short *samples, unsigned int count, resource_sound_level_s *level);
+
+/**
+ * @brief Computes the level of a window of sound samples with the given kernel.
+ * @param[in] kernel The kernel to use
+ * @param[in] samples The raw ADC samples, each must be below 32768
+ * @param[in] count The number of the samples, from 1 to SOUND_LEVEL_COUNT_MAX
+ * @param[out] level The level of the window
+ * @return 0 on success, otherwise a negative error value (e.g. the kernel is not supported by the CPU)
+ */
+extern int resource_compute_sound_level_with_kernel(resource_sound_level_kernel_e kernel,
+	const unsigned short *samples, unsigned int count, resource_sound_level_s *level);
+
+/**
+ * @brief Measures every kernel supported by the CPU and logs the time per sample of each.
+ * @param[in] count The number of samples per window
+ * @param[in] iterations The number of windows to process with each kernel
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_benchmark_sound_level(unsigned int count, unsigned int iterations);
+
+#endif /* __POSITION_FINDER_RESOURCE_SOUND_LEVEL_DSP_H__ */
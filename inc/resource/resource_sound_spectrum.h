@@ -0,0 +1,52 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_RESOURCE_SOUND_SPECTRUM_H__
+#define __POSITION_FINDER_RESOURCE_SOUND_SPECTRUM_H__
+
+#define SOUND_SPECTRUM_FFT_MAX 1024 /* must be a power of 2 */
+
+#define SOUND_SPECTRUM_PITCH_MIN 300.0 /* Hz, the fundamental of an infant cry */
+#define SOUND_SPECTRUM_PITCH_MAX 600.0
+#define SOUND_SPECTRUM_HARMONIC_MAX 1800.0 /* Hz, up to the third harmonic */
+
+typedef enum {
+	SOUND_SPECTRUM_BAND_LOW, /* below the pitch band */
+	SOUND_SPECTRUM_BAND_PITCH, /* SOUND_SPECTRUM_PITCH_MIN to SOUND_SPECTRUM_PITCH_MAX */
+	SOUND_SPECTRUM_BAND_HARMONIC, /* SOUND_SPECTRUM_PITCH_MAX to SOUND_SPECTRUM_HARMONIC_MAX */
+	SOUND_SPECTRUM_BAND_HIGH, /* above the harmonic band */
+	SOUND_SPECTRUM_BAND_MAX
+} resource_sound_spectrum_band_e;
+
+struct _resource_sound_spectrum_s {
+	double total; /* energy of the whole spectrum without DC */
+	double band[SOUND_SPECTRUM_BAND_MAX]; /* energy of each band */
+	double pitch; /* strongest frequency of the pitch band in Hz */
+	double pitch_prominence; /* power at the pitch over the mean power of the pitch band */
+	double harmonic_ratio; /* mean power at the 2nd and 3rd harmonics of the pitch over the mean power of the spectrum */
+};
+typedef struct _resource_sound_spectrum_s resource_sound_spectrum_s;
+
+/**
+ * @brief Analyzes the spectrum of a window of sound samples with a fixed-point FFT.
+ * @param[in] samples The raw 10-bit ADC samples
+ * @param[in] count The number of the samples, a power of 2 from 64 to SOUND_SPECTRUM_FFT_MAX
+ * @param[in] rate The sampling rate in Hz
+ * @param[in] mean The DC level of the samples, e.g. from resource_compute_sound_level()
+ * @param[out] spectrum The features of the spectrum
+ * @return 0 on success, otherwise a negative error value
+ * @remarks A Hann window is applied. Not thread-safe, the tables are shared by all callers.
+ */
+extern int resource_analyze_sound_spectrum(const unsigned short *samples, unsigned int count,
+	unsigned int rate, double mean, resource_sound_spectrum_s *spectrum);
+
+#endif /* __POSITION_FINDER_RESOURCE_SOUND_SPECTRUM_H__ */
@@ -0,0 +1,85 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#ifndef __POSITION_FINDER_RESOURCE_ULTRASONIC_ARRAY_H__
+#define __POSITION_FINDER_RESOURCE_ULTRASONIC_ARRAY_H__
+
+#include "resource/resource_ultrasonic_sensor.h"
+#include "resource/resource_filter.h"
+
+#define ULTRASONIC_ARRAY_ORDER_MAX 16
+
+typedef enum {
+	ULTRASONIC_SECTOR_FRONT,
+	ULTRASONIC_SECTOR_LEFT,
+	ULTRASONIC_SECTOR_RIGHT,
+	ULTRASONIC_SECTOR_MAX
+} resource_ultrasonic_sector_e;
+
+struct _resource_ultrasonic_obstacle_s {
+	double distance[ULTRASONIC_SECTOR_MAX]; /* nearest obstacle in centimeters, -1 if nothing is in range */
+	unsigned long long timestamp[ULTRASONIC_SECTOR_MAX]; /* when the distance was measured, monotonic in microseconds */
+};
+typedef struct _resource_ultrasonic_obstacle_s resource_ultrasonic_obstacle_s;
+
+/**
+ * @brief Called on the array thread at the publish interval with the nearest obstacle of each sector.
+ * @param[in] obstacle The nearest obstacles, valid only in the callback
+ * @param[in] data The data passed to resource_start_ultrasonic_array()
+ */
+typedef void (*resource_ultrasonic_obstacle_cb)(const resource_ultrasonic_obstacle_s *obstacle, void *data);
+
+/**
+ * @brief Adds an ultrasonic sensor to the array.
+ * @param[in] trig_pin_num The number of the gpio pin connected to the trig of the ultrasonic sensor
+ * @param[in] echo_pin_num The number of the gpio pin connected to the echo of the ultrasonic sensor
+ * @param[in] sector The sector the sensor is looking at
+ * @return The index of the sensor in the array on success, otherwise a negative error value
+ * @see Sensors are fired in the order they are added unless resource_set_ultrasonic_array_order() is called.
+ */
+extern int resource_add_ultrasonic_array_sensor(int trig_pin_num, int echo_pin_num, resource_ultrasonic_sector_e sector);
+
+/**
+ * @brief Sets the order to fire the sensors of the array.
+ * @param[in] indices The indices of the sensors, a sensor may appear more than once to be fired more often
+ * @param[in] count The number of the indices
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_set_ultrasonic_array_order(const int *indices, unsigned int count);
+
+/**
+ * @brief Sets the filter applied to the distances of each sensor of the array.
+ * @param[in] config The configuration of the filter, the distances are not filtered if NULL
+ * @return 0 on success, otherwise a negative error value
+ * @see By default a median of 5 samples is used, jumps faster than 400 cm/s are rejected
+ * and the last valid distance is held for 300 ms.
+ */
+extern int resource_set_ultrasonic_array_filter(const resource_filter_config_s *config);
+
+/**
+ * @brief Starts to fire the sensors one by one in round-robin order.
+ * @param[in] guard_interval The idle time between the end of a measurement and the next trigger in seconds,
+ * it lets late echoes fade out so that a sensor does not hear the ping of another one
+ * @param[in] publish_interval The interval to publish the nearest obstacles in seconds
+ * @param[in] cb The function to be called with the nearest obstacles
+ * @param[in] data The data to be passed to the callback function
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_start_ultrasonic_array(double guard_interval, double publish_interval,
+	resource_ultrasonic_obstacle_cb cb, void *data);
+
+/**
+ * @brief Stops to fire the sensors of the array.
+ */
+extern void resource_stop_ultrasonic_array(void);
+
+#endif /* __POSITION_FINDER_RESOURCE_ULTRASONIC_ARRAY_H__ */
@@ -22,15 +22,70 @@
 #ifndef __POSITION_FINDER_RESOURCE_ULTRASONIC_SENSOR_H__
 #define __POSITION_FINDER_RESOURCE_ULTRASONIC_SENSOR_H__
 
+#define ULTRASONIC_SENSOR_MAX 4
+
+struct _resource_ultrasonic_quality_s {
+	int kernel_timestamp; /* 1 if the echo edges are timestamped by the kernel */
+	unsigned long long echo_width; /* width of the last echo pulse, in microseconds */
+	unsigned long long latency; /* delay from the last falling edge to its handling, in microseconds */
+	unsigned long long max_latency;
+	double jitter; /* smoothed variation of the latency, in microseconds */
+	unsigned long long timestamp; /* when the last measurement was completed, monotonic in microseconds */
+};
+typedef struct _resource_ultrasonic_quality_s resource_ultrasonic_quality_s;
+
 /**
  * @brief Reads the value of gpio connected ultrasonic sensor(HC-SR04).
  * @param[in] trig_pin_num The number of the gpio pin connected to the trig of the ultrasonic sensor
  * @param[in] echo_pin_num The number of the gpio pin connected to the echo of the ultrasonic sensor
- * @param[in] cb A callback function to be invoked when the gpio interrupt is triggered
+ * @param[in] cb A callback function to be invoked on the main loop when the measurement is completed,
+ * the distance is given in centimeters or -1 if it is out of range or the echo timed out
  * @param[in] data The data to be passed to the callback function
  * @return 0 on success, otherwise a negative error value
+ * @remarks This function returns right after starting the trigger pulse, it never blocks the caller.
  * @see If the gpio pin is not open, creates gpio handle before reading the value of gpio.
+ * @see Each trig/echo pair is measured independently, up to ULTRASONIC_SENSOR_MAX sensors.
+ * @see Fails while the previous measurement of the same sensor is not completed yet.
  */
 extern int resource_read_ultrasonic_sensor(int trig_pin_num, int echo_pin_num, resource_read_cb cb, void *data);
 
+/**
+ * @brief Gets the measurement quality of the ultrasonic sensor.
+ * @param[in] echo_pin_num The number of the gpio pin connected to the echo of the ultrasonic sensor
+ * @param[out] out_quality The quality of the last measurement
+ * @return 0 on success, otherwise a negative error value
+ * @remarks The latency shows how much error a user-space timestamp would have added,
+ * it is only measured when the echo edges are timestamped by the kernel.
+ */
+extern int resource_get_ultrasonic_sensor_quality(int echo_pin_num, resource_ultrasonic_quality_s *out_quality);
+
+/**
+ * @brief Reads the ultrasonic sensor like resource_read_ultrasonic_sensor(), but the caller dispatches it.
+ * @param[in] trig_pin_num The number of the gpio pin connected to the trig of the ultrasonic sensor
+ * @param[in] echo_pin_num The number of the gpio pin connected to the echo of the ultrasonic sensor
+ * @param[in] cb A callback function to be invoked when the measurement is completed
+ * @param[in] data The data to be passed to the callback function
+ * @return 0 on success, otherwise a negative error value
+ * @remarks The sensor is not watched on the main loop, poll the fds of resource_get_ultrasonic_sensor_fds()
+ * and call resource_dispatch_ultrasonic_sensor() when one is readable, the callback is called from there.
+ * Without kernel timestamps the echo edges still come in on the main loop.
+ * @see A sensor is either polled or read on the main loop, from its first read on.
+ */
+extern int resource_read_ultrasonic_sensor_polled(int trig_pin_num, int echo_pin_num, resource_read_cb cb, void *data);
+
+/**
+ * @brief Gets the fds of a polled ultrasonic sensor.
+ * @param[in] echo_pin_num The number of the gpio pin connected to the echo of the ultrasonic sensor
+ * @param[out] out_timer_fd The fd of the trigger and echo timeout timer, -1 if not open yet
+ * @param[out] out_echo_fd The fd of the echo edges, -1 if they are not timestamped by the kernel
+ * @return 0 on success, otherwise a negative error value
+ */
+extern int resource_get_ultrasonic_sensor_fds(int echo_pin_num, int *out_timer_fd, int *out_echo_fd);
+
+/**
+ * @brief Handles the pending trigger timer and echo edges of a polled ultrasonic sensor.
+ * @param[in] echo_pin_num The number of the gpio pin connected to the echo of the ultrasonic sensor
+ */
+extern void resource_dispatch_ultrasonic_sensor(int echo_pin_num);
+
 #endif /* __POSITION_FINDER_RESOURCE_ULTRASONIC_SENSOR_H__ */
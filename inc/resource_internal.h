@@ -50,6 +50,7 @@
 #include "resource/resource_sound_level_sensor_internal.h"
 #include "resource/resource_motor_driver_L298N_internal.h"
 #include "resource/resource_pressure_sensor_internal.h"
+#include "resource/resource_servo_motor_internal.h"
 
 #define PIN_MAX 40
 
@@ -69,7 +70,39 @@ struct _resource_read_cb_s {
 };
 typedef struct _resource_read_cb_s resource_read_s;
 
+struct _resource_gpio_event_s {
+	int pin_num;
+	uint32_t value;
+	unsigned long long timestamp; /* monotonic, in microseconds */
+};
+typedef struct _resource_gpio_event_s resource_gpio_event_s;
+
+typedef void (*resource_gpio_event_cb)(const resource_gpio_event_s *event, void *data);
+
 extern resource_s *resource_get_info(int pin_num);
 extern void resource_close_all(void);
 
+/**
+ * @brief Subscribes edge events of a digital input gpio pin.
+ * @param[in] pin_num The number of the gpio pin
+ * @param[in] edge The edge to be notified
+ * @param[in] debounce_ms Edges which come within this time after the last notified edge are ignored
+ * @param[in] cb The function to be called on the main loop with the debounced and timestamped value
+ * @param[in] data The data to be passed to the callback function
+ * @param[in] close The function to release the pin, used when the pin is not open yet
+ * @return 0 on success, otherwise a negative error value
+ * @remarks With PERIPHERAL_GPIO_EDGE_BOTH, the pin is read again when the debounce ends,
+ * and the level is notified if the ignored edges left it different from the last notified one.
+ * The resource_subscribe_*_sensor() functions of the gpio sensors subscribe both edges with this.
+ * @see If the gpio pin is not open, creates gpio handle before subscribing.
+ */
+extern int resource_subscribe_gpio_event(int pin_num, peripheral_gpio_edge_e edge, unsigned int debounce_ms,
+	resource_gpio_event_cb cb, void *data, void (*close) (int));
+
+/**
+ * @brief Unsubscribes edge events of a gpio pin, does nothing if the pin is not subscribed.
+ * @param[in] pin_num The number of the gpio pin
+ */
+extern void resource_unsubscribe_gpio_event(int pin_num);
+
 #endif /* __POSITION_FINDER_RESOURCE_INTERNAL_H__ */
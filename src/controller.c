@@ -30,17 +30,42 @@
 #include "connectivity.h"
 #include "controller.h"
 #include "controller_util.h"
+#include "controller_scheduler.h"
+#include "controller_acquisition.h"
+#include "controller_sound.h"
+#include "controller_safety.h"
+#include "controller_governor.h"
+#include "controller_hill_hold.h"
 #include "webutil.h"
 
 #define CONNECTIVITY_KEY "opened"
 #define SENSORING_TIME_INTERVAL 5.0f
+#define SENSORING_PRIORITY 0
 #define CAMERA_TIME_INTERVAL 2
 #define TEST_CAMERA_SAVE 0
 #define CAMERA_ENABLED 0
+#define SOUND_LEVEL_CH 0
+#define SOUND_SAMPLING_RATE 8000
+#define SOUND_WINDOW 1024
+#define SOUND_BENCHMARK 0
+#define HANDLE_PRESSURE_CH 1
+#define OBSTACLE_IR_PIN 21
+#define FRONT_ULTRASONIC_TRIG_PIN 5
+#define FRONT_ULTRASONIC_ECHO_PIN 13
+#define ULTRASONIC_GUARD_INTERVAL 0.01
+#define ULTRASONIC_PUBLISH_INTERVAL 0.05
+#define GYRO_INT_PIN 24
+#define GYRO_CALIBRATION_RETRY_INTERVAL 5.0
 
 typedef struct app_data_s {
-	Ecore_Timer *getter_timer;
+#if CAMERA_ENABLED
+	controller_scheduler_s *scheduler;
+#endif
+	int motion_sensor_id;
+	double loudest_db;
+	unsigned long long loudest_notified;
 	connectivity_resource_s *resource_info;
+	Ecore_Timer *calibration_timer;
 } app_data;
 
 static void __resource_camera_capture_completed_cb(const void *image, unsigned int size, void *user_data)
@@ -81,28 +106,108 @@ static void __resource_camera_capture_completed_cb(const void *image, unsigned i
 #endif
 }
 
-static Eina_Bool control_sensors_cb(void *data)
+#if CAMERA_ENABLED
+static void control_camera_cb(void *data)
 {
-	app_data *ad = data;
-	int value = 1;
 	int ret = 0;
-#if CAMERA_ENABLED
-	static unsigned int count = 0;
-
-	if (count % CAMERA_TIME_INTERVAL == 0) {
-		ret = resource_capture_camera(__resource_camera_capture_completed_cb, NULL);
-		if (ret < 0)
-			_E("Failed to capture camera");
-	}
 
-	count++;
+	ret = resource_capture_camera(__resource_camera_capture_completed_cb, NULL);
+	if (ret < 0)
+		_E("Failed to capture camera");
+}
 #endif
 
+static int read_motion_sensor_cb(double *out_value, void *data)
+{
 	/* This is example, get value from sensors first */
-	if (connectivity_notify_int(ad->resource_info, "Motion", value) == -1)
+	*out_value = 1;
+
+	return 0;
+}
+
+static void control_sensors_cb(const controller_sample_s *sample, void *data)
+{
+	app_data *ad = data;
+
+	if (sample->error) {
+		_E("Failed to read sensor[%d]", sample->sensor_id);
+		return;
+	}
+
+	if (sample->sensor_id == ad->motion_sensor_id) {
+		if (connectivity_notify_int(ad->resource_info, "Motion", (int)sample->value) == -1)
+			_E("Cannot notify message");
+	}
+}
+
+static void control_sound_level_cb(const resource_sound_level_s *level, unsigned long long timestamp, void *data)
+{
+	app_data *ad = data;
+
+	if (level->db > ad->loudest_db)
+		ad->loudest_db = level->db;
+
+	/* Windows come several times a second, only the loudest one of each sensing interval is sent */
+	if (timestamp - ad->loudest_notified < SENSORING_TIME_INTERVAL * 1000000)
+		return;
+
+	if (connectivity_notify_double(ad->resource_info, "SoundLevel", ad->loudest_db) == -1)
 		_E("Cannot notify message");
 
-	return ECORE_CALLBACK_RENEW;
+	ad->loudest_db = SOUND_LEVEL_DB_FLOOR;
+	ad->loudest_notified = timestamp;
+}
+
+static void control_cry_cb(bool crying, unsigned long long timestamp, void *data)
+{
+	app_data *ad = data;
+
+	if (connectivity_notify_bool(ad->resource_info, "Crying", crying) == -1)
+		_E("Cannot notify message");
+}
+
+static void control_obstacle_cb(const resource_ultrasonic_obstacle_s *obstacle, void *data)
+{
+	controller_governor_update_ultrasonic(obstacle);
+}
+
+static void control_safety_brake_cb(bool braked, unsigned long long timestamp, void *data)
+{
+	app_data *ad = data;
+
+	if (connectivity_notify_bool(ad->resource_info, "HandleReleased", braked) == -1)
+		_E("Cannot notify message");
+}
+
+static void start_hill_hold(void)
+{
+	int ret = 0;
+
+	/**
+	 * The hill-hold runs on the real-time IMU drain thread, the pitch is turned into holding torque
+	 * within a batch of samples, without a round trip through the main loop.
+	 */
+	ret = controller_hill_hold_start(GYRO_INT_PIN, NULL);
+	if (ret < 0)
+		_E("Failed to start hill-hold");
+}
+
+static Eina_Bool retry_gyro_calibration_cb(void *data)
+{
+	app_data *ad = data;
+	int ret = 0;
+
+	/* A moving stroller fails within about 50 ms, the full calibration only blocks a stroller at rest */
+	ret = resource_init_gyro_sensor_calibration(GYRO_CALIBRATION_SAMPLES);
+	if (ret < 0) {
+		_W("Gyro sensor is still not calibrated, hill-hold stays off");
+		return ECORE_CALLBACK_RENEW;
+	}
+
+	ad->calibration_timer = NULL;
+	start_hill_hold();
+
+	return ECORE_CALLBACK_CANCEL;
 }
 
 static bool service_app_create(void *data)
@@ -131,16 +236,116 @@ static bool service_app_create(void *data)
 	ret = connectivity_set_resource(path, "org.tizen.door", &ad->resource_info);
 	if (ret == -1) _E("Cannot broadcast resource");
 
+#if CAMERA_ENABLED
+	/**
+	 * Creates a scheduler to call the given functions on the main loop in their own period of time.
+	 * Each task has its own period, deadline and priority,
+	 * tasks are called in earliest-deadline-first order and missed deadlines are reported.
+	 * The camera is its only task, the sensors have the acquisition thread below.
+	 */
+	ad->scheduler = controller_scheduler_create();
+	if (!ad->scheduler) {
+		_E("Failed to create scheduler");
+		return false;
+	}
+
+	ret = controller_scheduler_add_task(ad->scheduler, "camera",
+			SENSORING_TIME_INTERVAL * CAMERA_TIME_INTERVAL, 0.0, SENSORING_PRIORITY, control_camera_cb, ad);
+	if (ret < 0) {
+		_E("Failed to add camera task");
+		return false;
+	}
+
+	ret = controller_scheduler_start(ad->scheduler);
+	if (ret < 0) {
+		_E("Failed to start scheduler");
+		return false;
+	}
+#endif
+
+	/**
+	 * Sensors are read on a dedicated acquisition thread, so a slow upload never delays a sensor read.
+	 * Each sensor is read in its own period of time and the samples are delivered
+	 * to control_sensors_cb() on the main loop.
+	 */
+	ret = controller_acquisition_init(control_sensors_cb, ad);
+	if (ret < 0) {
+		_E("Failed to initialize acquisition");
+		return false;
+	}
+
+	ad->motion_sensor_id = controller_acquisition_add_sensor("motion",
+			SENSORING_TIME_INTERVAL, 0.0, SENSORING_PRIORITY, read_motion_sensor_cb, ad);
+	if (ad->motion_sensor_id < 0) {
+		_E("Failed to add infrared motion sensor");
+		return false;
+	}
+
 	/**
-	 * Creates a timer to call the given function in the given period of time.
-	 * In the control_sensors_cb(), each sensor reads the measured value or writes a specific value to the sensor.
+	 * The speed governor is evaluated with the sensors on the acquisition thread, not on the sensing interval,
+	 * so that the motors slow down within tens of milliseconds of an obstacle coming closer.
 	 */
-	ad->getter_timer = ecore_timer_add(SENSORING_TIME_INTERVAL, control_sensors_cb, ad);
-	if (!ad->getter_timer) {
-		_E("Failed to add infrared motion getter timer");
+	ret = controller_governor_init(OBSTACLE_IR_PIN, NULL);
+	if (ret < 0)
+		_E("Failed to add speed governor");
+
+	ret = controller_acquisition_start();
+	if (ret < 0) {
+		_E("Failed to start acquisition");
 		return false;
 	}
 
+	/**
+	 * The ultrasonic sensors are fired and published on the array thread, not on the main loop,
+	 * so an upload blocked in the network never holds the front distance back from the governor.
+	 */
+	ret = resource_add_ultrasonic_array_sensor(FRONT_ULTRASONIC_TRIG_PIN, FRONT_ULTRASONIC_ECHO_PIN, ULTRASONIC_SECTOR_FRONT);
+	if (ret >= 0)
+		ret = resource_start_ultrasonic_array(ULTRASONIC_GUARD_INTERVAL, ULTRASONIC_PUBLISH_INTERVAL, control_obstacle_cb, ad);
+	if (ret < 0)
+		_E("Failed to start ultrasonic array");
+
+	/**
+	 * The handle is watched on its own real-time thread, apart from the main loop and networking.
+	 * When it is let go, the motors are braked from that thread, the main loop is only told afterwards.
+	 */
+	ret = controller_safety_start(HANDLE_PRESSURE_CH, NULL, control_safety_brake_cb, ad);
+	if (ret < 0)
+		_E("Failed to start safety loop");
+
+	/**
+	 * The saved gyro calibration is only validated in about 50 ms, a full calibration runs on the first start only
+	 * and blocks here for about half a second. It is kept here on purpose: the stroller must be at rest,
+	 * and the hill-hold below must not start on an uncalibrated gyro.
+	 */
+	ret = resource_init_gyro_sensor_calibration(GYRO_CALIBRATION_SAMPLES);
+	if (ret < 0) {
+		/* Calibrate again later, when the stroller may be at rest, and only then hold it on slopes */
+		_W("Gyro sensor is not calibrated, hill-hold is deferred");
+		ad->calibration_timer = ecore_timer_add(GYRO_CALIBRATION_RETRY_INTERVAL, retry_gyro_calibration_cb, ad);
+		if (!ad->calibration_timer)
+			_E("Failed to add gyro calibration timer");
+	} else {
+		start_hill_hold();
+	}
+
+#if SOUND_BENCHMARK
+	resource_benchmark_sound_level(SOUND_WINDOW, 1000);
+#endif
+
+	/**
+	 * The sound level sensor is sampled at audio rate and analyzed window by window on its own thread.
+	 * Only the crying state leaves the device, never the sound itself.
+	 */
+	ret = controller_sound_set_cry_detector(NULL, control_cry_cb, ad);
+	if (ret < 0)
+		_E("Failed to set cry detector");
+
+	ad->loudest_db = SOUND_LEVEL_DB_FLOOR;
+	ret = controller_sound_start(SOUND_LEVEL_CH, SOUND_SAMPLING_RATE, SOUND_WINDOW, control_sound_level_cb, ad);
+	if (ret < 0)
+		_E("Failed to start sound analysis");
+
 	return true;
 }
 
@@ -148,8 +353,19 @@ static void service_app_terminate(void *data)
 {
 	app_data *ad = (app_data *)data;
 
-	if (ad->getter_timer)
-		ecore_timer_del(ad->getter_timer);
+	if (ad->calibration_timer)
+		ecore_timer_del(ad->calibration_timer);
+
+	controller_hill_hold_stop();
+	controller_safety_stop();
+	controller_sound_stop();
+	controller_acquisition_fini();
+	controller_governor_fini();
+
+#if CAMERA_ENABLED
+	if (ad->scheduler)
+		controller_scheduler_destroy(ad->scheduler);
+#endif
 
 
 	/**
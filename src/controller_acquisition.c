@@ -0,0 +1,265 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <Ecore.h>
+
+#include "log.h"
+#include "controller_scheduler.h"
+#include "controller_acquisition.h"
+
+#define ACQUISITION_IDLE_INTERVAL 0.1 /* upper bound of a sleep, to notice the stop request */
+#define RING_MASK (CONTROLLER_ACQUISITION_RING_SIZE - 1)
+
+typedef struct _acquisition_sensor_s {
+	int used;
+	int id;
+	controller_acquisition_read_cb read_cb;
+	void *data;
+} acquisition_sensor_s;
+
+/*
+ * Single-producer/single-consumer ring.
+ * Only the acquisition thread moves the head and only the main loop moves the tail.
+ */
+typedef struct _acquisition_ring_s {
+	controller_sample_s samples[CONTROLLER_ACQUISITION_RING_SIZE];
+	unsigned int head;
+	unsigned int tail;
+} acquisition_ring_s;
+
+static struct {
+	int initialized;
+	int running;
+	int stop_requested;
+	int wakeup_pending;
+	unsigned int dropped;
+	pthread_t thread;
+	controller_scheduler_s *scheduler;
+	Ecore_Pipe *pipe;
+	controller_acquisition_sample_cb sample_cb;
+	void *sample_data;
+	acquisition_sensor_s sensors[CONTROLLER_SCHEDULER_TASK_MAX];
+	acquisition_ring_s ring;
+} acquisition;
+
+static unsigned long long _get_timestamp(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec) / 1000;
+}
+
+static int __ring_push(acquisition_ring_s *ring, const controller_sample_s *sample)
+{
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= CONTROLLER_ACQUISITION_RING_SIZE)
+		return -1;
+
+	ring->samples[head & RING_MASK] = *sample;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static int __ring_pop(acquisition_ring_s *ring, controller_sample_s *sample)
+{
+	unsigned int tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	unsigned int head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return -1;
+
+	*sample = ring->samples[tail & RING_MASK];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+static void __pipe_cb(void *data, void *buffer, unsigned int nbyte)
+{
+	controller_sample_s sample;
+
+	/* Clear the flag first, a sample pushed while draining will wake us up again */
+	__atomic_store_n(&acquisition.wakeup_pending, 0, __ATOMIC_SEQ_CST);
+
+	while (__ring_pop(&acquisition.ring, &sample) == 0) {
+		if (acquisition.sample_cb)
+			acquisition.sample_cb(&sample, acquisition.sample_data);
+	}
+}
+
+static void __read_sensor_task_cb(void *data)
+{
+	acquisition_sensor_s *sensor = data;
+	controller_sample_s sample;
+	int ret = 0;
+
+	memset(&sample, 0, sizeof(controller_sample_s));
+	sample.sensor_id = sensor->id;
+
+	ret = sensor->read_cb(&sample.value, sensor->data);
+	sample.timestamp = _get_timestamp();
+	sample.error = ret < 0 ? ret : 0;
+
+	if (__ring_push(&acquisition.ring, &sample) < 0) {
+		__atomic_add_fetch(&acquisition.dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	if (__atomic_exchange_n(&acquisition.wakeup_pending, 1, __ATOMIC_SEQ_CST) == 0)
+		ecore_pipe_write(acquisition.pipe, "s", 1);
+}
+
+static void *__acquisition_thread(void *data)
+{
+	struct timespec wakeup;
+	double now = 0.0;
+	double next = 0.0;
+	int ret = 0;
+
+	_I("Acquisition thread is running...");
+
+	while (!__atomic_load_n(&acquisition.stop_requested, __ATOMIC_ACQUIRE)) {
+		now = controller_scheduler_get_time();
+		next = controller_scheduler_dispatch(acquisition.scheduler, now);
+
+		now = controller_scheduler_get_time();
+		if (next < 0.0 || next > now + ACQUISITION_IDLE_INTERVAL)
+			next = now + ACQUISITION_IDLE_INTERVAL;
+
+		wakeup.tv_sec = (time_t)next;
+		wakeup.tv_nsec = (long)((next - (double)wakeup.tv_sec) * 1000000000.0);
+
+		do {
+			ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+		} while (ret == EINTR);
+	}
+
+	_I("Acquisition thread is finishing...");
+
+	return NULL;
+}
+
+int controller_acquisition_init(controller_acquisition_sample_cb cb, void *data)
+{
+	if (acquisition.initialized) {
+		_D("acquisition is already initialized");
+		return 0;
+	}
+
+	acquisition.scheduler = controller_scheduler_create();
+	retv_if(!acquisition.scheduler, -1);
+
+	acquisition.pipe = ecore_pipe_add(__pipe_cb, NULL);
+	if (!acquisition.pipe) {
+		_E("Failed to add ecore pipe");
+		controller_scheduler_destroy(acquisition.scheduler);
+		acquisition.scheduler = NULL;
+		return -1;
+	}
+
+	acquisition.sample_cb = cb;
+	acquisition.sample_data = data;
+	acquisition.initialized = 1;
+
+	return 0;
+}
+
+int controller_acquisition_add_sensor(const char *name, double period, double deadline,
+	int priority, controller_acquisition_read_cb read_cb, void *data)
+{
+	acquisition_sensor_s *sensor = NULL;
+	int ret = 0;
+	int i = 0;
+
+	retvm_if(!acquisition.initialized, -1, "acquisition is not initialized");
+	retvm_if(acquisition.running, -1, "cannot add a sensor while running");
+	retv_if(!read_cb, -1);
+
+	for (i = 0; i < CONTROLLER_SCHEDULER_TASK_MAX; i++) {
+		if (!acquisition.sensors[i].used)
+			break;
+	}
+	retvm_if(i == CONTROLLER_SCHEDULER_TASK_MAX, -1, "too many sensors[%d]", i);
+
+	sensor = &acquisition.sensors[i];
+	sensor->id = i;
+	sensor->read_cb = read_cb;
+	sensor->data = data;
+
+	ret = controller_scheduler_add_task(acquisition.scheduler, name,
+			period, deadline, priority, __read_sensor_task_cb, sensor);
+	retv_if(ret < 0, -1);
+
+	sensor->used = 1;
+
+	return sensor->id;
+}
+
+int controller_acquisition_start(void)
+{
+	int ret = 0;
+
+	retvm_if(!acquisition.initialized, -1, "acquisition is not initialized");
+
+	if (acquisition.running) {
+		_D("acquisition thread is already running");
+		return 0;
+	}
+
+	acquisition.stop_requested = 0;
+
+	ret = pthread_create(&acquisition.thread, NULL, __acquisition_thread, NULL);
+	retvm_if(ret != 0, -1, "Failed to create acquisition thread[%d]", ret);
+
+	acquisition.running = 1;
+
+	return 0;
+}
+
+void controller_acquisition_stop(void)
+{
+	if (!acquisition.running)
+		return;
+
+	__atomic_store_n(&acquisition.stop_requested, 1, __ATOMIC_RELEASE);
+	pthread_join(acquisition.thread, NULL);
+	acquisition.running = 0;
+}
+
+unsigned int controller_acquisition_get_dropped_count(void)
+{
+	return __atomic_load_n(&acquisition.dropped, __ATOMIC_RELAXED);
+}
+
+void controller_acquisition_fini(void)
+{
+	if (!acquisition.initialized)
+		return;
+
+	controller_acquisition_stop();
+
+	if (acquisition.pipe) {
+		ecore_pipe_del(acquisition.pipe);
+		acquisition.pipe = NULL;
+	}
+
+	controller_scheduler_destroy(acquisition.scheduler);
+	memset(&acquisition, 0, sizeof(acquisition));
+}
@@ -0,0 +1,228 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "resource.h"
+#include "controller_acquisition.h"
+#include "controller_governor.h"
+
+#define GOVERNOR_PERIOD 0.02
+#define GOVERNOR_STOP_DISTANCE 20.0
+#define GOVERNOR_FULL_DISTANCE 150.0
+#define GOVERNOR_HYSTERESIS 10.0
+#define GOVERNOR_IR_DISTANCE 15.0
+#define GOVERNOR_STALE_TIME 0.5
+/* Ahead of the other sensors of the acquisition when their deadlines meet */
+#define GOVERNOR_PRIORITY 10
+
+/*
+ * The ultrasonic distance is written on the ultrasonic array thread and read on the acquisition thread,
+ * everything else belongs to the acquisition thread.
+ */
+static struct {
+	int initialized;
+	int ir_pin;
+	controller_governor_config_s config;
+	double ultrasonic_distance; /* -1 if nothing is in range */
+	unsigned long long ultrasonic_timestamp;
+	unsigned long long start_time;
+	double effective_distance; /* the nearest obstacle after hysteresis */
+	pthread_mutex_t lock;
+	controller_governor_stats_s stats;
+} governor = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static unsigned long long _get_timestamp(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec) / 1000;
+}
+
+static int __distance_to_limit(double distance)
+{
+	const controller_governor_config_s *config = &governor.config;
+
+	if (isinf(distance) || distance >= config->full_distance)
+		return MOTOR_DRIVER_L298N_SPEED_MAX;
+
+	if (distance <= config->stop_distance)
+		return 0;
+
+	return (int)lround(MOTOR_DRIVER_L298N_SPEED_MAX
+		* (distance - config->stop_distance) / (config->full_distance - config->stop_distance));
+}
+
+static int __read_governor_cb(double *out_value, void *data)
+{
+	unsigned long long now = _get_timestamp();
+	unsigned long long measured = 0;
+	unsigned long long latency = 0;
+	unsigned long long age = 0;
+	double distance = -1;
+	double nearest = INFINITY;
+	uint32_t ir_value = 0;
+	bool stale = false;
+	int limit = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&governor.lock);
+	distance = governor.ultrasonic_distance;
+	measured = governor.ultrasonic_timestamp;
+	pthread_mutex_unlock(&governor.lock);
+
+	/* The array thread may have stopped measuring, e.g. a sensor that can't be opened */
+	age = now - (measured ? measured : governor.start_time);
+	stale = !measured || age > governor.config.stale_time * 1000000.0;
+	if (!stale && distance >= 0)
+		nearest = distance;
+
+	if (governor.ir_pin >= 0) {
+		ret = resource_read_infrared_obstacle_avoidance_sensor(governor.ir_pin, &ir_value);
+		if (ret == 0 && ir_value && governor.config.ir_distance < nearest) {
+			nearest = governor.config.ir_distance;
+			measured = now;
+		}
+	}
+
+	/* Without a fresh front distance nothing ahead is known, stop instead of failing open */
+	if (stale)
+		nearest = governor.config.stop_distance;
+
+	/* Closer obstacles count at once, farther ones only past the hysteresis */
+	if (nearest < governor.effective_distance)
+		governor.effective_distance = nearest;
+	else if (nearest > governor.effective_distance + governor.config.hysteresis)
+		governor.effective_distance = nearest - governor.config.hysteresis;
+
+	limit = __distance_to_limit(governor.effective_distance);
+
+	pthread_mutex_lock(&governor.lock);
+	governor.stats.evaluations++;
+	if (stale)
+		governor.stats.stale_evaluations++;
+	governor.stats.last_age = age;
+	if (age > governor.stats.max_age)
+		governor.stats.max_age = age;
+	governor.stats.distance = isinf(governor.effective_distance) ? -1 : governor.effective_distance;
+	pthread_mutex_unlock(&governor.lock);
+
+	*out_value = limit;
+
+	if (limit == governor.stats.limit)
+		return 0;
+
+	ret = resource_set_motor_driver_L298N_speed_limit(limit);
+	if (ret < 0) {
+		_E("Failed to set speed limit[%d]", limit);
+		return -1;
+	}
+
+	pthread_mutex_lock(&governor.lock);
+	/* Only slowing down is a reaction, it is timed from the measurement of the obstacle */
+	if (limit < governor.stats.limit && measured && measured <= now) {
+		latency = _get_timestamp() - measured;
+		governor.stats.last_latency = latency;
+		if (latency > governor.stats.max_latency)
+			governor.stats.max_latency = latency;
+	}
+	governor.stats.limit = limit;
+	governor.stats.limit_changes++;
+	pthread_mutex_unlock(&governor.lock);
+
+	_D("speed limit[%d] - obstacle[%.1f cm], reaction[%llu us]", limit, governor.stats.distance, latency);
+
+	return 0;
+}
+
+int controller_governor_init(int ir_pin_num, const controller_governor_config_s *config)
+{
+	controller_governor_config_s defaults = {
+		.period = GOVERNOR_PERIOD,
+		.stop_distance = GOVERNOR_STOP_DISTANCE,
+		.full_distance = GOVERNOR_FULL_DISTANCE,
+		.hysteresis = GOVERNOR_HYSTERESIS,
+		.ir_distance = GOVERNOR_IR_DISTANCE,
+		.stale_time = GOVERNOR_STALE_TIME,
+	};
+	int id = 0;
+
+	retvm_if(governor.initialized, -1, "governor is already initialized");
+
+	if (!config)
+		config = &defaults;
+
+	retv_if(config->period <= 0.0, -1);
+	retv_if(config->stop_distance < 0.0 || config->full_distance <= config->stop_distance, -1);
+	retv_if(config->hysteresis < 0.0 || config->stale_time <= 0.0, -1);
+
+	governor.ir_pin = ir_pin_num;
+	governor.config = *config;
+	governor.ultrasonic_distance = -1;
+	governor.ultrasonic_timestamp = 0;
+	governor.effective_distance = INFINITY;
+	governor.start_time = _get_timestamp();
+	memset(&governor.stats, 0, sizeof(governor.stats));
+	governor.stats.limit = MOTOR_DRIVER_L298N_SPEED_MAX;
+	governor.stats.distance = -1;
+
+	id = controller_acquisition_add_sensor("governor", config->period, 0.0,
+			GOVERNOR_PRIORITY, __read_governor_cb, NULL);
+	retv_if(id < 0, -1);
+
+	governor.initialized = 1;
+
+	return id;
+}
+
+void controller_governor_update_ultrasonic(const resource_ultrasonic_obstacle_s *obstacle)
+{
+	ret_if(!obstacle);
+
+	pthread_mutex_lock(&governor.lock);
+	governor.ultrasonic_distance = obstacle->distance[ULTRASONIC_SECTOR_FRONT];
+	governor.ultrasonic_timestamp = obstacle->timestamp[ULTRASONIC_SECTOR_FRONT];
+	pthread_mutex_unlock(&governor.lock);
+}
+
+int controller_governor_get_stats(controller_governor_stats_s *out)
+{
+	retv_if(out == NULL, -1);
+
+	pthread_mutex_lock(&governor.lock);
+	*out = governor.stats;
+	pthread_mutex_unlock(&governor.lock);
+
+	return 0;
+}
+
+void controller_governor_fini(void)
+{
+	if (!governor.initialized)
+		return;
+
+	_I("Speed governor - evaluations[%llu] stale[%llu] limit changes[%llu] worst reaction[%llu us] oldest data[%llu us]",
+		governor.stats.evaluations, governor.stats.stale_evaluations, governor.stats.limit_changes,
+		governor.stats.max_latency, governor.stats.max_age);
+
+	/* Don't leave the motors limited by an obstacle nobody watches anymore */
+	resource_set_motor_driver_L298N_speed_limit(MOTOR_DRIVER_L298N_SPEED_MAX);
+	governor.initialized = 0;
+}
@@ -0,0 +1,192 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "resource.h"
+#include "controller_hill_hold.h"
+
+#define HILL_HOLD_RATE 200
+#define HILL_HOLD_BATCH 2 /* 10 ms from a sample to the motors */
+#define HILL_HOLD_GAIN 4095.0
+#define HILL_HOLD_MAX 1500.0
+#define HILL_HOLD_DEADBAND 2.0
+#define HILL_HOLD_RAMP_TIME 0.5
+#define HILL_HOLD_STEP 16 /* smaller changes of the hold are not worth a bus write */
+
+/*
+ * Everything but the statistics belongs to the gyro FIFO drain thread.
+ */
+static struct {
+	int running;
+	controller_hill_hold_config_s config;
+	resource_attitude_engine_s *engine;
+	resource_imu_sample_s samples[GYRO_FIFO_SAMPLE_MAX];
+	int feedforward;
+	pthread_mutex_t stats_lock;
+	controller_hill_hold_stats_s stats;
+} hill_hold = {
+	.stats_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static unsigned long long _get_timestamp(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec) / 1000;
+}
+
+static int __pitch_to_feedforward(double pitch)
+{
+	double hold = 0.0;
+
+	if (fabs(pitch) < hill_hold.config.deadband)
+		return 0;
+
+	/* Gravity along the slope grows with the sine of it, facing uphill is a negative pitch */
+	hold = -hill_hold.config.gain * sin(pitch * M_PI / 180.0);
+	if (hold > hill_hold.config.max_hold)
+		hold = hill_hold.config.max_hold;
+	else if (hold < -hill_hold.config.max_hold)
+		hold = -hill_hold.config.max_hold;
+
+	return (int)lround(hold / HILL_HOLD_STEP) * HILL_HOLD_STEP;
+}
+
+static void __imu_batch_cb(const resource_gyro_sample_s *samples, unsigned int count, void *data)
+{
+	resource_attitude_s attitude;
+	unsigned long long latency = 0;
+	unsigned int i = 0;
+	int feedforward = 0;
+	int ret = 0;
+
+	ret_if(count == 0);
+
+	for (i = 0; i < count; i++) {
+		resource_convert_gyro_sensor_raw(&samples[i].raw, 1, &hill_hold.samples[i]);
+		hill_hold.samples[i].timestamp = samples[i].timestamp;
+	}
+
+	ret_if(resource_update_attitude(hill_hold.engine, hill_hold.samples, count) < 0);
+	ret_if(resource_get_attitude(hill_hold.engine, &attitude) < 0);
+
+	feedforward = __pitch_to_feedforward(attitude.pitch);
+
+	/* Also moves a ramp from rest forward, so it is applied on every batch */
+	ret = resource_set_motor_driver_L298N_hold(feedforward, hill_hold.config.ramp_time);
+	if (ret < 0)
+		_E("Failed to hold the motors[%d]", feedforward);
+	else
+		latency = _get_timestamp() - samples[count - 1].timestamp;
+
+	pthread_mutex_lock(&hill_hold.stats_lock);
+	hill_hold.stats.pitch = attitude.pitch;
+	hill_hold.stats.samples += count;
+	if (ret == 0 && feedforward != hill_hold.feedforward) {
+		hill_hold.stats.updates++;
+		hill_hold.stats.last_latency = latency;
+		if (latency > hill_hold.stats.max_latency)
+			hill_hold.stats.max_latency = latency;
+	}
+	hill_hold.stats.feedforward = feedforward;
+	pthread_mutex_unlock(&hill_hold.stats_lock);
+
+	if (ret == 0 && feedforward != hill_hold.feedforward) {
+		_D("hill-hold - pitch[%.1f], hold[%d], %llu us", attitude.pitch, feedforward, latency);
+		hill_hold.feedforward = feedforward;
+	}
+}
+
+int controller_hill_hold_start(int int_pin_num, const controller_hill_hold_config_s *config)
+{
+	controller_hill_hold_config_s defaults = {
+		.rate = HILL_HOLD_RATE,
+		.batch = HILL_HOLD_BATCH,
+		.gain = HILL_HOLD_GAIN,
+		.max_hold = HILL_HOLD_MAX,
+		.deadband = HILL_HOLD_DEADBAND,
+		.ramp_time = HILL_HOLD_RAMP_TIME,
+	};
+	resource_attitude_config_s attitude_config;
+	int ret = 0;
+
+	if (hill_hold.running) {
+		_D("hill-hold is already running");
+		return 0;
+	}
+
+	if (!config)
+		config = &defaults;
+
+	retv_if(config->rate < CONTROLLER_HILL_HOLD_RATE_MIN || config->rate > GYRO_FIFO_RATE_MAX, -1);
+	retv_if(config->batch == 0 || config->batch > GYRO_FIFO_SAMPLE_MAX, -1);
+	retv_if(config->max_hold < 0.0 || config->deadband < 0.0 || config->ramp_time < 0.0, -1);
+
+	/* The accelerometer of a moving stroller is noisy, Mahony keeps the pitch steady */
+	ret = resource_get_attitude_default_config(ATTITUDE_FILTER_MAHONY, &attitude_config);
+	retv_if(ret < 0, -1);
+
+	hill_hold.engine = resource_create_attitude_engine(&attitude_config);
+	retv_if(!hill_hold.engine, -1);
+
+	hill_hold.config = *config;
+	hill_hold.feedforward = 0;
+	memset(&hill_hold.stats, 0, sizeof(hill_hold.stats));
+
+	ret = resource_start_gyro_sensor_fifo(int_pin_num, config->rate, config->batch, __imu_batch_cb, NULL);
+	if (ret < 0) {
+		_E("Failed to start the IMU for the hill-hold");
+		resource_destroy_attitude_engine(hill_hold.engine);
+		hill_hold.engine = NULL;
+		return -1;
+	}
+
+	hill_hold.running = 1;
+
+	_I("Hill-hold is running - rate[%u], batch[%u]", config->rate, config->batch);
+
+	return 0;
+}
+
+void controller_hill_hold_stop(void)
+{
+	if (!hill_hold.running)
+		return;
+
+	resource_stop_gyro_sensor_fifo();
+	hill_hold.running = 0;
+
+	/* Nobody watches the slope anymore */
+	resource_set_motor_driver_L298N_hold(0, 0.0);
+
+	resource_destroy_attitude_engine(hill_hold.engine);
+	hill_hold.engine = NULL;
+
+	_I("Hill-hold - samples[%llu] updates[%llu] worst latency[%llu us]",
+		hill_hold.stats.samples, hill_hold.stats.updates, hill_hold.stats.max_latency);
+}
+
+int controller_hill_hold_get_stats(controller_hill_hold_stats_s *out)
+{
+	retv_if(out == NULL, -1);
+
+	pthread_mutex_lock(&hill_hold.stats_lock);
+	*out = hill_hold.stats;
+	pthread_mutex_unlock(&hill_hold.stats_lock);
+
+	return 0;
+}
@@ -0,0 +1,294 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <Ecore.h>
+
+#include "log.h"
+#include "resource/resource_adc_mcp3008.h"
+#include "resource/resource_pressure_sensor.h"
+#include "resource/resource_pressure_sensor_internal.h"
+#include "resource/resource_motor_driver_L298N.h"
+#include "controller_safety.h"
+
+#define SAFETY_RATE 250
+#define SAFETY_GRIP_THRESHOLD 300
+#define SAFETY_RELEASE_THRESHOLD 200
+#define SAFETY_RELEASE_TIME 0.2
+/* Above the ADC stream, a brake must not wait for sampling */
+#define SAFETY_THREAD_PRIORITY 60
+
+typedef struct _safety_brake_msg_s {
+	bool braked;
+	unsigned long long timestamp;
+} safety_brake_msg_s;
+
+/*
+ * The loop owns everything but the statistics, which are read from the main loop.
+ */
+static struct {
+	int running;
+	int stop_requested;
+	pthread_t thread;
+	int ch_num;
+	controller_safety_config_s config;
+	bool held;
+	bool braked;
+	unsigned long long released_since; /* ns, 0 while held */
+	pthread_mutex_t stats_lock;
+	controller_safety_stats_s stats;
+	controller_safety_brake_cb cb;
+	void *data;
+} safety = {
+	.stats_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static unsigned long long _get_timestamp_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+static inline void __to_timespec(unsigned long long ns, struct timespec *t)
+{
+	t->tv_sec = ns / 1000000000LL;
+	t->tv_nsec = ns % 1000000000LL;
+}
+
+static void __brake_cb(void *data)
+{
+	safety_brake_msg_s *msg = data;
+
+	if (safety.running && safety.cb)
+		safety.cb(msg->braked, msg->timestamp, safety.data);
+
+	free(msg);
+}
+
+static void __notify(bool braked, unsigned long long timestamp)
+{
+	safety_brake_msg_s *msg = NULL;
+
+	msg = malloc(sizeof(safety_brake_msg_s));
+	ret_if(!msg);
+
+	msg->braked = braked;
+	msg->timestamp = timestamp / 1000;
+	ecore_main_loop_thread_safe_call_async(__brake_cb, msg);
+}
+
+static void __record_latency(unsigned long long latency)
+{
+	unsigned int bucket = 0;
+
+	while (bucket < CONTROLLER_SAFETY_LATENCY_BUCKETS - 1 && (latency >> (bucket + 1)))
+		bucket++;
+
+	pthread_mutex_lock(&safety.stats_lock);
+	safety.stats.brakes++;
+	safety.stats.histogram[bucket]++;
+	if (latency > safety.stats.max_latency)
+		safety.stats.max_latency = latency;
+	pthread_mutex_unlock(&safety.stats_lock);
+}
+
+static void __check_handle(void)
+{
+	unsigned long long sampled = 0;
+	unsigned long long latency = 0;
+	unsigned int value = 0;
+
+	sampled = _get_timestamp_ns();
+	if (resource_read_pressure_sensor(safety.ch_num, &value) < 0) {
+		pthread_mutex_lock(&safety.stats_lock);
+		safety.stats.read_errors++;
+		pthread_mutex_unlock(&safety.stats_lock);
+		/* A sensor we can't read is a released handle */
+		value = 0;
+	}
+
+	if (safety.held)
+		safety.held = value >= safety.config.release_threshold;
+	else
+		safety.held = value >= safety.config.grip_threshold;
+
+	if (safety.held) {
+		safety.released_since = 0;
+		if (safety.braked) {
+			resource_release_motor_driver_L298N_brake();
+			safety.braked = false;
+			_I("Handle is held again, the brake is released");
+			__notify(false, sampled);
+		}
+		return;
+	}
+
+	if (!safety.released_since)
+		safety.released_since = sampled;
+
+	if (safety.braked || sampled - safety.released_since < safety.config.release_time * 1000000000.0)
+		return;
+
+	if (resource_brake_motor_driver_L298N_all() < 0) {
+		/* Try again on the next tick */
+		_E("Failed to brake the motors");
+		return;
+	}
+
+	latency = (_get_timestamp_ns() - sampled) / 1000;
+	safety.braked = true;
+	__record_latency(latency);
+
+	_W("Handle is released, the motors are braked in %llu us", latency);
+	__notify(true, sampled);
+}
+
+static void *__safety_thread(void *data)
+{
+	unsigned long long period = 1000000000ULL / safety.config.rate;
+	unsigned long long next = _get_timestamp_ns();
+	unsigned long long now = 0;
+	unsigned long long missed = 0;
+	struct timespec wakeup;
+	int ret = 0;
+
+	_I("Safety thread is running...");
+
+	while (!__atomic_load_n(&safety.stop_requested, __ATOMIC_ACQUIRE)) {
+		__check_handle();
+
+		missed = 0;
+		next += period;
+		now = _get_timestamp_ns();
+		if (now > next + period) {
+			/* Fell behind, skip the missed ticks instead of bursting to catch up */
+			missed = (now - next) / period;
+			next += missed * period;
+		}
+
+		pthread_mutex_lock(&safety.stats_lock);
+		safety.stats.ticks++;
+		safety.stats.late += missed;
+		pthread_mutex_unlock(&safety.stats_lock);
+
+		__to_timespec(next, &wakeup);
+		do {
+			ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+		} while (ret == EINTR);
+	}
+
+	_I("Safety thread is finishing...");
+
+	return NULL;
+}
+
+int controller_safety_start(int ch_num, const controller_safety_config_s *config,
+	controller_safety_brake_cb cb, void *data)
+{
+	controller_safety_config_s defaults = {
+		.rate = SAFETY_RATE,
+		.grip_threshold = SAFETY_GRIP_THRESHOLD,
+		.release_threshold = SAFETY_RELEASE_THRESHOLD,
+		.release_time = SAFETY_RELEASE_TIME,
+	};
+	struct sched_param param;
+	unsigned int value = 0;
+	int ret = 0;
+
+	retv_if(ch_num < 0 || ch_num >= MCP3008_CH_MAX, -1);
+
+	if (safety.running) {
+		_D("safety loop is already running");
+		return 0;
+	}
+
+	if (!config)
+		config = &defaults;
+
+	retv_if(config->rate < CONTROLLER_SAFETY_RATE_MIN || config->rate > CONTROLLER_SAFETY_RATE_MAX, -1);
+	retv_if(config->release_threshold > config->grip_threshold, -1);
+	retv_if(config->release_time < 0.0, -1);
+
+	/* Opens the AD converter here, not on the loop */
+	ret = resource_read_pressure_sensor(ch_num, &value);
+	retvm_if(ret < 0, -1, "Failed to read the handle pressure sensor");
+
+	safety.ch_num = ch_num;
+	safety.config = *config;
+	safety.held = value >= config->grip_threshold;
+	safety.braked = false;
+	safety.released_since = 0;
+	safety.cb = cb;
+	safety.data = data;
+	safety.stop_requested = 0;
+	memset(&safety.stats, 0, sizeof(safety.stats));
+
+	ret = pthread_create(&safety.thread, NULL, __safety_thread, NULL);
+	if (ret != 0) {
+		_E("Failed to create safety thread[%d]", ret);
+		resource_close_pressure_sensor();
+		return -1;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = SAFETY_THREAD_PRIORITY;
+	ret = pthread_setschedparam(safety.thread, SCHED_FIFO, &param);
+	if (ret != 0)
+		_W("Safety thread runs without real-time priority[%d]", ret);
+
+	safety.running = 1;
+
+	_I("Safety loop is running - channel[%d], rate[%u], release time[%.3f s]",
+		ch_num, config->rate, config->release_time);
+
+	return 0;
+}
+
+void controller_safety_stop(void)
+{
+	controller_safety_stats_s stats;
+	int i = 0;
+
+	if (!safety.running)
+		return;
+
+	__atomic_store_n(&safety.stop_requested, 1, __ATOMIC_RELEASE);
+	pthread_join(safety.thread, NULL);
+	safety.running = 0;
+
+	resource_close_pressure_sensor();
+
+	controller_safety_get_stats(&stats);
+	_I("Safety loop - ticks[%llu] late[%llu] read errors[%llu] brakes[%llu] worst latency[%llu us]",
+		stats.ticks, stats.late, stats.read_errors, stats.brakes, stats.max_latency);
+	for (i = 0; i < CONTROLLER_SAFETY_LATENCY_BUCKETS; i++) {
+		if (stats.histogram[i])
+			_I("  brake latency %6u us~ : %llu", 1U << i, stats.histogram[i]);
+	}
+}
+
+int controller_safety_get_stats(controller_safety_stats_s *out)
+{
+	retv_if(out == NULL, -1);
+
+	pthread_mutex_lock(&safety.stats_lock);
+	*out = safety.stats;
+	pthread_mutex_unlock(&safety.stats_lock);
+
+	return 0;
+}
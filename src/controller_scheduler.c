@@ -0,0 +1,298 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <Ecore.h>
+
+#include "log.h"
+#include "controller_scheduler.h"
+
+#define TASK_NAME_MAX 32
+
+typedef struct _scheduler_task_s {
+	int used;
+	char name[TASK_NAME_MAX];
+	double period;
+	double deadline;
+	int priority;
+	double release;
+	double abs_deadline;
+	controller_scheduler_task_cb cb;
+	void *data;
+	controller_scheduler_stats_s stats;
+} scheduler_task_s;
+
+struct _controller_scheduler_s {
+	scheduler_task_s tasks[CONTROLLER_SCHEDULER_TASK_MAX];
+	Ecore_Timer *timer;
+	int started;
+	controller_scheduler_miss_cb miss_cb;
+	void *miss_data;
+};
+
+double controller_scheduler_get_time(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (double)t.tv_sec + (double)t.tv_nsec / 1000000000.0;
+}
+
+controller_scheduler_s *controller_scheduler_create(void)
+{
+	controller_scheduler_s *sched = NULL;
+
+	sched = calloc(1, sizeof(controller_scheduler_s));
+	retv_if(!sched, NULL);
+
+	return sched;
+}
+
+static Eina_Bool __scheduler_timer_cb(void *data);
+
+static void __schedule_timer(controller_scheduler_s *sched, double next)
+{
+	double now = controller_scheduler_get_time();
+
+	if (sched->timer) {
+		ecore_timer_del(sched->timer);
+		sched->timer = NULL;
+	}
+
+	sched->timer = ecore_timer_add(next > now ? next - now : 0.0, __scheduler_timer_cb, sched);
+	if (!sched->timer)
+		_E("Failed to add scheduler timer");
+}
+
+void controller_scheduler_destroy(controller_scheduler_s *sched)
+{
+	ret_if(!sched);
+
+	controller_scheduler_stop(sched);
+	free(sched);
+}
+
+int controller_scheduler_add_task(controller_scheduler_s *sched, const char *name,
+	double period, double deadline, int priority, controller_scheduler_task_cb cb, void *data)
+{
+	scheduler_task_s *task = NULL;
+	int i = 0;
+
+	retv_if(!sched, -1);
+	retv_if(!cb, -1);
+	retv_if(period <= 0.0, -1);
+	retv_if(deadline < 0.0, -1);
+
+	for (i = 0; i < CONTROLLER_SCHEDULER_TASK_MAX; i++) {
+		if (!sched->tasks[i].used)
+			break;
+	}
+	retvm_if(i == CONTROLLER_SCHEDULER_TASK_MAX, -1, "too many tasks[%d]", i);
+
+	task = &sched->tasks[i];
+	memset(task, 0, sizeof(scheduler_task_s));
+	snprintf(task->name, sizeof(task->name), "%s", name ? name : "unknown");
+	task->period = period;
+	task->deadline = deadline > 0.0 ? deadline : period;
+	task->priority = priority;
+	task->release = controller_scheduler_get_time();
+	task->abs_deadline = task->release + task->deadline;
+	task->cb = cb;
+	task->data = data;
+	task->used = 1;
+
+	_D("task[%d:%s] - period[%.3f] deadline[%.3f] priority[%d]",
+		i, task->name, task->period, task->deadline, task->priority);
+
+	/* The new task is released now, do not let it wait for the armed timer */
+	if (sched->started)
+		__schedule_timer(sched, task->release);
+
+	return i;
+}
+
+int controller_scheduler_remove_task(controller_scheduler_s *sched, int task_id)
+{
+	retv_if(!sched, -1);
+	retv_if(task_id < 0 || task_id >= CONTROLLER_SCHEDULER_TASK_MAX, -1);
+	retv_if(!sched->tasks[task_id].used, -1);
+
+	sched->tasks[task_id].used = 0;
+
+	return 0;
+}
+
+void controller_scheduler_set_deadline_missed_cb(controller_scheduler_s *sched, controller_scheduler_miss_cb cb, void *data)
+{
+	ret_if(!sched);
+
+	sched->miss_cb = cb;
+	sched->miss_data = data;
+}
+
+int controller_scheduler_get_stats(controller_scheduler_s *sched, int task_id, controller_scheduler_stats_s *stats)
+{
+	retv_if(!sched, -1);
+	retv_if(!stats, -1);
+	retv_if(task_id < 0 || task_id >= CONTROLLER_SCHEDULER_TASK_MAX, -1);
+	retv_if(!sched->tasks[task_id].used, -1);
+
+	*stats = sched->tasks[task_id].stats;
+
+	return 0;
+}
+
+static scheduler_task_s *__pick_earliest_deadline(controller_scheduler_s *sched, double now, const int *dispatched)
+{
+	scheduler_task_s *pick = NULL;
+	int i = 0;
+
+	for (i = 0; i < CONTROLLER_SCHEDULER_TASK_MAX; i++) {
+		scheduler_task_s *task = &sched->tasks[i];
+
+		if (!task->used || dispatched[i] || task->release > now)
+			continue;
+
+		if (!pick
+			|| task->abs_deadline < pick->abs_deadline
+			|| (task->abs_deadline == pick->abs_deadline && task->priority > pick->priority))
+			pick = task;
+	}
+
+	return pick;
+}
+
+static void __complete_task(controller_scheduler_s *sched, scheduler_task_s *task, double start, double end)
+{
+	double lateness = end - task->abs_deadline;
+	double exec_time = end - start;
+	unsigned int skipped = 0;
+
+	task->stats.released++;
+	if (exec_time > task->stats.worst_exec_time)
+		task->stats.worst_exec_time = exec_time;
+
+	if (lateness > 0.0) {
+		task->stats.missed++;
+		if (lateness > task->stats.worst_lateness)
+			task->stats.worst_lateness = lateness;
+
+		_W("task[%s] missed its deadline by %.6f sec", task->name, lateness);
+		if (sched->miss_cb)
+			sched->miss_cb(task - sched->tasks, task->name, lateness, sched->miss_data);
+	}
+
+	task->release += task->period;
+
+	/* Do not burst to catch up, drop the releases we are already late for */
+	if (task->release <= end) {
+		skipped = (unsigned int)((end - task->release) / task->period) + 1;
+		task->release += skipped * task->period;
+		task->stats.skipped += skipped;
+	}
+
+	task->abs_deadline = task->release + task->deadline;
+}
+
+double controller_scheduler_dispatch(controller_scheduler_s *sched, double now)
+{
+	scheduler_task_s *task = NULL;
+	int dispatched[CONTROLLER_SCHEDULER_TASK_MAX] = { 0, };
+	double next = -1.0;
+	double end = 0.0;
+	int i = 0;
+
+	retv_if(!sched, -1.0);
+
+	/* Each task runs at most once per pass, so an overload cannot keep us here */
+	while ((task = __pick_earliest_deadline(sched, now, dispatched))) {
+		dispatched[task - sched->tasks] = 1;
+		task->cb(task->data);
+		end = controller_scheduler_get_time();
+
+		/* The callback may remove its own task */
+		if (task->used)
+			__complete_task(sched, task, now, end);
+
+		now = end;
+	}
+
+	for (i = 0; i < CONTROLLER_SCHEDULER_TASK_MAX; i++) {
+		if (!sched->tasks[i].used)
+			continue;
+
+		if (next < 0.0 || sched->tasks[i].release < next)
+			next = sched->tasks[i].release;
+	}
+
+	return next;
+}
+
+static Eina_Bool __scheduler_timer_cb(void *data)
+{
+	controller_scheduler_s *sched = data;
+	double now = 0.0;
+	double next = 0.0;
+
+	sched->timer = NULL;
+
+	now = controller_scheduler_get_time();
+	next = controller_scheduler_dispatch(sched, now);
+
+	/* A callback may have stopped the scheduler */
+	if (!sched->started)
+		return ECORE_CALLBACK_CANCEL;
+
+	if (next < 0.0) {
+		_D("no more task to dispatch");
+		if (sched->timer) {
+			ecore_timer_del(sched->timer);
+			sched->timer = NULL;
+		}
+		return ECORE_CALLBACK_CANCEL;
+	}
+
+	__schedule_timer(sched, next);
+
+	return ECORE_CALLBACK_CANCEL;
+}
+
+int controller_scheduler_start(controller_scheduler_s *sched)
+{
+	retv_if(!sched, -1);
+
+	if (sched->started) {
+		_D("scheduler is already started");
+		return 0;
+	}
+
+	sched->timer = ecore_timer_add(0.0, __scheduler_timer_cb, sched);
+	retvm_if(!sched->timer, -1, "Failed to add scheduler timer");
+
+	sched->started = 1;
+
+	return 0;
+}
+
+void controller_scheduler_stop(controller_scheduler_s *sched)
+{
+	ret_if(!sched);
+
+	sched->started = 0;
+
+	if (sched->timer) {
+		ecore_timer_del(sched->timer);
+		sched->timer = NULL;
+	}
+}
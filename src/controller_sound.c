@@ -0,0 +1,332 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <Ecore.h>
+
+#include "log.h"
+#include "resource/resource_adc_stream.h"
+#include "resource/resource_sound_level_dsp.h"
+#include "resource/resource_sound_spectrum.h"
+#include "controller_sound.h"
+
+#define SOUND_READ_MAX 512 /* frames taken from the stream at once */
+#define SOUND_POLL_DIVIDER 4 /* poll the stream 4 times per window */
+
+#define CRY_MIN_DB -40.0
+#define CRY_MIN_VOICED_RATIO 0.5
+#define CRY_MIN_PITCH_PROMINENCE 6.0
+#define CRY_MIN_HARMONIC_RATIO 8.0
+#define CRY_DECISION_TIME 2.0
+#define CRY_ON_FRACTION 0.4
+#define CRY_OFF_FRACTION 0.1
+
+typedef struct _sound_level_msg_s {
+	resource_sound_level_s level;
+	unsigned long long timestamp;
+} sound_level_msg_s;
+
+typedef struct _sound_cry_msg_s {
+	bool crying;
+	unsigned long long timestamp;
+} sound_cry_msg_s;
+
+typedef struct _cry_detector_s {
+	int enabled;
+	controller_cry_detector_config_s config;
+	unsigned char decision[CONTROLLER_SOUND_DECISION_MAX];
+	unsigned int decision_count; /* windows the decision is made on */
+	unsigned int decision_pos;
+	unsigned int cry_like;
+	bool crying;
+	unsigned long long worst_time; /* ns, the longest spectrum analysis */
+	unsigned long long total_time;
+	unsigned long long analyzed;
+	controller_sound_cry_cb cb;
+	void *data;
+} cry_detector_s;
+
+static struct {
+	int running;
+	int stop_requested;
+	pthread_t thread;
+	int ch_num;
+	unsigned int rate;
+	unsigned int window;
+	unsigned int fill;
+	unsigned short samples[CONTROLLER_SOUND_WINDOW_MAX];
+	controller_sound_level_cb cb;
+	void *data;
+	cry_detector_s cry;
+} sound;
+
+static unsigned long long _get_timestamp_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+static void __level_cb(void *data)
+{
+	sound_level_msg_s *msg = data;
+
+	if (sound.running && sound.cb)
+		sound.cb(&msg->level, msg->timestamp, sound.data);
+
+	free(msg);
+}
+
+static void __cry_cb(void *data)
+{
+	sound_cry_msg_s *msg = data;
+
+	if (sound.running && sound.cry.cb)
+		sound.cry.cb(msg->crying, msg->timestamp, sound.cry.data);
+
+	free(msg);
+}
+
+static int __is_cry_like(const resource_sound_level_s *level, const resource_sound_spectrum_s *spectrum)
+{
+	const controller_cry_detector_config_s *config = &sound.cry.config;
+	double voiced = 0.0;
+
+	if (level->db < config->min_db || spectrum->total <= 0.0)
+		return 0;
+
+	voiced = (spectrum->band[SOUND_SPECTRUM_BAND_PITCH] + spectrum->band[SOUND_SPECTRUM_BAND_HARMONIC]) / spectrum->total;
+
+	return voiced >= config->min_voiced_ratio
+		&& spectrum->pitch_prominence >= config->min_pitch_prominence
+		&& spectrum->harmonic_ratio >= config->min_harmonic_ratio;
+}
+
+static void __detect_cry(const resource_sound_level_s *level, unsigned long long timestamp)
+{
+	cry_detector_s *cry = &sound.cry;
+	resource_sound_spectrum_s spectrum;
+	sound_cry_msg_s *msg = NULL;
+	unsigned long long start = _get_timestamp_ns();
+	unsigned long long elapsed = 0;
+	unsigned char cry_like = 0;
+	bool crying = false;
+
+	if (resource_analyze_sound_spectrum(sound.samples, sound.window, sound.rate, level->mean, &spectrum) < 0)
+		return;
+
+	cry_like = __is_cry_like(level, &spectrum);
+
+	/* Sliding count over the last decision_count windows */
+	cry->cry_like += cry_like;
+	cry->cry_like -= cry->decision[cry->decision_pos];
+	cry->decision[cry->decision_pos] = cry_like;
+	cry->decision_pos = (cry->decision_pos + 1) % cry->decision_count;
+
+	if (cry->crying)
+		crying = cry->cry_like > cry->config.off_fraction * cry->decision_count;
+	else
+		crying = cry->cry_like >= cry->config.on_fraction * cry->decision_count;
+
+	elapsed = _get_timestamp_ns() - start;
+	if (elapsed > cry->worst_time)
+		cry->worst_time = elapsed;
+	cry->total_time += elapsed;
+	cry->analyzed++;
+
+	if (crying == cry->crying)
+		return;
+
+	cry->crying = crying;
+	_I("Crying %s - pitch[%.0f Hz]", crying ? "started" : "stopped", spectrum.pitch);
+
+	msg = malloc(sizeof(sound_cry_msg_s));
+	ret_if(!msg);
+
+	msg->crying = crying;
+	msg->timestamp = timestamp / 1000;
+	ecore_main_loop_thread_safe_call_async(__cry_cb, msg);
+}
+
+static void __analyze_window(unsigned long long timestamp)
+{
+	sound_level_msg_s *msg = NULL;
+
+	msg = malloc(sizeof(sound_level_msg_s));
+	ret_if(!msg);
+
+	if (resource_compute_sound_level(sound.samples, sound.window, &msg->level) < 0) {
+		free(msg);
+		return;
+	}
+	msg->timestamp = timestamp / 1000;
+
+	if (sound.cry.enabled)
+		__detect_cry(&msg->level, timestamp);
+
+	ecore_main_loop_thread_safe_call_async(__level_cb, msg);
+}
+
+static void __sleep_ns(unsigned long long ns)
+{
+	struct timespec t;
+	int ret = 0;
+
+	t.tv_sec = ns / 1000000000LL;
+	t.tv_nsec = ns % 1000000000LL;
+	do {
+		ret = nanosleep(&t, &t);
+	} while (ret < 0 && errno == EINTR);
+}
+
+static void *__sound_thread(void *data)
+{
+	unsigned long long poll_interval = 1000000000ULL * sound.window / sound.rate / SOUND_POLL_DIVIDER;
+	resource_adc_stream_block_s block;
+	unsigned int i = 0;
+	int count = 0;
+
+	_I("Sound thread is running...");
+
+	while (!__atomic_load_n(&sound.stop_requested, __ATOMIC_ACQUIRE)) {
+		count = resource_adc_stream_read_begin(SOUND_READ_MAX, &block);
+		if (count <= 0) {
+			__sleep_ns(poll_interval);
+			continue;
+		}
+
+		/* Gathers the channel out of the frames, the kernels want contiguous samples */
+		for (i = 0; i < block.count; i++) {
+			sound.samples[sound.fill++] = block.frames[i].value[sound.ch_num];
+			if (sound.fill == sound.window) {
+				__analyze_window(block.frames[i].timestamp);
+				sound.fill = 0;
+			}
+		}
+
+		resource_adc_stream_read_end(block.count);
+	}
+
+	_I("Sound thread is finishing...");
+
+	return NULL;
+}
+
+int controller_sound_set_cry_detector(const controller_cry_detector_config_s *config,
+	controller_sound_cry_cb cb, void *data)
+{
+	controller_cry_detector_config_s defaults = {
+		.min_db = CRY_MIN_DB,
+		.min_voiced_ratio = CRY_MIN_VOICED_RATIO,
+		.min_pitch_prominence = CRY_MIN_PITCH_PROMINENCE,
+		.min_harmonic_ratio = CRY_MIN_HARMONIC_RATIO,
+		.decision_time = CRY_DECISION_TIME,
+		.on_fraction = CRY_ON_FRACTION,
+		.off_fraction = CRY_OFF_FRACTION,
+	};
+
+	retvm_if(sound.running, -1, "cannot set the cry detector while running");
+
+	if (!config)
+		config = &defaults;
+
+	retv_if(config->decision_time <= 0.0, -1);
+	retv_if(config->on_fraction <= 0.0 || config->on_fraction > 1.0, -1);
+	retv_if(config->off_fraction < 0.0 || config->off_fraction >= config->on_fraction, -1);
+
+	memset(&sound.cry, 0, sizeof(cry_detector_s));
+	sound.cry.config = *config;
+	sound.cry.cb = cb;
+	sound.cry.data = data;
+	sound.cry.enabled = 1;
+
+	return 0;
+}
+
+int controller_sound_start(int ch_num, unsigned int rate, unsigned int window,
+	controller_sound_level_cb cb, void *data)
+{
+	int ret = 0;
+
+	retv_if(ch_num < 0 || ch_num >= MCP3008_CH_MAX, -1);
+	retv_if(window == 0 || window > CONTROLLER_SOUND_WINDOW_MAX, -1);
+
+	if (sound.running) {
+		_D("sound analysis is already running");
+		return 0;
+	}
+
+	if (sound.cry.enabled) {
+		retvm_if(window > SOUND_SPECTRUM_FFT_MAX || (window & (window - 1)), -1,
+			"the cry detector needs a window of a power of 2 up to %d", SOUND_SPECTRUM_FFT_MAX);
+
+		sound.cry.decision_count = (unsigned int)(sound.cry.config.decision_time * rate / window);
+		if (sound.cry.decision_count == 0)
+			sound.cry.decision_count = 1;
+		else if (sound.cry.decision_count > CONTROLLER_SOUND_DECISION_MAX)
+			sound.cry.decision_count = CONTROLLER_SOUND_DECISION_MAX;
+
+		memset(sound.cry.decision, 0, sizeof(sound.cry.decision));
+		sound.cry.decision_pos = 0;
+		sound.cry.cry_like = 0;
+		sound.cry.crying = false;
+	}
+
+	ret = resource_adc_stream_start(1 << ch_num, rate);
+	retv_if(ret < 0, -1);
+
+	sound.ch_num = ch_num;
+	sound.rate = rate;
+	sound.window = window;
+	sound.fill = 0;
+	sound.cb = cb;
+	sound.data = data;
+	sound.stop_requested = 0;
+
+	ret = pthread_create(&sound.thread, NULL, __sound_thread, NULL);
+	if (ret != 0) {
+		_E("Failed to create sound thread[%d]", ret);
+		resource_adc_stream_stop();
+		return -1;
+	}
+
+	sound.running = 1;
+
+	return 0;
+}
+
+void controller_sound_stop(void)
+{
+	resource_adc_stream_stats_s stats;
+
+	if (!sound.running)
+		return;
+
+	__atomic_store_n(&sound.stop_requested, 1, __ATOMIC_RELEASE);
+	pthread_join(sound.thread, NULL);
+	sound.running = 0;
+
+	resource_adc_stream_stop();
+
+	if (resource_adc_stream_get_stats(&stats) == 0)
+		_I("ADC stream - requested[%u Hz] achieved[%.1f Hz] overruns[%llu] late[%llu]",
+			stats.requested_rate, stats.achieved_rate, stats.overruns, stats.late);
+
+	if (sound.cry.enabled && sound.cry.analyzed)
+		_I("Cry detector - %llu windows, mean[%llu ns] worst[%llu ns] per window of %.1f ms",
+			sound.cry.analyzed, sound.cry.total_time / sound.cry.analyzed, sound.cry.worst_time,
+			1000.0 * sound.window / sound.rate);
+}
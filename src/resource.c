@@ -34,6 +34,10 @@ resource_s *resource_get_info(int pin_num)
 void resource_close_all(void)
 {
 	int i = 0;
+
+	resource_stop_ultrasonic_array();
+	resource_close_gpio_snapshot();
+
 	for (i = 0; i < PIN_MAX; i++) {
 		if (!resource_info[i].opened) continue;
 		_I("GPIO[%d] is closing...", i);
@@ -42,5 +46,9 @@ void resource_close_all(void)
 			resource_info[i].close(i);
 	}
 	resource_close_illuminance_sensor();
+	resource_close_gyro_sensor();
+	resource_adc_stream_stop();
 	resource_close_sound_level_sensor();
+	resource_close_servo_motor_all();
+	resource_close_motor_driver_L298N_all();
 }
@@ -17,8 +17,11 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 #include <unistd.h>
+#include <stdbool.h>
 #include <math.h>
+#include <pthread.h>
 #include <peripheral_io.h>
 #include "log.h"
 #include "resource/resource_PCA9685.h"
@@ -48,6 +51,9 @@
 #define ALLCALL            0x01
 #define INVRT              0x10
 #define OUTDRV             0x04
+#define AI                 0x20 /* register auto-increment */
+
+#define PCA9685_REGS_PER_CH 4
 
 typedef enum {
 	PCA9685_CH_STATE_NONE,
@@ -58,14 +64,149 @@ static peripheral_i2c_h g_i2c_h = NULL;
 static unsigned int ref_count = 0;
 static pca9685_ch_state_e ch_state[PCA9685_CH_MAX + 1] = {PCA9685_CH_STATE_NONE, };
 
-int resource_pca9685_set_frequency(unsigned int freq_hz)
+/*
+ * Last values written to the chip, so that a write which doesn't change
+ * the hardware state can be dropped before it reaches the bus.
+ * The shadow is only trusted after a write, bits in led_known are per channel.
+ * A failed write may still have reached the chip in part, so it leaves the registers unknown.
+ */
+static struct {
+	uint8_t led[PCA9685_REGS_PER_CH * (PCA9685_CH_MAX + 1)];
+	unsigned int led_known;
+	uint8_t mode1;
+	uint8_t mode2;
+	uint8_t prescale;
+	bool mode1_known;
+	bool mode2_known;
+	bool prescale_known;
+} shadow;
+
+static resource_pca9685_stats_s stats;
+
+/*
+ * Motor and servo updates may come from worker threads, the bus and the shadow are shared.
+ * Priority inheritance keeps the brake write from waiting behind a preempted low-priority update.
+ */
+static pthread_mutex_t pca9685_lock;
+
+__attribute__((constructor))
+static void __init_pca9685_lock(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&pca9685_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void __reset_shadow(void)
+{
+	memset(&shadow, 0, sizeof(shadow));
+}
+
+/* Writes consecutive registers in one transaction, MODE1 must have the auto-increment bit set */
+static int __write_registers(uint8_t reg, const uint8_t *values, unsigned int count)
+{
+	uint8_t buf[1 + PCA9685_REGS_PER_CH * (PCA9685_CH_MAX + 1)];
+	int ret = PERIPHERAL_ERROR_NONE;
+
+	retv_if(count == 0 || count > sizeof(buf) - 1, -1);
+
+	buf[0] = reg;
+	memcpy(&buf[1], values, count);
+
+	ret = peripheral_i2c_write(g_i2c_h, buf, count + 1);
+	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write registers[0x%02x, %u]", reg, count);
+
+	stats.issued++;
+
+	return 0;
+}
+
+static int __write_register(uint8_t reg, uint8_t value)
+{
+	uint8_t *cached = NULL;
+	bool *known = NULL;
+	int ret = PERIPHERAL_ERROR_NONE;
+
+	switch (reg) {
+	case MODE1:
+		cached = &shadow.mode1;
+		known = &shadow.mode1_known;
+		break;
+	case MODE2:
+		cached = &shadow.mode2;
+		known = &shadow.mode2_known;
+		break;
+	case PRESCALE:
+		cached = &shadow.prescale;
+		known = &shadow.prescale_known;
+		break;
+	default:
+		break;
+	}
+
+	/* RESTART is an action, not a state, so it always goes out */
+	if (known && *known && *cached == value && !(reg == MODE1 && (value & RESTART))) {
+		stats.skipped++;
+		return 0;
+	}
+
+	ret = peripheral_i2c_write_register_byte(g_i2c_h, reg, value);
+	if (ret != PERIPHERAL_ERROR_NONE) {
+		_E("failed to write register[0x%02x]", reg);
+		if (known)
+			*known = false;
+		return -1;
+	}
+
+	stats.issued++;
+
+	if (known) {
+		*cached = (reg == MODE1) ? (value & ~RESTART) : value;
+		*known = true;
+	}
+
+	return 0;
+}
+
+static int __read_mode1(uint8_t *mode1)
 {
 	int ret = PERIPHERAL_ERROR_NONE;
+
+	if (shadow.mode1_known) {
+		*mode1 = shadow.mode1;
+		return 0;
+	}
+
+	ret = peripheral_i2c_read_register_byte(g_i2c_h, MODE1, mode1);
+	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to read register");
+
+	*mode1 &= ~RESTART;
+	shadow.mode1 = *mode1;
+	shadow.mode1_known = true;
+
+	return 0;
+}
+
+static inline void __fill_on_off(uint8_t *regs, int on, int off)
+{
+	regs[0] = on & 0xFF;
+	regs[1] = on >> 8;
+	regs[2] = off & 0xFF;
+	regs[3] = off >> 8;
+}
+
+static int __set_frequency(unsigned int freq_hz)
+{
 	double prescale_value = 0.0;
 	int prescale = 0;
 	uint8_t oldmode = 0;
 	uint8_t newmode = 0;
 
+	retvm_if(g_i2c_h == NULL, -1, "Not initialized yet");
+
 	prescale_value = 25000000.0;	// 25MHz
 	prescale_value /= 4096.0;	// 12-bit
 	prescale_value /= (double)freq_hz;
@@ -73,79 +214,226 @@ int resource_pca9685_set_frequency(unsigned int freq_hz)
 
 	prescale = (int)floor(prescale_value + 0.5);
 
-	ret = peripheral_i2c_read_register_byte(g_i2c_h, MODE1, &oldmode);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to read register");
-
-	newmode = (oldmode & 0x7F) | 0x10; // sleep
-	ret = peripheral_i2c_write_register_byte(g_i2c_h, MODE1, newmode); // go to sleep
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	/* PRESCALE is only writable in sleep, don't bounce the oscillator for nothing */
+	if (shadow.prescale_known && shadow.prescale == prescale) {
+		stats.skipped++;
+		return 0;
+	}
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h, PRESCALE, prescale);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	retv_if(__read_mode1(&oldmode) < 0, -1);
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h, MODE1, oldmode);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	newmode = (oldmode & 0x7F) | SLEEP;
+	retv_if(__write_register(MODE1, newmode) < 0, -1); // go to sleep
+	retv_if(__write_register(PRESCALE, prescale) < 0, -1);
+	retv_if(__write_register(MODE1, oldmode) < 0, -1);
 
 	usleep(500);
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h, MODE1, (oldmode | 0x80));
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	retv_if(__write_register(MODE1, oldmode | RESTART) < 0, -1);
 
 	return 0;
 }
 
-int resource_pca9685_set_value_to_channel(unsigned int channel, int on, int off)
+static int __set_value_to_channel(unsigned int channel, int on, int off)
 {
-	int ret = PERIPHERAL_ERROR_NONE;
+	uint8_t regs[PCA9685_REGS_PER_CH];
+	uint8_t *cached = NULL;
+
 	retvm_if(g_i2c_h == NULL, -1, "Not initialized yet");
+	retvm_if(channel > PCA9685_CH_MAX, -1, "channel[%u] is out of range", channel);
 
 	retvm_if(ch_state[channel] == PCA9685_CH_STATE_NONE, -1,
 		"ch[%u] is not in used state", channel);
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h,
-			LED0_ON_L + 4*channel, on & 0xFF);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	__fill_on_off(regs, on, off);
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h,
-			LED0_ON_H + 4*channel, on >> 8);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	cached = &shadow.led[PCA9685_REGS_PER_CH * channel];
+	if ((shadow.led_known & (1U << channel)) && !memcmp(cached, regs, PCA9685_REGS_PER_CH)) {
+		stats.skipped++;
+		return 0;
+	}
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h,
-			LED0_OFF_L + 4*channel, off & 0xFF);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	if (__write_registers(LED0_ON_L + PCA9685_REGS_PER_CH * channel, regs, PCA9685_REGS_PER_CH) < 0) {
+		shadow.led_known &= ~(1U << channel);
+		return -1;
+	}
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h,
-			LED0_OFF_H + 4*channel, off >> 8);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	memcpy(cached, regs, PCA9685_REGS_PER_CH);
+	shadow.led_known |= 1U << channel;
 
 	return 0;
 }
 
 static int resource_pca9685_set_value_to_all(int on, int off)
 {
-	int ret = PERIPHERAL_ERROR_NONE;
+	uint8_t regs[PCA9685_REGS_PER_CH];
+	unsigned int i = 0;
+	bool same = true;
+
 	retvm_if(g_i2c_h == NULL, -1, "Not initialized yet");
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h,
-		ALL_LED_ON_L, on & 0xFF);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	__fill_on_off(regs, on, off);
+
+	for (i = 0; i <= PCA9685_CH_MAX; i++) {
+		if (!(shadow.led_known & (1U << i))
+			|| memcmp(&shadow.led[PCA9685_REGS_PER_CH * i], regs, PCA9685_REGS_PER_CH)) {
+			same = false;
+			break;
+		}
+	}
+
+	if (same) {
+		stats.skipped++;
+		return 0;
+	}
+
+	if (__write_registers(ALL_LED_ON_L, regs, PCA9685_REGS_PER_CH) < 0) {
+		shadow.led_known = 0;
+		return -1;
+	}
+
+	for (i = 0; i <= PCA9685_CH_MAX; i++)
+		memcpy(&shadow.led[PCA9685_REGS_PER_CH * i], regs, PCA9685_REGS_PER_CH);
+	shadow.led_known = (1U << (PCA9685_CH_MAX + 1)) - 1;
+
+	return 0;
+}
+
+int resource_pca9685_set_frequency(unsigned int freq_hz)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&pca9685_lock);
+	ret = __set_frequency(freq_hz);
+	pthread_mutex_unlock(&pca9685_lock);
+
+	return ret;
+}
+
+int resource_pca9685_set_value_to_channel(unsigned int channel, int on, int off)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&pca9685_lock);
+	ret = __set_value_to_channel(channel, on, off);
+	pthread_mutex_unlock(&pca9685_lock);
+
+	return ret;
+}
+
+/*
+ * Channels are consecutive in the register map, so every changed channel
+ * between the first and the last one goes out in a single auto-increment write.
+ * Unchanged channels in between are filled from the shadow, which is cheaper
+ * than another transaction and doesn't alter them. A channel whose registers
+ * are unknown can't be rewritten blindly, so the run is split there.
+ * The chip latches all outputs on the STOP condition, so everything in one
+ * run changes at the same PWM cycle.
+ */
+int resource_pca9685_set_values(const resource_pca9685_value_s *values, unsigned int count)
+{
+	uint8_t regs[PCA9685_REGS_PER_CH * (PCA9685_CH_MAX + 1)];
+	unsigned int dirty = 0;
+	unsigned int wanted = 0;
+	unsigned int first = 0;
+	unsigned int last = 0;
+	unsigned int ch = 0;
+	unsigned int i = 0;
+	int ret = 0;
+
+	retv_if(values == NULL, -1);
+	retv_if(count == 0, 0);
+
+	pthread_mutex_lock(&pca9685_lock);
+
+	if (g_i2c_h == NULL) {
+		_E("Not initialized yet");
+		goto ERROR;
+	}
+
+	memcpy(regs, shadow.led, sizeof(regs));
+
+	/* A later tuple for the same channel wins */
+	for (i = 0; i < count; i++) {
+		ch = values[i].channel;
+		if (ch > PCA9685_CH_MAX) {
+			_E("channel[%u] is out of range", ch);
+			goto ERROR;
+		}
+		if (ch_state[ch] == PCA9685_CH_STATE_NONE) {
+			_E("ch[%u] is not in used state", ch);
+			goto ERROR;
+		}
+
+		__fill_on_off(&regs[PCA9685_REGS_PER_CH * ch], values[i].on, values[i].off);
+		wanted |= 1U << ch;
+	}
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h,
-		ALL_LED_ON_H, on >> 8);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	for (ch = 0; ch <= PCA9685_CH_MAX; ch++) {
+		if (!(wanted & (1U << ch)))
+			continue;
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h,
-		ALL_LED_OFF_L, off & 0xFF);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+		if ((shadow.led_known & (1U << ch))
+			&& !memcmp(&shadow.led[PCA9685_REGS_PER_CH * ch],
+				&regs[PCA9685_REGS_PER_CH * ch], PCA9685_REGS_PER_CH))
+			stats.skipped++;
+		else
+			dirty |= 1U << ch;
+	}
+
+	ch = 0;
+	while (dirty >> ch) {
+		while (!(dirty & (1U << ch)))
+			ch++;
+
+		first = ch;
+		last = ch;
+
+		for (ch = first + 1; ch <= PCA9685_CH_MAX; ch++) {
+			if (!(dirty >> ch))
+				break;
+
+			if (dirty & (1U << ch))
+				last = ch;
+			else if (!(shadow.led_known & (1U << ch)))
+				break;
+		}
+
+		ret = __write_registers(LED0_ON_L + PCA9685_REGS_PER_CH * first,
+			&regs[PCA9685_REGS_PER_CH * first], PCA9685_REGS_PER_CH * (last - first + 1));
+		if (ret) {
+			for (i = first; i <= last; i++)
+				shadow.led_known &= ~(1U << i);
+			goto ERROR;
+		}
+
+		memcpy(&shadow.led[PCA9685_REGS_PER_CH * first], &regs[PCA9685_REGS_PER_CH * first],
+			PCA9685_REGS_PER_CH * (last - first + 1));
+		for (i = first; i <= last; i++)
+			shadow.led_known |= 1U << i;
+
+		ch = last + 1;
+	}
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h,
-		ALL_LED_OFF_H, off >> 8);
-	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register");
+	pthread_mutex_unlock(&pca9685_lock);
 
 	return 0;
+
+ERROR:
+	pthread_mutex_unlock(&pca9685_lock);
+	return -1;
 }
 
-int resource_pca9685_init(unsigned int ch)
+void resource_pca9685_get_stats(resource_pca9685_stats_s *out)
+{
+	ret_if(out == NULL);
+
+	pthread_mutex_lock(&pca9685_lock);
+	*out = stats;
+	pthread_mutex_unlock(&pca9685_lock);
+}
+
+static int __init_channel(unsigned int ch)
 {
 	uint8_t mode1 = 0;
 	int ret = PERIPHERAL_ERROR_NONE;
@@ -169,42 +457,47 @@ int resource_pca9685_init(unsigned int ch)
 			RPI3_I2C_BUS, PCA9685_ADDRESS);
 		return -1;
 	}
-	ret = resource_pca9685_set_value_to_all(0, 0);
+
+	/* Nothing is known about a chip we've just opened */
+	__reset_shadow();
+
+	/* Auto-increment first, so that a channel is written in one transaction */
+	ret = __write_register(MODE1, ALLCALL | AI);
 	if (ret) {
-		_E("failed to reset all value to register");
+		_E("failed to write register");
 		goto ERROR;
 	}
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h, MODE2, OUTDRV);
-	if (ret != PERIPHERAL_ERROR_NONE) {
-		_E("failed to write register");
+	ret = resource_pca9685_set_value_to_all(0, 0);
+	if (ret) {
+		_E("failed to reset all value to register");
 		goto ERROR;
 	}
 
-	ret = peripheral_i2c_write_register_byte(g_i2c_h, MODE1, ALLCALL);
-	if (ret != PERIPHERAL_ERROR_NONE) {
+	ret = __write_register(MODE2, OUTDRV);
+	if (ret) {
 		_E("failed to write register");
 		goto ERROR;
 	}
 
 	usleep(500); // wait for oscillator
 
-	ret = peripheral_i2c_read_register_byte(g_i2c_h, MODE1, &mode1);
-	if (ret != PERIPHERAL_ERROR_NONE) {
+	ret = __read_mode1(&mode1);
+	if (ret) {
 		_E("failed to read register");
 		goto ERROR;
 	}
 
 	mode1 = mode1 & (~SLEEP); // # wake up (reset sleep)
-	ret = peripheral_i2c_write_register_byte(g_i2c_h, MODE1, mode1);
-	if (ret != PERIPHERAL_ERROR_NONE) {
+	ret = __write_register(MODE1, mode1);
+	if (ret) {
 		_E("failed to write register");
 		goto ERROR;
 	}
 
 	usleep(500); // wait for oscillator
 
-	ret = resource_pca9685_set_frequency(60);
+	ret = __set_frequency(60);
 	if (ret) {
 		_E("failed to set frequency");
 		goto ERROR;
@@ -223,16 +516,22 @@ ERROR:
 		peripheral_i2c_close(g_i2c_h);
 
 	g_i2c_h = NULL;
+	__reset_shadow();
 	return -1;
 }
 
-int resource_pca9685_fini(unsigned int ch)
+static int __fini_channel(unsigned int ch)
 {
+	if (ch > PCA9685_CH_MAX) {
+		_E("channel[%u] is out of range", ch);
+		return -1;
+	}
+
 	if (ch_state[ch] == PCA9685_CH_STATE_NONE) {
 		_E("channel[%u] is not in used state", ch);
 		return -1;
 	}
-	resource_pca9685_set_value_to_channel(ch, 0, 0);
+	__set_value_to_channel(ch, 0, 0);
 	ch_state[ch] = PCA9685_CH_STATE_NONE;
 
 	ref_count--;
@@ -243,7 +542,30 @@ int resource_pca9685_fini(unsigned int ch)
 		resource_pca9685_set_value_to_all(0, 0);
 		peripheral_i2c_close(g_i2c_h);
 		g_i2c_h = NULL;
+		__reset_shadow();
 	}
 
 	return 0;
 }
+
+int resource_pca9685_init(unsigned int ch)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&pca9685_lock);
+	ret = __init_channel(ch);
+	pthread_mutex_unlock(&pca9685_lock);
+
+	return ret;
+}
+
+int resource_pca9685_fini(unsigned int ch)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&pca9685_lock);
+	ret = __fini_channel(ch);
+	pthread_mutex_unlock(&pca9685_lock);
+
+	return ret;
+}
@@ -25,22 +25,23 @@
 #include <tizen.h>
 #include <system_info.h>
 #include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
 #include "log.h"
+#include "resource/resource_adc_mcp3008.h"
 
 
 #define	MCP3008_SPEED 3600000
 #define MCP3008_BPW 8
 
 #define	MCP3008_TX_WORD1     0x01	/* 0b00000001 */
-#define	MCP3008_TX_CH0 0x80	/* 0b10000000 */
-#define	MCP3008_TX_CH1 0x90	/* 0b10010000 */
-#define	MCP3008_TX_CH2 0xA0	/* 0b10100000 */
-#define	MCP3008_TX_CH3 0xB0	/* 0b10110000 */
-#define	MCP3008_TX_CH4 0xC0	/* 0b11000000 */
-#define	MCP3008_TX_CH5 0xD0	/* 0b11010000 */
-#define	MCP3008_TX_CH6 0xE0	/* 0b11100000 */
-#define	MCP3008_TX_CH7 0xF0	/* 0b11110000 */
+#define	MCP3008_TX_SGL 0x80	/* 0b10000000, single-ended, the channel follows in the next 3 bits */
+#define	MCP3008_TX_CH(ch) (MCP3008_TX_SGL | ((ch) << 4))
 #define	MCP3008_TX_WORD3     0x00	/* 0b00000000 */
+#define MCP3008_FRAME_SIZE 3
 
 #define MCP3008_RX_WORD1_MASK 0x00	/* 0b00000000 */
 #define MCP3008_RX_WORD2_NULL_BIT_MASK 0x04	/* 0b00000100 */
@@ -51,10 +52,69 @@
 #define MODEL_NAME_KEY "http://tizen.org/system/model_name"
 #define MODEL_NAME_RPI3 "rpi3"
 #define MODEL_NAME_ARTIK "artik"
+#define SPIDEV_PATH_FORMAT "/dev/spidev%d.0"
 
 static peripheral_spi_h MCP3008_H = NULL;
 static unsigned int ref_count = 0;
 
+/* A raw spidev handle to the same device, to chain the frames of a scan in one message */
+static int spidev_fd = -1;
+
+/*
+ * The bus is shared by the main loop, the continuous sampling thread and the safety loop,
+ * with priority inheritance so that the handle read is not held up by a preempted main loop read.
+ */
+static pthread_mutex_t spi_lock;
+
+__attribute__((constructor))
+static void __init_spi_lock(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&spi_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void __open_spidev(int bus)
+{
+	char path[32] = {0, };
+
+	snprintf(path, sizeof(path), SPIDEV_PATH_FORMAT, bus);
+	spidev_fd = open(path, O_RDWR | O_CLOEXEC);
+	if (spidev_fd < 0)
+		_W("cannot open %s, scanning channel by channel", path);
+}
+
+static inline void __fill_frame(int ch_num, unsigned char *tx)
+{
+	tx[0] = MCP3008_TX_WORD1;
+	tx[1] = MCP3008_TX_CH(ch_num);
+	tx[2] = MCP3008_TX_WORD3;
+}
+
+static inline int __parse_frame(const unsigned char *rx, unsigned int *out_value)
+{
+	unsigned char rx_w1 = 0;
+	unsigned char rx_w2 = 0;
+	unsigned char rx_w2_nb = 0;
+	unsigned char rx_w3 = 0;
+
+	rx_w1 = rx[0] & MCP3008_RX_WORD1_MASK;
+	retv_if(rx_w1 != 0, -1);
+
+	rx_w2_nb = rx[1] & MCP3008_RX_WORD2_NULL_BIT_MASK;
+	retv_if(rx_w2_nb != 0, -1);
+
+	rx_w2 = rx[1] & MCP3008_RX_WORD2_MASK;
+	rx_w3 = rx[2] & MCP3008_RX_WORD3_MASK;
+
+	*out_value = ((rx_w2 << 8) | (rx_w3)) & UINT10_VALIDATION_MASK;
+
+	return 0;
+}
+
 int resource_adc_mcp3008_init(void)
 {
 	int ret = 0;
@@ -114,6 +174,8 @@ int resource_adc_mcp3008_init(void)
 		goto error_after_open;
 	}
 
+	__open_spidev(bus);
+
 	ref_count++;
 
 	return 0;
@@ -125,68 +187,87 @@ error_after_open:
 }
 
 
+static int __read_channel(int ch_num, unsigned int *out_value)
+{
+	unsigned char rx[MCP3008_FRAME_SIZE] = {0, };
+	unsigned char tx[MCP3008_FRAME_SIZE] = {0, };
+
+	__fill_frame(ch_num, tx);
+
+	peripheral_spi_transfer(MCP3008_H, tx, rx, MCP3008_FRAME_SIZE);
+
+	return __parse_frame(rx, out_value);
+}
+
 int resource_read_adc_mcp3008(int ch_num, unsigned int *out_value)
 {
-	unsigned char rx[3] = {0, };
-	unsigned char tx[3] = {0, };
-	unsigned char rx_w1 = 0;
-	unsigned char rx_w2 = 0;
-	unsigned char rx_w2_nb = 0;
-	unsigned char rx_w3 = 0;
-	unsigned short int result = 0;
+	int ret = 0;
 
 	retv_if(MCP3008_H == NULL, -1);
 	retv_if(out_value == NULL, -1);
 	retv_if((ch_num < 0 || ch_num > 7), -1);
 
-	tx[0] = MCP3008_TX_WORD1;
-	switch (ch_num) {
-	case 0:
-		tx[1] = MCP3008_TX_CH0;
-		break;
-	case 1:
-		tx[1] = MCP3008_TX_CH1;
-		break;
-	case 2:
-		tx[1] = MCP3008_TX_CH2;
-		break;
-	case 3:
-		tx[1] = MCP3008_TX_CH3;
-		break;
-	case 4:
-		tx[1] = MCP3008_TX_CH4;
-		break;
-	case 5:
-		tx[1] = MCP3008_TX_CH5;
-		break;
-	case 6:
-		tx[1] = MCP3008_TX_CH6;
-		break;
-	case 7:
-		tx[1] = MCP3008_TX_CH7;
-		break;
-	default:
-		tx[1] = MCP3008_TX_CH0;
-		break;
-	}
-	tx[2] = MCP3008_TX_WORD3;
-
-	peripheral_spi_transfer(MCP3008_H, tx, rx, 3);
+	pthread_mutex_lock(&spi_lock);
+	ret = __read_channel(ch_num, out_value);
+	pthread_mutex_unlock(&spi_lock);
 
-	rx_w1 = rx[0] & MCP3008_RX_WORD1_MASK;
-	retv_if(rx_w1 != 0, -1);
+	return ret;
+}
 
-	rx_w2_nb = rx[1] & MCP3008_RX_WORD2_NULL_BIT_MASK;
-	retv_if(rx_w2_nb != 0, -1);
+int resource_scan_adc_mcp3008(unsigned int ch_mask, unsigned int *out_values)
+{
+	struct spi_ioc_transfer xfer[MCP3008_CH_MAX];
+	unsigned char rx[MCP3008_CH_MAX][MCP3008_FRAME_SIZE];
+	unsigned char tx[MCP3008_CH_MAX][MCP3008_FRAME_SIZE];
+	int ch[MCP3008_CH_MAX] = {0, };
+	int count = 0;
+	int ret = 0;
+	int i = 0;
 
-	rx_w2 = rx[1] & MCP3008_RX_WORD2_MASK;
-	rx_w3 = rx[2] & MCP3008_RX_WORD3_MASK;
+	retv_if(MCP3008_H == NULL, -1);
+	retv_if(out_values == NULL, -1);
+	retv_if(ch_mask == 0 || (ch_mask >> MCP3008_CH_MAX), -1);
+
+	if (spidev_fd < 0) {
+		pthread_mutex_lock(&spi_lock);
+		for (i = 0; i < MCP3008_CH_MAX; i++) {
+			if (!(ch_mask & (1 << i)))
+				continue;
+			ret = __read_channel(i, &out_values[i]);
+			if (ret < 0)
+				break;
+		}
+		pthread_mutex_unlock(&spi_lock);
+		return ret;
+	}
 
-	result = ((rx_w2 << 8) | (rx_w3)) & UINT10_VALIDATION_MASK;
+	memset(xfer, 0, sizeof(xfer));
+	for (i = 0; i < MCP3008_CH_MAX; i++) {
+		if (!(ch_mask & (1 << i)))
+			continue;
+
+		__fill_frame(i, tx[count]);
+		xfer[count].tx_buf = (unsigned long)tx[count];
+		xfer[count].rx_buf = (unsigned long)rx[count];
+		xfer[count].len = MCP3008_FRAME_SIZE;
+		xfer[count].speed_hz = MCP3008_SPEED;
+		xfer[count].bits_per_word = MCP3008_BPW;
+		/* Each conversion starts on the falling edge of CS */
+		xfer[count].cs_change = 1;
+		ch[count] = i;
+		count++;
+	}
+	xfer[count - 1].cs_change = 0;
 
-	// _D("%hu", result);
+	pthread_mutex_lock(&spi_lock);
+	ret = ioctl(spidev_fd, SPI_IOC_MESSAGE(count), xfer);
+	pthread_mutex_unlock(&spi_lock);
+	retvm_if(ret < 0, -1, "Failed to scan channels[0x%02x]", ch_mask);
 
-	*out_value = result;
+	for (i = 0; i < count; i++) {
+		ret = __parse_frame(rx[i], &out_values[ch[i]]);
+		retv_if(ret < 0, -1);
+	}
 
 	return 0;
 }
@@ -199,6 +280,10 @@ void resource_adc_mcp3008_fini(void)
 		return;
 
 	if (ref_count == 0) {
+		if (spidev_fd >= 0) {
+			close(spidev_fd);
+			spidev_fd = -1;
+		}
 		peripheral_spi_close(MCP3008_H);
 		MCP3008_H = NULL;
 	}
@@ -0,0 +1,235 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "log.h"
+#include "resource/resource_adc_mcp3008.h"
+#include "resource/resource_adc_stream.h"
+
+#define RING_MASK (ADC_STREAM_RING_FRAMES - 1)
+#define ADC_STREAM_THREAD_PRIORITY 50
+
+/*
+ * Single-producer/single-consumer ring.
+ * Only the sampling thread moves the head and only the consumer moves the tail.
+ */
+static struct {
+	int running;
+	int stop_requested;
+	pthread_t thread;
+	unsigned int ch_mask;
+	unsigned int rate;
+	unsigned long long start_time;
+	unsigned long long stop_time;
+	unsigned long long frames;
+	unsigned long long overruns;
+	unsigned long long late;
+	unsigned int head;
+	unsigned int tail;
+	resource_adc_stream_frame_s ring[ADC_STREAM_RING_FRAMES];
+} stream;
+
+static unsigned long long _get_timestamp_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+static inline void __to_timespec(unsigned long long ns, struct timespec *t)
+{
+	t->tv_sec = ns / 1000000000LL;
+	t->tv_nsec = ns % 1000000000LL;
+}
+
+static void __take_frame(void)
+{
+	unsigned int values[MCP3008_CH_MAX] = {0, };
+	unsigned int head = __atomic_load_n(&stream.head, __ATOMIC_RELAXED);
+	unsigned int tail = __atomic_load_n(&stream.tail, __ATOMIC_ACQUIRE);
+	resource_adc_stream_frame_s *frame = NULL;
+	unsigned long long timestamp = 0;
+	int i = 0;
+
+	timestamp = _get_timestamp_ns();
+	if (resource_scan_adc_mcp3008(stream.ch_mask, values) < 0)
+		return;
+
+	__atomic_add_fetch(&stream.frames, 1, __ATOMIC_RELAXED);
+
+	if (head - tail >= ADC_STREAM_RING_FRAMES) {
+		__atomic_add_fetch(&stream.overruns, 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	frame = &stream.ring[head & RING_MASK];
+	frame->timestamp = timestamp;
+	for (i = 0; i < MCP3008_CH_MAX; i++)
+		frame->value[i] = (unsigned short)values[i];
+
+	__atomic_store_n(&stream.head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void *__stream_thread(void *data)
+{
+	unsigned long long period = 1000000000ULL / stream.rate;
+	unsigned long long next = stream.start_time;
+	unsigned long long now = 0;
+	struct timespec wakeup;
+	int ret = 0;
+
+	_I("ADC stream thread is running...");
+
+	while (!__atomic_load_n(&stream.stop_requested, __ATOMIC_ACQUIRE)) {
+		__take_frame();
+
+		next += period;
+		now = _get_timestamp_ns();
+		if (now > next + period) {
+			/* Fell behind, skip the missed ticks instead of bursting to catch up */
+			unsigned long long missed = (now - next) / period;
+
+			next += missed * period;
+			__atomic_add_fetch(&stream.late, missed, __ATOMIC_RELAXED);
+		}
+
+		__to_timespec(next, &wakeup);
+		do {
+			ret = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeup, NULL);
+		} while (ret == EINTR);
+	}
+
+	_I("ADC stream thread is finishing...");
+
+	return NULL;
+}
+
+int resource_adc_stream_start(unsigned int ch_mask, unsigned int rate)
+{
+	struct sched_param param;
+	int ret = 0;
+
+	retv_if(ch_mask == 0 || (ch_mask >> MCP3008_CH_MAX), -1);
+	retv_if(rate < ADC_STREAM_RATE_MIN || rate > ADC_STREAM_RATE_MAX, -1);
+
+	if (stream.running) {
+		_D("ADC stream is already running");
+		return 0;
+	}
+
+	ret = resource_adc_mcp3008_init();
+	retv_if(ret < 0, -1);
+
+	stream.ch_mask = ch_mask;
+	stream.rate = rate;
+	stream.frames = 0;
+	stream.overruns = 0;
+	stream.late = 0;
+	stream.head = 0;
+	stream.tail = 0;
+	stream.stop_requested = 0;
+	stream.start_time = _get_timestamp_ns();
+	stream.stop_time = 0;
+
+	ret = pthread_create(&stream.thread, NULL, __stream_thread, NULL);
+	if (ret != 0) {
+		_E("Failed to create ADC stream thread[%d]", ret);
+		resource_adc_mcp3008_fini();
+		return -1;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = ADC_STREAM_THREAD_PRIORITY;
+	ret = pthread_setschedparam(stream.thread, SCHED_FIFO, &param);
+	if (ret != 0)
+		_W("ADC stream thread runs without real-time priority[%d]", ret);
+
+	stream.running = 1;
+
+	_I("ADC stream is running - channels[0x%02x], rate[%u]", ch_mask, rate);
+
+	return 0;
+}
+
+void resource_adc_stream_stop(void)
+{
+	if (!stream.running)
+		return;
+
+	__atomic_store_n(&stream.stop_requested, 1, __ATOMIC_RELEASE);
+	pthread_join(stream.thread, NULL);
+	stream.running = 0;
+	stream.stop_time = _get_timestamp_ns();
+
+	resource_adc_mcp3008_fini();
+}
+
+int resource_adc_stream_read_begin(unsigned int max_count, resource_adc_stream_block_s *block)
+{
+	unsigned int tail = 0;
+	unsigned int head = 0;
+	unsigned int count = 0;
+
+	retv_if(!block, -1);
+
+	tail = __atomic_load_n(&stream.tail, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&stream.head, __ATOMIC_ACQUIRE);
+
+	count = head - tail;
+	/* Stop at the end of the ring to keep the block contiguous */
+	if (count > ADC_STREAM_RING_FRAMES - (tail & RING_MASK))
+		count = ADC_STREAM_RING_FRAMES - (tail & RING_MASK);
+	if (count > max_count)
+		count = max_count;
+
+	block->frames = &stream.ring[tail & RING_MASK];
+	block->count = count;
+
+	return count;
+}
+
+void resource_adc_stream_read_end(unsigned int count)
+{
+	unsigned int tail = __atomic_load_n(&stream.tail, __ATOMIC_RELAXED);
+	unsigned int head = __atomic_load_n(&stream.head, __ATOMIC_ACQUIRE);
+
+	if (count > head - tail)
+		count = head - tail;
+
+	__atomic_store_n(&stream.tail, tail + count, __ATOMIC_RELEASE);
+}
+
+int resource_adc_stream_get_stats(resource_adc_stream_stats_s *stats)
+{
+	unsigned long long elapsed = 0;
+
+	retv_if(!stats, -1);
+
+	stats->requested_rate = stream.rate;
+	stats->frames = __atomic_load_n(&stream.frames, __ATOMIC_RELAXED);
+	stats->overruns = __atomic_load_n(&stream.overruns, __ATOMIC_RELAXED);
+	stats->late = __atomic_load_n(&stream.late, __ATOMIC_RELAXED);
+
+	if (stream.stop_time)
+		elapsed = stream.stop_time - stream.start_time;
+	else if (stream.start_time)
+		elapsed = _get_timestamp_ns() - stream.start_time;
+	stats->achieved_rate = elapsed ? stats->frames * 1000000000.0 / elapsed : 0.0;
+
+	return 0;
+}
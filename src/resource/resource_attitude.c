@@ -0,0 +1,412 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "log.h"
+#include "resource/resource_attitude.h"
+
+#define DEG_TO_RAD 0.017453292519943295f
+#define RAD_TO_DEG 57.29577951308232f
+#define ATTITUDE_DT_MAX 0.1f /* s, a longer gap is not integrated, the engine re-levels instead */
+
+#define ATTITUDE_DEFAULT_TIME_CONSTANT 0.5f
+#define ATTITUDE_DEFAULT_BETA 0.1f
+#define ATTITUDE_DEFAULT_KP 1.0f
+#define ATTITUDE_DEFAULT_KI 0.02f
+
+struct _resource_attitude_engine_s {
+	resource_attitude_config_s config;
+	int initialized;
+	unsigned long long timestamp;
+	float roll; /* complementary state, radians */
+	float pitch;
+	float yaw;
+	float q[4]; /* Madgwick and Mahony state */
+	float integral[3]; /* Mahony gyro bias estimate */
+};
+
+static const char *filter_name[ATTITUDE_FILTER_MAX] = {
+	"complementary", "madgwick", "mahony",
+};
+
+static inline float __inv_sqrt(float x)
+{
+	return 1.0f / sqrtf(x);
+}
+
+static void __euler_to_quaternion(float roll, float pitch, float yaw, float *q)
+{
+	float cr = cosf(roll * 0.5f);
+	float sr = sinf(roll * 0.5f);
+	float cp = cosf(pitch * 0.5f);
+	float sp = sinf(pitch * 0.5f);
+	float cy = cosf(yaw * 0.5f);
+	float sy = sinf(yaw * 0.5f);
+
+	q[0] = cr * cp * cy + sr * sp * sy;
+	q[1] = sr * cp * cy - cr * sp * sy;
+	q[2] = cr * sp * cy + sr * cp * sy;
+	q[3] = cr * cp * sy - sr * sp * cy;
+}
+
+static void __quaternion_to_euler(const float *q, float *roll, float *pitch, float *yaw)
+{
+	float sinp = 2.0f * (q[0] * q[2] - q[3] * q[1]);
+
+	if (sinp > 1.0f)
+		sinp = 1.0f;
+	else if (sinp < -1.0f)
+		sinp = -1.0f;
+
+	*roll = atan2f(2.0f * (q[0] * q[1] + q[2] * q[3]), 1.0f - 2.0f * (q[1] * q[1] + q[2] * q[2]));
+	*pitch = asinf(sinp);
+	*yaw = atan2f(2.0f * (q[0] * q[3] + q[1] * q[2]), 1.0f - 2.0f * (q[2] * q[2] + q[3] * q[3]));
+}
+
+/* Levels the engine from the accelerometer alone, the yaw is kept */
+static void __level(resource_attitude_engine_s *engine, const resource_imu_sample_s *sample)
+{
+	const float *a = sample->accel;
+	float roll = 0.0f;
+	float pitch = 0.0f;
+
+	if (!engine->initialized)
+		engine->yaw = 0.0f;
+	else if (engine->config.filter != ATTITUDE_FILTER_COMPLEMENTARY)
+		__quaternion_to_euler(engine->q, &roll, &pitch, &engine->yaw);
+
+	engine->roll = atan2f(a[1], a[2]);
+	engine->pitch = atan2f(-a[0], sqrtf(a[1] * a[1] + a[2] * a[2]));
+	__euler_to_quaternion(engine->roll, engine->pitch, engine->yaw, engine->q);
+	memset(engine->integral, 0, sizeof(engine->integral));
+	engine->initialized = 1;
+}
+
+static void __update_complementary(resource_attitude_engine_s *engine, const resource_imu_sample_s *sample, float dt)
+{
+	const float *a = sample->accel;
+	float alpha = engine->config.time_constant / (engine->config.time_constant + dt);
+
+	engine->roll += sample->gyro[0] * DEG_TO_RAD * dt;
+	engine->pitch += sample->gyro[1] * DEG_TO_RAD * dt;
+	engine->yaw += sample->gyro[2] * DEG_TO_RAD * dt;
+
+	if (a[0] == 0.0f && a[1] == 0.0f && a[2] == 0.0f)
+		return;
+
+	engine->roll = alpha * engine->roll + (1.0f - alpha) * atan2f(a[1], a[2]);
+	engine->pitch = alpha * engine->pitch + (1.0f - alpha) * atan2f(-a[0], sqrtf(a[1] * a[1] + a[2] * a[2]));
+}
+
+static void __update_madgwick(resource_attitude_engine_s *engine, const resource_imu_sample_s *sample, float dt)
+{
+	float *q = engine->q;
+	float gx = sample->gyro[0] * DEG_TO_RAD;
+	float gy = sample->gyro[1] * DEG_TO_RAD;
+	float gz = sample->gyro[2] * DEG_TO_RAD;
+	float ax = sample->accel[0];
+	float ay = sample->accel[1];
+	float az = sample->accel[2];
+	float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	float qd0 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+	float qd1 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+	float qd2 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+	float qd3 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+	float norm = 0.0f;
+
+	if (!(ax == 0.0f && ay == 0.0f && az == 0.0f)) {
+		float s0, s1, s2, s3;
+		float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1, _2q2 = 2.0f * q2, _2q3 = 2.0f * q3;
+		float _4q0 = 4.0f * q0, _4q1 = 4.0f * q1, _4q2 = 4.0f * q2;
+		float _8q1 = 8.0f * q1, _8q2 = 8.0f * q2;
+		float q0q0 = q0 * q0, q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3;
+
+		norm = __inv_sqrt(ax * ax + ay * ay + az * az);
+		ax *= norm;
+		ay *= norm;
+		az *= norm;
+
+		/* Gradient descent step towards the gravity measured by the accelerometer */
+		s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+		s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+		s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+		s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+
+		norm = s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3;
+		if (norm > 0.0f) {
+			norm = __inv_sqrt(norm);
+			qd0 -= engine->config.beta * s0 * norm;
+			qd1 -= engine->config.beta * s1 * norm;
+			qd2 -= engine->config.beta * s2 * norm;
+			qd3 -= engine->config.beta * s3 * norm;
+		}
+	}
+
+	q0 += qd0 * dt;
+	q1 += qd1 * dt;
+	q2 += qd2 * dt;
+	q3 += qd3 * dt;
+
+	norm = __inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q[0] = q0 * norm;
+	q[1] = q1 * norm;
+	q[2] = q2 * norm;
+	q[3] = q3 * norm;
+}
+
+static void __update_mahony(resource_attitude_engine_s *engine, const resource_imu_sample_s *sample, float dt)
+{
+	float *q = engine->q;
+	float gx = sample->gyro[0] * DEG_TO_RAD;
+	float gy = sample->gyro[1] * DEG_TO_RAD;
+	float gz = sample->gyro[2] * DEG_TO_RAD;
+	float ax = sample->accel[0];
+	float ay = sample->accel[1];
+	float az = sample->accel[2];
+	float q0 = q[0], q1 = q[1], q2 = q[2], q3 = q[3];
+	float norm = 0.0f;
+
+	if (!(ax == 0.0f && ay == 0.0f && az == 0.0f)) {
+		float vx, vy, vz, ex, ey, ez;
+
+		norm = __inv_sqrt(ax * ax + ay * ay + az * az);
+		ax *= norm;
+		ay *= norm;
+		az *= norm;
+
+		/* Gravity expected from the attitude, the error is its cross product with the measured one */
+		vx = q1 * q3 - q0 * q2;
+		vy = q0 * q1 + q2 * q3;
+		vz = q0 * q0 - 0.5f + q3 * q3;
+		ex = ay * vz - az * vy;
+		ey = az * vx - ax * vz;
+		ez = ax * vy - ay * vx;
+
+		if (engine->config.ki > 0.0f) {
+			engine->integral[0] += engine->config.ki * ex * dt;
+			engine->integral[1] += engine->config.ki * ey * dt;
+			engine->integral[2] += engine->config.ki * ez * dt;
+			gx += engine->integral[0];
+			gy += engine->integral[1];
+			gz += engine->integral[2];
+		}
+
+		gx += engine->config.kp * ex;
+		gy += engine->config.kp * ey;
+		gz += engine->config.kp * ez;
+	}
+
+	gx *= 0.5f * dt;
+	gy *= 0.5f * dt;
+	gz *= 0.5f * dt;
+	q[0] = q0 - q1 * gx - q2 * gy - q3 * gz;
+	q[1] = q1 + q0 * gx + q2 * gz - q3 * gy;
+	q[2] = q2 + q0 * gy - q1 * gz + q3 * gx;
+	q[3] = q3 + q0 * gz + q1 * gy - q2 * gx;
+
+	norm = __inv_sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+	q[0] *= norm;
+	q[1] *= norm;
+	q[2] *= norm;
+	q[3] *= norm;
+}
+
+int resource_get_attitude_default_config(resource_attitude_filter_e filter, resource_attitude_config_s *config)
+{
+	retv_if(!config, -1);
+	retv_if(filter < ATTITUDE_FILTER_COMPLEMENTARY || filter >= ATTITUDE_FILTER_MAX, -1);
+
+	config->filter = filter;
+	config->time_constant = ATTITUDE_DEFAULT_TIME_CONSTANT;
+	config->beta = ATTITUDE_DEFAULT_BETA;
+	config->kp = ATTITUDE_DEFAULT_KP;
+	config->ki = ATTITUDE_DEFAULT_KI;
+
+	return 0;
+}
+
+resource_attitude_engine_s *resource_create_attitude_engine(const resource_attitude_config_s *config)
+{
+	resource_attitude_engine_s *engine = NULL;
+
+	engine = calloc(1, sizeof(resource_attitude_engine_s));
+	retv_if(!engine, NULL);
+
+	if (config) {
+		if (config->filter < ATTITUDE_FILTER_COMPLEMENTARY || config->filter >= ATTITUDE_FILTER_MAX
+			|| config->time_constant < 0.0f || config->beta < 0.0f || config->kp < 0.0f || config->ki < 0.0f) {
+			_E("Invalid attitude configuration");
+			free(engine);
+			return NULL;
+		}
+		engine->config = *config;
+	} else {
+		resource_get_attitude_default_config(ATTITUDE_FILTER_COMPLEMENTARY, &engine->config);
+	}
+
+	resource_reset_attitude_engine(engine);
+
+	return engine;
+}
+
+void resource_destroy_attitude_engine(resource_attitude_engine_s *engine)
+{
+	free(engine);
+}
+
+void resource_reset_attitude_engine(resource_attitude_engine_s *engine)
+{
+	ret_if(!engine);
+
+	engine->initialized = 0;
+	engine->timestamp = 0;
+	engine->roll = 0.0f;
+	engine->pitch = 0.0f;
+	engine->yaw = 0.0f;
+	engine->q[0] = 1.0f;
+	engine->q[1] = 0.0f;
+	engine->q[2] = 0.0f;
+	engine->q[3] = 0.0f;
+	memset(engine->integral, 0, sizeof(engine->integral));
+}
+
+int resource_update_attitude(resource_attitude_engine_s *engine, const resource_imu_sample_s *samples, unsigned int count)
+{
+	unsigned int i = 0;
+
+	retv_if(!engine, -1);
+	retv_if(!samples && count, -1);
+
+	for (i = 0; i < count; i++) {
+		const resource_imu_sample_s *sample = &samples[i];
+		float dt = 0.0f;
+
+		if (engine->initialized && sample->timestamp > engine->timestamp)
+			dt = (sample->timestamp - engine->timestamp) / 1000000.0f;
+
+		if (!engine->initialized || dt <= 0.0f || dt > ATTITUDE_DT_MAX) {
+			if (!engine->initialized || dt > ATTITUDE_DT_MAX)
+				__level(engine, sample);
+			engine->timestamp = sample->timestamp;
+			continue;
+		}
+
+		switch (engine->config.filter) {
+		case ATTITUDE_FILTER_MADGWICK:
+			__update_madgwick(engine, sample, dt);
+			break;
+		case ATTITUDE_FILTER_MAHONY:
+			__update_mahony(engine, sample, dt);
+			break;
+		case ATTITUDE_FILTER_COMPLEMENTARY:
+		default:
+			__update_complementary(engine, sample, dt);
+			break;
+		}
+		engine->timestamp = sample->timestamp;
+	}
+
+	return 0;
+}
+
+int resource_get_attitude(resource_attitude_engine_s *engine, resource_attitude_s *attitude)
+{
+	float roll = 0.0f;
+	float pitch = 0.0f;
+	float yaw = 0.0f;
+
+	retv_if(!engine, -1);
+	retv_if(!attitude, -1);
+
+	if (engine->config.filter == ATTITUDE_FILTER_COMPLEMENTARY) {
+		roll = engine->roll;
+		pitch = engine->pitch;
+		yaw = engine->yaw;
+		__euler_to_quaternion(roll, pitch, yaw, attitude->q);
+	} else {
+		__quaternion_to_euler(engine->q, &roll, &pitch, &yaw);
+		memcpy(attitude->q, engine->q, sizeof(attitude->q));
+	}
+
+	attitude->roll = roll * RAD_TO_DEG;
+	attitude->pitch = pitch * RAD_TO_DEG;
+	attitude->yaw = yaw * RAD_TO_DEG;
+	attitude->timestamp = engine->timestamp;
+
+	return 0;
+}
+
+static unsigned long long _get_timestamp_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+int resource_benchmark_attitude(unsigned int count, unsigned int iterations)
+{
+	resource_attitude_config_s config;
+	resource_attitude_engine_s *engine = NULL;
+	resource_imu_sample_s *samples = NULL;
+	resource_attitude_s attitude;
+	unsigned long long start = 0;
+	unsigned long long elapsed = 0;
+	unsigned int i = 0;
+	int filter = 0;
+
+	retv_if(count == 0 || iterations == 0, -1);
+
+	samples = malloc(sizeof(resource_imu_sample_s) * count);
+	retv_if(!samples, -1);
+
+	/* A 1 kHz sway around the x axis, like a stroller rolling over a bumpy path */
+	for (i = 0; i < count; i++) {
+		float angle = 0.2f * sinf(i * 0.01f);
+
+		samples[i].accel[0] = 0.0f;
+		samples[i].accel[1] = sinf(angle);
+		samples[i].accel[2] = cosf(angle);
+		samples[i].gyro[0] = 0.2f * 0.01f * 1000.0f * cosf(i * 0.01f) * RAD_TO_DEG;
+		samples[i].gyro[1] = 0.0f;
+		samples[i].gyro[2] = 0.0f;
+		samples[i].timestamp = 1000 + i * 1000ULL;
+	}
+
+	for (filter = ATTITUDE_FILTER_COMPLEMENTARY; filter < ATTITUDE_FILTER_MAX; filter++) {
+		resource_get_attitude_default_config(filter, &config);
+		engine = resource_create_attitude_engine(&config);
+		if (!engine)
+			break;
+
+		start = _get_timestamp_ns();
+		for (i = 0; i < iterations; i++) {
+			resource_reset_attitude_engine(engine);
+			resource_update_attitude(engine, samples, count);
+		}
+		elapsed = _get_timestamp_ns() - start;
+
+		resource_get_attitude(engine, &attitude);
+		_I("attitude filter[%s] : %.1f ns/sample, roll[%.2f] expected[%.2f]",
+			filter_name[filter], (double)elapsed / ((double)count * iterations),
+			attitude.roll, 0.2f * sinf((count - 1) * 0.01f) * RAD_TO_DEG);
+
+		resource_destroy_attitude_engine(engine);
+	}
+
+	free(samples);
+
+	return 0;
+}
@@ -0,0 +1,255 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <math.h>
+
+#include "log.h"
+#include "resource/resource_filter.h"
+
+/*
+ * The running median keeps the window in a ring and orders it with two heaps
+ * sharing one index array: heap[0] is the median, positive indexes form the
+ * min-heap of the larger half and negative indexes the max-heap of the smaller half.
+ */
+struct _resource_filter_s {
+	resource_filter_config_s config;
+
+	double data[RESOURCE_FILTER_WINDOW_MAX];
+	int pos[RESOURCE_FILTER_WINDOW_MAX];
+	int heap_storage[RESOURCE_FILTER_WINDOW_MAX];
+	int *heap;
+	int idx;
+	int count;
+
+	int has_output;
+	double output;
+	unsigned long long output_timestamp;
+	unsigned int rejected;
+};
+
+#define MIN_COUNT(f) (((f)->count - 1) / 2)
+#define MAX_COUNT(f) ((f)->count / 2)
+
+static inline int __less(resource_filter_s *filter, int i, int j)
+{
+	return filter->data[filter->heap[i]] < filter->data[filter->heap[j]];
+}
+
+static inline int __exchange(resource_filter_s *filter, int i, int j)
+{
+	int t = filter->heap[i];
+
+	filter->heap[i] = filter->heap[j];
+	filter->heap[j] = t;
+	filter->pos[filter->heap[i]] = i;
+	filter->pos[filter->heap[j]] = j;
+
+	return 1;
+}
+
+static inline int __compare_exchange(resource_filter_s *filter, int i, int j)
+{
+	return __less(filter, i, j) && __exchange(filter, i, j);
+}
+
+static void __min_sort_down(resource_filter_s *filter, int i)
+{
+	for (i *= 2; i <= MIN_COUNT(filter); i *= 2) {
+		if (i < MIN_COUNT(filter) && __less(filter, i + 1, i))
+			i++;
+		if (!__compare_exchange(filter, i, i / 2))
+			break;
+	}
+}
+
+static void __max_sort_down(resource_filter_s *filter, int i)
+{
+	for (i *= 2; i >= -MAX_COUNT(filter); i *= 2) {
+		if (i > -MAX_COUNT(filter) && __less(filter, i, i - 1))
+			i--;
+		if (!__compare_exchange(filter, i / 2, i))
+			break;
+	}
+}
+
+static int __min_sort_up(resource_filter_s *filter, int i)
+{
+	while (i > 0 && __compare_exchange(filter, i, i / 2))
+		i /= 2;
+
+	return i == 0;
+}
+
+static int __max_sort_up(resource_filter_s *filter, int i)
+{
+	while (i < 0 && __compare_exchange(filter, i / 2, i))
+		i /= 2;
+
+	return i == 0;
+}
+
+/* The median changed, push it into the max-heap if it is smaller than the top of that heap */
+static int __median_sort_max(resource_filter_s *filter)
+{
+	if (!MAX_COUNT(filter) || !__compare_exchange(filter, 0, -1))
+		return 0;
+
+	__max_sort_down(filter, -1);
+
+	return 1;
+}
+
+static int __median_sort_min(resource_filter_s *filter)
+{
+	if (!MIN_COUNT(filter) || !__compare_exchange(filter, 1, 0))
+		return 0;
+
+	__min_sort_down(filter, 1);
+
+	return 1;
+}
+
+static void __median_insert(resource_filter_s *filter, double value)
+{
+	int is_new = filter->count < (int)filter->config.window;
+	int p = filter->pos[filter->idx];
+	double old = filter->data[filter->idx];
+
+	filter->data[filter->idx] = value;
+	filter->idx = (filter->idx + 1) % filter->config.window;
+	filter->count += is_new;
+
+	if (p > 0) {
+		if (!is_new && old < value)
+			__min_sort_down(filter, p);
+		else if (__min_sort_up(filter, p))
+			__median_sort_max(filter);
+	} else if (p < 0) {
+		if (!is_new && value < old)
+			__max_sort_down(filter, p);
+		else if (__max_sort_up(filter, p))
+			__median_sort_min(filter);
+	} else {
+		if (!__median_sort_max(filter))
+			__median_sort_min(filter);
+	}
+}
+
+static double __median_get(resource_filter_s *filter)
+{
+	double value = filter->data[filter->heap[0]];
+
+	if ((filter->count & 1) == 0)
+		value = (value + filter->data[filter->heap[-1]]) / 2.0;
+
+	return value;
+}
+
+void resource_filter_reset(resource_filter_s *filter)
+{
+	int n = 0;
+
+	ret_if(!filter);
+
+	n = filter->config.window;
+	filter->heap = filter->heap_storage + n / 2;
+	filter->idx = 0;
+	filter->count = 0;
+
+	/* Initial fill pattern : median, max, min, max, ... */
+	while (n--) {
+		filter->pos[n] = ((n + 1) / 2) * ((n & 1) ? -1 : 1);
+		filter->heap[filter->pos[n]] = n;
+	}
+
+	filter->has_output = 0;
+	filter->output = 0.0;
+	filter->output_timestamp = 0;
+	filter->rejected = 0;
+}
+
+resource_filter_s *resource_filter_create(const resource_filter_config_s *config)
+{
+	resource_filter_s *filter = NULL;
+
+	retv_if(!config, NULL);
+	retvm_if(config->window < 1 || config->window > RESOURCE_FILTER_WINDOW_MAX, NULL,
+		"Invalid window : %u", config->window);
+	retvm_if(config->max_rate < 0.0 || config->hold_time < 0.0, NULL, "Invalid configuration");
+
+	filter = calloc(1, sizeof(resource_filter_s));
+	retv_if(!filter, NULL);
+
+	filter->config = *config;
+	resource_filter_reset(filter);
+
+	return filter;
+}
+
+void resource_filter_destroy(resource_filter_s *filter)
+{
+	free(filter);
+}
+
+static int __hold(resource_filter_s *filter, unsigned long long timestamp, double *out_value)
+{
+	if (!filter->has_output)
+		return 0;
+
+	if (timestamp > filter->output_timestamp
+		&& (timestamp - filter->output_timestamp) / 1000000.0 > filter->config.hold_time) {
+		/* The held value got too old, start over from the next valid sample */
+		resource_filter_reset(filter);
+		return 0;
+	}
+
+	*out_value = filter->output;
+
+	return 1;
+}
+
+int resource_filter_update(resource_filter_s *filter, double value, int valid,
+	unsigned long long timestamp, double *out_value)
+{
+	retv_if(!filter, -1);
+	retv_if(!out_value, -1);
+
+	if (!valid || isnan(value))
+		return __hold(filter, timestamp, out_value);
+
+	if (filter->has_output && filter->config.max_rate > 0.0) {
+		double elapsed = 0.0;
+
+		if (timestamp > filter->output_timestamp)
+			elapsed = (timestamp - filter->output_timestamp) / 1000000.0;
+
+		if (fabs(value - filter->output) > filter->config.max_rate * elapsed) {
+			filter->rejected++;
+			if (filter->rejected < filter->config.window)
+				return __hold(filter, timestamp, out_value);
+
+			/* A whole window disagrees, the scene has really changed */
+			resource_filter_reset(filter);
+		}
+	}
+
+	filter->rejected = 0;
+	__median_insert(filter, value);
+
+	filter->output = __median_get(filter);
+	filter->output_timestamp = timestamp;
+	filter->has_output = 1;
+	*out_value = filter->output;
+
+	return 1;
+}
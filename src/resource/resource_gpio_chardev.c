@@ -0,0 +1,373 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include <peripheral_io.h>
+
+#include "log.h"
+#include "resource_internal.h"
+#include "resource/resource_gpio_chardev.h"
+
+#define GPIO_CHIP_PATH "/dev/gpiochip0"
+#define GPIO_CONSUMER_LABEL "position-finder"
+
+static struct {
+	int opened;
+	int line_fd;
+	unsigned int count;
+	int pins[GPIOHANDLES_MAX];
+} snapshot = { 0, -1, 0, };
+
+/* Which uapi each line event fd is requested with, the v2 one is tried first */
+static struct {
+	int used;
+	int fd;
+	int v2;
+} line_events[PIN_MAX];
+
+static void __close_snapshot_pin(int pin_num)
+{
+	if (!resource_get_info(pin_num)->opened) return;
+
+	peripheral_gpio_close(resource_get_info(pin_num)->sensor_h);
+	resource_get_info(pin_num)->opened = 0;
+}
+
+static int __open_snapshot_line_handle(void)
+{
+	struct gpiohandle_request req;
+	unsigned int i = 0;
+	int chip_fd = -1;
+	int ret = 0;
+
+	chip_fd = open(GPIO_CHIP_PATH, O_RDONLY | O_CLOEXEC);
+	retvm_if(chip_fd < 0, -1, "failed to open %s[%d]", GPIO_CHIP_PATH, errno);
+
+	memset(&req, 0, sizeof(struct gpiohandle_request));
+	for (i = 0; i < snapshot.count; i++)
+		req.lineoffsets[i] = snapshot.pins[i];
+	req.lines = snapshot.count;
+	req.flags = GPIOHANDLE_REQUEST_INPUT;
+	snprintf(req.consumer_label, sizeof(req.consumer_label), "%s", GPIO_CONSUMER_LABEL);
+
+	ret = ioctl(chip_fd, GPIO_GET_LINEHANDLE_IOCTL, &req);
+	close(chip_fd);
+	retvm_if(ret < 0, -1, "failed to request line handle[%d]", errno);
+
+	snapshot.line_fd = req.fd;
+
+	return 0;
+}
+
+static int __open_snapshot_pins(void)
+{
+	unsigned int i = 0;
+	int pin_num = 0;
+	int ret = 0;
+
+	for (i = 0; i < snapshot.count; i++) {
+		pin_num = snapshot.pins[i];
+		if (resource_get_info(pin_num)->opened)
+			continue;
+
+		ret = peripheral_gpio_open(pin_num, &resource_get_info(pin_num)->sensor_h);
+		retv_if(!resource_get_info(pin_num)->sensor_h, -1);
+
+		ret = peripheral_gpio_set_direction(resource_get_info(pin_num)->sensor_h, PERIPHERAL_GPIO_DIRECTION_IN);
+		retv_if(ret != 0, -1);
+
+		resource_get_info(pin_num)->opened = 1;
+		resource_get_info(pin_num)->close = __close_snapshot_pin;
+	}
+
+	return 0;
+}
+
+int resource_open_gpio_snapshot(const int *pins, unsigned int count)
+{
+	unsigned int i = 0;
+	int ret = 0;
+
+	retv_if(!pins, -1);
+	retv_if(count == 0 || count > GPIOHANDLES_MAX, -1);
+
+	if (snapshot.opened)
+		resource_close_gpio_snapshot();
+
+	for (i = 0; i < count; i++) {
+		retvm_if(pins[i] < 0 || pins[i] >= PIN_MAX, -1, "pin[%d] is out of range", pins[i]);
+		snapshot.pins[i] = pins[i];
+	}
+	snapshot.count = count;
+
+	ret = __open_snapshot_line_handle();
+	if (ret < 0) {
+		_W("gpio character device is not available, falls back to read each pin");
+		ret = __open_snapshot_pins();
+		retv_if(ret < 0, -1);
+	}
+
+	snapshot.opened = 1;
+	_I("GPIO snapshot is opened - %u pins, %s", count, snapshot.line_fd >= 0 ? "line handle" : "per pin");
+
+	return 0;
+}
+
+int resource_read_gpio_snapshot(uint64_t *out_mask)
+{
+	struct gpiohandle_data data;
+	uint64_t mask = 0;
+	uint32_t value = 0;
+	unsigned int i = 0;
+	int ret = 0;
+
+	retv_if(!out_mask, -1);
+	retvm_if(!snapshot.opened, -1, "GPIO snapshot is not opened");
+
+	if (snapshot.line_fd >= 0) {
+		memset(&data, 0, sizeof(struct gpiohandle_data));
+		ret = ioctl(snapshot.line_fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data);
+		retvm_if(ret < 0, -1, "failed to get line values[%d]", errno);
+
+		for (i = 0; i < snapshot.count; i++) {
+			if (data.values[i])
+				mask |= 1ULL << snapshot.pins[i];
+		}
+	} else {
+		for (i = 0; i < snapshot.count; i++) {
+			ret = peripheral_gpio_read(resource_get_info(snapshot.pins[i])->sensor_h, &value);
+			retv_if(ret < 0, -1);
+
+			if (value)
+				mask |= 1ULL << snapshot.pins[i];
+		}
+	}
+
+	*out_mask = mask;
+
+	return 0;
+}
+
+void resource_close_gpio_snapshot(void)
+{
+	unsigned int i = 0;
+
+	if (!snapshot.opened) return;
+
+	_I("GPIO snapshot is finishing...");
+
+	if (snapshot.line_fd >= 0) {
+		close(snapshot.line_fd);
+		snapshot.line_fd = -1;
+	} else {
+		for (i = 0; i < snapshot.count; i++) {
+			if (resource_get_info(snapshot.pins[i])->close == __close_snapshot_pin)
+				__close_snapshot_pin(snapshot.pins[i]);
+		}
+	}
+
+	snapshot.count = 0;
+	snapshot.opened = 0;
+}
+
+static unsigned long long __get_clock_ns(clockid_t clock_id)
+{
+	struct timespec t;
+	clock_gettime(clock_id, &t);
+	return (unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+/*
+ * GPIO v1 events are stamped with CLOCK_REALTIME before linux 5.7 and CLOCK_MONOTONIC after,
+ * so map the timestamp onto the monotonic clock by taking the closer one.
+ */
+static unsigned long long __to_monotonic_ns(unsigned long long timestamp)
+{
+	unsigned long long mono = __get_clock_ns(CLOCK_MONOTONIC);
+	unsigned long long real = __get_clock_ns(CLOCK_REALTIME);
+	unsigned long long mono_diff = mono > timestamp ? mono - timestamp : timestamp - mono;
+	unsigned long long real_diff = real > timestamp ? real - timestamp : timestamp - real;
+
+	if (mono_diff <= real_diff)
+		return timestamp;
+
+	return timestamp - (real - mono);
+}
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+static int __request_line_event_v2(int chip_fd, int pin_num, peripheral_gpio_edge_e edge)
+{
+	struct gpio_v2_line_request req;
+	int ret = 0;
+
+	memset(&req, 0, sizeof(struct gpio_v2_line_request));
+	req.offsets[0] = pin_num;
+	req.num_lines = 1;
+	req.config.flags = GPIO_V2_LINE_FLAG_INPUT;
+	if (edge == PERIPHERAL_GPIO_EDGE_RISING || edge == PERIPHERAL_GPIO_EDGE_BOTH)
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_RISING;
+	if (edge == PERIPHERAL_GPIO_EDGE_FALLING || edge == PERIPHERAL_GPIO_EDGE_BOTH)
+		req.config.flags |= GPIO_V2_LINE_FLAG_EDGE_FALLING;
+	snprintf(req.consumer, sizeof(req.consumer), "%s", GPIO_CONSUMER_LABEL);
+
+	ret = ioctl(chip_fd, GPIO_V2_GET_LINE_IOCTL, &req);
+	if (ret < 0)
+		return -1;
+
+	return req.fd;
+}
+#endif
+
+static int __request_line_event_v1(int chip_fd, int pin_num, peripheral_gpio_edge_e edge)
+{
+	struct gpioevent_request req;
+	int ret = 0;
+
+	memset(&req, 0, sizeof(struct gpioevent_request));
+	req.lineoffset = pin_num;
+	req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+	if (edge == PERIPHERAL_GPIO_EDGE_RISING)
+		req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+	else if (edge == PERIPHERAL_GPIO_EDGE_FALLING)
+		req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+	else
+		req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+	snprintf(req.consumer_label, sizeof(req.consumer_label), "%s", GPIO_CONSUMER_LABEL);
+
+	ret = ioctl(chip_fd, GPIO_GET_LINEEVENT_IOCTL, &req);
+	if (ret < 0)
+		return -1;
+
+	return req.fd;
+}
+
+static int __find_line_event(int fd)
+{
+	int i = 0;
+
+	for (i = 0; i < PIN_MAX; i++) {
+		if (line_events[i].used && line_events[i].fd == fd)
+			return i;
+	}
+
+	return -1;
+}
+
+int resource_open_gpio_line_event(int pin_num, peripheral_gpio_edge_e edge, int *out_fd)
+{
+	int chip_fd = -1;
+	int line_fd = -1;
+	int slot = 0;
+	int v2 = 0;
+	int ret = 0;
+
+	retv_if(pin_num < 0 || pin_num >= PIN_MAX, -1);
+	retv_if(edge == PERIPHERAL_GPIO_EDGE_NONE, -1);
+	retv_if(!out_fd, -1);
+
+	for (slot = 0; slot < PIN_MAX; slot++) {
+		if (!line_events[slot].used)
+			break;
+	}
+	retvm_if(slot == PIN_MAX, -1, "too many line events");
+
+	chip_fd = open(GPIO_CHIP_PATH, O_RDONLY | O_CLOEXEC);
+	retvm_if(chip_fd < 0, -1, "failed to open %s[%d]", GPIO_CHIP_PATH, errno);
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	/* The headers may be newer than the kernel, which then rejects the v2 request */
+	line_fd = __request_line_event_v2(chip_fd, pin_num, edge);
+	if (line_fd >= 0)
+		v2 = 1;
+	else
+		_D("gpio v2 line request of pin[%d] failed[%d], falls back to v1", pin_num, errno);
+#endif
+	if (line_fd < 0)
+		line_fd = __request_line_event_v1(chip_fd, pin_num, edge);
+	close(chip_fd);
+	retvm_if(line_fd < 0, -1, "failed to request line event of pin[%d][%d]", pin_num, errno);
+
+	ret = fcntl(line_fd, F_SETFL, fcntl(line_fd, F_GETFL) | O_NONBLOCK);
+	if (ret < 0) {
+		_E("failed to set non-blocking[%d]", errno);
+		close(line_fd);
+		return -1;
+	}
+
+	line_events[slot].fd = line_fd;
+	line_events[slot].v2 = v2;
+	line_events[slot].used = 1;
+
+	*out_fd = line_fd;
+
+	return 0;
+}
+
+int resource_read_gpio_line_event(int fd, resource_gpio_line_event_s *event)
+{
+	struct gpioevent_data v1_data;
+	ssize_t size = 0;
+	int slot = 0;
+
+	retv_if(fd < 0, -1);
+	retv_if(!event, -1);
+
+	slot = __find_line_event(fd);
+	retvm_if(slot < 0, -1, "fd[%d] is not a line event", fd);
+
+#ifdef GPIO_V2_GET_LINE_IOCTL
+	if (line_events[slot].v2) {
+		struct gpio_v2_line_event data;
+
+		size = read(fd, &data, sizeof(data));
+		if (size < 0 && (errno == EAGAIN || errno == EINTR))
+			return 0;
+		retvm_if(size != sizeof(data), -1, "failed to read line event[%d]", errno);
+
+		event->rising = data.id == GPIO_V2_LINE_EVENT_RISING_EDGE;
+		event->timestamp = data.timestamp_ns;
+
+		return 1;
+	}
+#endif
+
+	size = read(fd, &v1_data, sizeof(v1_data));
+	if (size < 0 && (errno == EAGAIN || errno == EINTR))
+		return 0;
+	retvm_if(size != sizeof(v1_data), -1, "failed to read line event[%d]", errno);
+
+	event->rising = v1_data.id == GPIOEVENT_EVENT_RISING_EDGE;
+	event->timestamp = __to_monotonic_ns(v1_data.timestamp);
+
+	return 1;
+}
+
+void resource_close_gpio_line_event(int fd)
+{
+	int slot = 0;
+
+	if (fd < 0) return;
+
+	slot = __find_line_event(fd);
+	if (slot >= 0)
+		line_events[slot].used = 0;
+
+	close(fd);
+}
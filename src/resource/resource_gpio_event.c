@@ -0,0 +1,199 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <peripheral_io.h>
+#include <Ecore.h>
+
+#include "log.h"
+#include "resource_internal.h"
+
+typedef struct _gpio_event_info_s {
+	int subscribed;
+	peripheral_gpio_edge_e edge;
+	unsigned long long debounce; /* in microseconds */
+	unsigned long long last_timestamp;
+	uint32_t last_value;
+	int notified;
+	unsigned int ignored;
+	Ecore_Timer *settle_timer; /* re-reads the pin when the debounce ends, for both edges */
+	resource_gpio_event_cb cb;
+	void *data;
+} gpio_event_info_s;
+
+static gpio_event_info_s gpio_event_info[PIN_MAX];
+
+static unsigned long long _get_timestamp(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec) / 1000;
+}
+
+static void __notify(gpio_event_info_s *info, uint32_t value, unsigned long long timestamp)
+{
+	resource_gpio_event_s event;
+
+	info->last_timestamp = timestamp;
+	info->last_value = value;
+	info->notified = 1;
+
+	event.pin_num = info - gpio_event_info;
+	event.value = value;
+	event.timestamp = timestamp;
+
+	if (info->cb)
+		info->cb(&event, info->data);
+}
+
+/* The edges ignored in the debounce may have left the pin at another level than the one notified */
+static Eina_Bool __settle_cb(void *data)
+{
+	gpio_event_info_s *info = data;
+	uint32_t value = 0;
+	int ret = 0;
+
+	ret = peripheral_gpio_read(resource_get_info(info - gpio_event_info)->sensor_h, &value);
+	if (ret != PERIPHERAL_ERROR_NONE) {
+		_E("failed to read gpio[%d]", (int)(info - gpio_event_info));
+		info->settle_timer = NULL;
+		return ECORE_CALLBACK_CANCEL;
+	}
+
+	if (value == info->last_value) {
+		info->settle_timer = NULL;
+		return ECORE_CALLBACK_CANCEL;
+	}
+
+	/* The level notified now opens a debounce of its own */
+	__notify(info, value, _get_timestamp());
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+static void _resource_gpio_event_cb(peripheral_gpio_h gpio, peripheral_error_e error, void *user_data)
+{
+	gpio_event_info_s *info = user_data;
+	unsigned long long timestamp = _get_timestamp();
+	uint32_t value = 0;
+	int ret = 0;
+
+	ret_if(!info);
+	ret_if(!info->subscribed);
+
+	switch (info->edge) {
+	case PERIPHERAL_GPIO_EDGE_RISING:
+		value = 1;
+		break;
+	case PERIPHERAL_GPIO_EDGE_FALLING:
+		value = 0;
+		break;
+	default:
+		ret = peripheral_gpio_read(gpio, &value);
+		retm_if(ret != PERIPHERAL_ERROR_NONE, "failed to read gpio[%d]", (int)(info - gpio_event_info));
+		break;
+	}
+
+	if (info->notified) {
+		if (timestamp - info->last_timestamp < info->debounce) {
+			info->ignored++;
+			return;
+		}
+
+		/* The settle read keeps last_value right, so the same level again is a bounce we missed */
+		if (info->edge == PERIPHERAL_GPIO_EDGE_BOTH && value == info->last_value) {
+			info->ignored++;
+			return;
+		}
+	}
+
+	__notify(info, value, timestamp);
+
+	if (info->edge == PERIPHERAL_GPIO_EDGE_BOTH && info->debounce) {
+		if (info->settle_timer)
+			ecore_timer_del(info->settle_timer);
+		info->settle_timer = ecore_timer_add(info->debounce / 1000000.0, __settle_cb, info);
+		if (!info->settle_timer)
+			_E("failed to add the settle timer of gpio[%d]", (int)(info - gpio_event_info));
+	}
+}
+
+int resource_subscribe_gpio_event(int pin_num, peripheral_gpio_edge_e edge, unsigned int debounce_ms,
+	resource_gpio_event_cb cb, void *data, void (*close) (int))
+{
+	gpio_event_info_s *info = NULL;
+	int ret = PERIPHERAL_ERROR_NONE;
+
+	retv_if(pin_num < 0 || pin_num >= PIN_MAX, -1);
+	retv_if(edge == PERIPHERAL_GPIO_EDGE_NONE, -1);
+	retv_if(!cb, -1);
+
+	if (!resource_get_info(pin_num)->opened) {
+		ret = peripheral_gpio_open(pin_num, &resource_get_info(pin_num)->sensor_h);
+		retv_if(!resource_get_info(pin_num)->sensor_h, -1);
+
+		ret = peripheral_gpio_set_direction(resource_get_info(pin_num)->sensor_h, PERIPHERAL_GPIO_DIRECTION_IN);
+		retv_if(ret != 0, -1);
+
+		resource_get_info(pin_num)->opened = 1;
+		resource_get_info(pin_num)->close = close;
+	}
+
+	info = &gpio_event_info[pin_num];
+	if (info->subscribed)
+		peripheral_gpio_unset_interrupted_cb(resource_get_info(pin_num)->sensor_h);
+
+	if (info->settle_timer)
+		ecore_timer_del(info->settle_timer);
+
+	memset(info, 0, sizeof(gpio_event_info_s));
+	info->edge = edge;
+	info->debounce = (unsigned long long)debounce_ms * 1000;
+	info->cb = cb;
+	info->data = data;
+
+	ret = peripheral_gpio_set_edge_mode(resource_get_info(pin_num)->sensor_h, edge);
+	retv_if(ret != 0, -1);
+
+	ret = peripheral_gpio_set_interrupted_cb(resource_get_info(pin_num)->sensor_h, _resource_gpio_event_cb, info);
+	retv_if(ret != 0, -1);
+
+	info->subscribed = 1;
+
+	_I("GPIO[%d] is subscribed - edge[%d] debounce[%u ms]", pin_num, edge, debounce_ms);
+
+	return 0;
+}
+
+void resource_unsubscribe_gpio_event(int pin_num)
+{
+	gpio_event_info_s *info = NULL;
+
+	ret_if(pin_num < 0 || pin_num >= PIN_MAX);
+
+	info = &gpio_event_info[pin_num];
+	if (!info->subscribed)
+		return;
+
+	if (resource_get_info(pin_num)->opened) {
+		peripheral_gpio_unset_interrupted_cb(resource_get_info(pin_num)->sensor_h);
+		peripheral_gpio_set_edge_mode(resource_get_info(pin_num)->sensor_h, PERIPHERAL_GPIO_EDGE_NONE);
+	}
+
+	if (info->settle_timer)
+		ecore_timer_del(info->settle_timer);
+
+	_D("GPIO[%d] is unsubscribed - %u edges ignored", pin_num, info->ignored);
+	memset(info, 0, sizeof(gpio_event_info_s));
+}
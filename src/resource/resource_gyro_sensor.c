@@ -10,13 +10,29 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <limits.h>
+#include <glib.h>
+#include <app_common.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
 #include <peripheral_io.h>
 #include "log.h"
 #include "resource/resource_gyro_sensor.h"
+#include "resource/resource_gpio_chardev.h"
+#include "resource/resource_attitude.h"
 
 #define RPI3_I2C_BUS 1
+#define I2C_DEV_PATH_FORMAT "/dev/i2c-%d"
 
 /* Registers/etc: */
 #define MPU6050_Address 0x68	/*Device Address/Identifier for MPU6050*/
@@ -24,15 +40,51 @@
 #define SMPLRT_DIV   0x19
 #define CONFIG       0x1A
 #define GYRO_CONFIG  0x1B
+#define FIFO_EN      0x23
+#define INT_PIN_CFG  0x37
 #define INT_ENABLE   0x38
+#define INT_STATUS   0x3A
+#define USER_CTRL    0x6A
+#define FIFO_COUNT_H 0x72
+#define FIFO_R_W     0x74
 #define ACCEL_XOUT_H 0x3B
 #define ACCEL_YOUT_H 0x3D
 #define ACCEL_ZOUT_H 0x3F
+#define TEMP_OUT_H   0x41
 #define GYRO_XOUT_H  0x43
 #define GYRO_YOUT_H  0x45
 #define GYRO_ZOUT_H  0x47
 
+#define MPU6050_BURST_SIZE 14 /* ACCEL_XOUT_H to GYRO_ZOUT_L, the register address auto-increments */
+
+#define MPU6050_FIFO_SIZE 1024
+#define MPU6050_FIFO_SAMPLE_SIZE 12 /* accel then gyro, 6 bytes each */
+#define MPU6050_GYRO_RATE_DLPF 1000 /* gyro output rate in Hz while the low pass filter is on */
+#define ACCEL_SENSITIVITY 16384.0f /* LSB/g at AFS_SEL 0 */
+#define GYRO_SENSITIVITY 16.4f /* LSB/(deg/s) at FS_SEL 3, as GYRO_CONFIG is set to 24 */
+
+#define CALIBRATION_FILE_NAME "gyro_calibration.ini"
+#define CALIBRATION_GROUP_NAME "mpu6050"
+#define CALIBRATION_KEY_GYRO_BIAS "gyro_bias"
+#define CALIBRATION_KEY_ACCEL_SCALE "accel_scale"
+#define CALIBRATION_SAMPLE_INTERVAL 1000000 /* ns, the output rate of the sensor */
+#define CALIBRATION_VALIDATION_SAMPLES 50
+#define CALIBRATION_STATIONARY_GYRO_STDDEV 1.0 /* deg/s, more means the device was moved */
+#define CALIBRATION_STATIONARY_ACCEL_STDDEV 0.02 /* g */
+#define CALIBRATION_VALID_GYRO_BIAS 0.5 /* deg/s, residual bias accepted at startup */
+
 /* Bits: */
+#define FIFO_EN_ACCEL_GYRO 0x78 /* XG, YG, ZG and ACCEL */
+#define USER_CTRL_FIFO_EN  0x40
+#define USER_CTRL_FIFO_RESET 0x04
+#define INT_PIN_CFG_LATCH  0x20 /* the pin stays high until INT_STATUS is read */
+#define INT_DATA_RDY       0x01
+#define INT_FIFO_OFLOW     0x10
+#define CONFIG_DLPF_188HZ  0x01
+
+#define GYRO_FIFO_POLL_TIMEOUT 100 /* ms, also recovers from a missed edge */
+#define GYRO_FIFO_ANCHOR_GAIN 8 /* an edge corrects 1/8 of the timestamp error, follows the drift of the oscillator */
+#define GYRO_FIFO_THREAD_PRIORITY 50
 #define RESTART            0x80
 #define SLEEP              0x10
 #define ALLCALL            0x01
@@ -40,16 +92,84 @@
 #define OUTDRV             0x04
 
 static peripheral_i2c_h g_i2c_h = NULL;
-static unsigned int ref_count = 0;
-float Angle_x=0;
+static int configured = 0;
+/* A raw i2c-dev handle to the same device, to read a burst in one combined transaction */
+static int i2c_fd = -1;
+/* The bus is shared by the main loop and the FIFO drain thread */
+static pthread_mutex_t i2c_lock = PTHREAD_MUTEX_INITIALIZER;
+static resource_attitude_engine_s *tilt_engine = NULL;
+static resource_gyro_calibration_s calibration = {
+	.gyro_bias = { 0.0f, 0.0f, 0.0f },
+	.accel_scale = 1.0f,
+};
+static unsigned long long tilt_timestamp = 0;
+
+static struct {
+	int running;
+	int stop_requested;
+	pthread_t thread;
+	int int_fd;
+	unsigned int rate;
+	unsigned int batch;
+	unsigned long long period; /* ns */
+	unsigned long long anchor; /* ns, when the sample of the index 0 was taken */
+	unsigned long long index; /* of the next sample to be drained */
+	int anchored;
+	resource_gyro_sample_s samples[GYRO_FIFO_SAMPLE_MAX];
+	resource_gyro_batch_cb cb;
+	void *data;
+	resource_gyro_fifo_stats_s stats;
+} fifo = {
+	.int_fd = -1,
+};
+
+static void __open_i2c_dev(void)
+{
+	char path[32] = {0, };
+
+	snprintf(path, sizeof(path), I2C_DEV_PATH_FORMAT, RPI3_I2C_BUS);
+	i2c_fd = open(path, O_RDWR | O_CLOEXEC);
+	if (i2c_fd < 0)
+		_W("cannot open %s, reading a burst in two transactions", path);
+}
+
+void resource_close_gyro_sensor(void)
+{
+	resource_stop_gyro_sensor_fifo();
+
+	if (i2c_fd >= 0) {
+		close(i2c_fd);
+		i2c_fd = -1;
+	}
+
+	if (g_i2c_h) {
+		peripheral_i2c_close(g_i2c_h);
+		g_i2c_h = NULL;
+	}
+
+	configured = 0;
+
+	resource_destroy_attitude_engine(tilt_engine);
+	tilt_engine = NULL;
+	tilt_timestamp = 0;
+}
 
 int resource_gyro_sensor_init()
 {
-	uint8_t mode1 = 0;
 	int ret = PERIPHERAL_ERROR_NONE;
 
-	if (g_i2c_h == NULL)
+	/* The registers keep their values, the device is configured only once */
+	if (configured)
+		return 0;
+
+	if (g_i2c_h == NULL) {
 		ret = peripheral_i2c_open(RPI3_I2C_BUS, MPU6050_Address , &g_i2c_h);
+		if (ret != PERIPHERAL_ERROR_NONE) {
+			_E("failed to open i2c");
+			g_i2c_h = NULL;
+			return -1;
+		}
+	}
 
 	ret = peripheral_i2c_write_register_byte(g_i2c_h,SMPLRT_DIV, 7);  //write to sample rate register
 	if (ret != PERIPHERAL_ERROR_NONE) {
@@ -81,84 +201,657 @@ int resource_gyro_sensor_init()
 		goto ERROR;
 	}
 
+	__open_i2c_dev();
+	configured = 1;
+
 	return 0;
 
 
 ERROR:
-	if (g_i2c_h)
-		peripheral_i2c_close(g_i2c_h);
-
-	g_i2c_h = NULL;
+	resource_close_gyro_sensor();
 	return -1;
 }
 
-short read_raw_data(int addr){
-	
+static int __read_burst_locked(uint8_t reg, uint8_t *buf, uint16_t length)
+{
+	struct i2c_msg msgs[2];
+	struct i2c_rdwr_ioctl_data rdwr;
 	int ret = PERIPHERAL_ERROR_NONE;
-	short high_byte,low_byte,value;
 
-	ret = peripheral_i2c_read_register_byte(g_i2c_h, addr , &high_byte);
-	if (ret != PERIPHERAL_ERROR_NONE) {
-		_E("failed to read register");
+	if (i2c_fd >= 0) {
+		/* Register address write and data read joined by a repeated start */
+		msgs[0].addr = MPU6050_Address;
+		msgs[0].flags = 0;
+		msgs[0].len = 1;
+		msgs[0].buf = &reg;
+		msgs[1].addr = MPU6050_Address;
+		msgs[1].flags = I2C_M_RD;
+		msgs[1].len = length;
+		msgs[1].buf = buf;
+		rdwr.msgs = msgs;
+		rdwr.nmsgs = 2;
+
+		ret = ioctl(i2c_fd, I2C_RDWR, &rdwr);
+		retvm_if(ret < 0, -1, "failed to read burst from register[0x%02x]", reg);
+
+		return 0;
+	}
+
+	ret = peripheral_i2c_write(g_i2c_h, &reg, 1);
+	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register address");
+
+	ret = peripheral_i2c_read(g_i2c_h, buf, length);
+	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to read burst");
+
+	return 0;
+}
+
+static int __read_burst(uint8_t reg, uint8_t *buf, uint16_t length)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&i2c_lock);
+	ret = __read_burst_locked(reg, buf, length);
+	pthread_mutex_unlock(&i2c_lock);
+
+	return ret;
+}
+
+static int __write_register(uint8_t reg, uint8_t value)
+{
+	int ret = PERIPHERAL_ERROR_NONE;
+
+	pthread_mutex_lock(&i2c_lock);
+	ret = peripheral_i2c_write_register_byte(g_i2c_h, reg, value);
+	pthread_mutex_unlock(&i2c_lock);
+	retvm_if(ret != PERIPHERAL_ERROR_NONE, -1, "failed to write register[0x%02x]", reg);
+
+	return 0;
+}
+
+static inline short __to_short(const uint8_t *buf)
+{
+	return (short)((buf[0] << 8) | buf[1]);
+}
+
+int resource_read_gyro_sensor_raw(resource_gyro_raw_s *raw)
+{
+	uint8_t buf[MPU6050_BURST_SIZE] = {0, };
+	int ret = 0;
+	int i = 0;
+
+	retv_if(!raw, -1);
+
+	ret = resource_gyro_sensor_init();
+	retv_if(ret < 0, -1);
 
+	ret = __read_burst(ACCEL_XOUT_H, buf, MPU6050_BURST_SIZE);
+	retv_if(ret < 0, -1);
+
+	for (i = 0; i < 3; i++) {
+		raw->accel[i] = __to_short(&buf[i * 2]);
+		raw->gyro[i] = __to_short(&buf[GYRO_XOUT_H - ACCEL_XOUT_H + i * 2]);
 	}
+	raw->temperature = __to_short(&buf[TEMP_OUT_H - ACCEL_XOUT_H]);
 
-	ret = peripheral_i2c_read_register_byte(g_i2c_h, addr+1 ,&low_byte);
-	if (ret != PERIPHERAL_ERROR_NONE) {
-		_E("failed to read register");
+	return 0;
+}
+
+void resource_convert_gyro_sensor_raw(const resource_gyro_raw_s *raw, unsigned int count, resource_imu_sample_s *samples)
+{
+	unsigned int i = 0;
+	int k = 0;
+
+	ret_if(!raw);
+	ret_if(!samples);
 
+	for (i = 0; i < count; i++) {
+		for (k = 0; k < 3; k++) {
+			samples[i].accel[k] = raw[i].accel[k] / ACCEL_SENSITIVITY * calibration.accel_scale;
+			samples[i].gyro[k] = raw[i].gyro[k] / GYRO_SENSITIVITY - calibration.gyro_bias[k];
+		}
 	}
-	value = (high_byte << 8) + low_byte;
-	if (value > 32768)
-		value=value-65536;
-	return value;
 }
 
-int resource_calculate_tilt(float rate_Gx, float interval){
+int resource_read_gyro_sensor(float interval, float *tilt)
+{
+	resource_gyro_raw_s raw;
+	resource_imu_sample_s sample;
+	resource_attitude_s attitude;
+	int ret = 0;
+
+	retv_if(!tilt, -1);
+
+	ret = resource_read_gyro_sensor_raw(&raw);
+	retv_if(ret < 0, -1);
+
+	if (!tilt_engine) {
+		tilt_engine = resource_create_attitude_engine(NULL);
+		retv_if(!tilt_engine, -1);
+	}
+
+	/* The caller paces the reads, the interval is its time step */
+	resource_convert_gyro_sensor_raw(&raw, 1, &sample);
+	tilt_timestamp += (unsigned long long)(interval * 1000000.0f);
+	sample.timestamp = tilt_timestamp;
 
-	Angle_x += (rate_Gx)*interval;
-	_D("\n Angle_x = %.1f", Angle_x);
+	_D("Gx=%.3f °/s\tGy=%.3f °/s\tGz=%.3f °/s", sample.gyro[0], sample.gyro[1], sample.gyro[2]);
+	_D("Ax=%.3f g\tAy=%.3f g\tAz=%.3f g", sample.accel[0], sample.accel[1], sample.accel[2]);
 
-	return Angle_x;
+	ret = resource_update_attitude(tilt_engine, &sample, 1);
+	retv_if(ret < 0, -1);
 
+	resource_get_attitude(tilt_engine, &attitude);
+	*tilt = attitude.roll;
+
+	return 0;
 }
 
-int resource_read_gyro_sensor(float interval, float *tilt){
+static unsigned long long _get_timestamp_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
 
-	int ret = PERIPHERAL_ERROR_NONE;
-	float Acc_x,Acc_y,Acc_z;
-	float Gyro_x,Gyro_y,Gyro_z;
-	float Ax=0, Ay=0, Az=0;
-	float Gx=0, Gy=0, Gz=0;
+static void __sleep_ns(unsigned long long ns)
+{
+	struct timespec t;
+	int ret = 0;
+
+	t.tv_sec = ns / 1000000000LL;
+	t.tv_nsec = ns % 1000000000LL;
+	do {
+		ret = nanosleep(&t, &t);
+	} while (ret < 0 && errno == EINTR);
+}
+
+static int __reset_fifo(void)
+{
+	retv_if(__write_register(USER_CTRL, USER_CTRL_FIFO_RESET) < 0, -1);
+	retv_if(__write_register(USER_CTRL, USER_CTRL_FIFO_EN) < 0, -1);
+
+	fifo.anchored = 0;
+	fifo.index = 0;
+
+	return 0;
+}
+
+/* The first data-ready edge after the latch is cleared marks the sample of fifo.index */
+static void __follow_edge(unsigned long long edge)
+{
+	long long period = (long long)fifo.period;
+	long long error = 0;
+
+	if (!fifo.anchored) {
+		fifo.anchor = edge - fifo.index * fifo.period;
+		fifo.anchored = 1;
+		return;
+	}
+
+	error = (long long)(edge - (fifo.anchor + fifo.index * fifo.period));
+	if (error > -period / 2 && error < period / 2) {
+		fifo.anchor += error / GYRO_FIFO_ANCHOR_GAIN;
+	} else if (error > period * 4 || error < -period * 4) {
+		_W("gyro timestamps are off by %lld ns, re-anchoring", error);
+		fifo.anchor = edge - fifo.index * fifo.period;
+	}
+	/* Otherwise the edge came from a sample drained already, it tells nothing */
+}
+
+static void __drain_fifo(void)
+{
+	uint8_t buf[GYRO_FIFO_SAMPLE_MAX * MPU6050_FIFO_SAMPLE_SIZE];
+	uint8_t count_buf[2] = {0, };
+	uint8_t status = 0;
+	unsigned int count = 0;
+	unsigned int i = 0;
+	int k = 0;
+
+	/* Reading the status clears the latched INT pin, the next sample raises it again */
+	ret_if(__read_burst(INT_STATUS, &status, 1) < 0);
+
+	if (status & INT_FIFO_OFLOW) {
+		_W("gyro FIFO overflowed, resetting");
+		fifo.stats.overflows++;
+		__reset_fifo();
+		return;
+	}
+
+	ret_if(__read_burst(FIFO_COUNT_H, count_buf, 2) < 0);
+	count = ((count_buf[0] << 8) | count_buf[1]) / MPU6050_FIFO_SAMPLE_SIZE;
+	if (count == 0)
+		return;
+	if (count > GYRO_FIFO_SAMPLE_MAX)
+		count = GYRO_FIFO_SAMPLE_MAX;
+
+	ret_if(__read_burst(FIFO_R_W, buf, count * MPU6050_FIFO_SAMPLE_SIZE) < 0);
+
+	if (!fifo.anchored) {
+		/* No edge to anchor to yet, assume the newest sample was just taken */
+		fifo.anchor = _get_timestamp_ns() - (fifo.index + count - 1) * fifo.period;
+		fifo.anchored = 1;
+	}
+
+	for (i = 0; i < count; i++) {
+		resource_gyro_sample_s *sample = &fifo.samples[i];
+		const uint8_t *p = &buf[i * MPU6050_FIFO_SAMPLE_SIZE];
+
+		for (k = 0; k < 3; k++) {
+			sample->raw.accel[k] = __to_short(&p[k * 2]);
+			sample->raw.gyro[k] = __to_short(&p[6 + k * 2]);
+		}
+		sample->raw.temperature = 0;
+		sample->timestamp = (fifo.anchor + fifo.index * fifo.period) / 1000;
+		fifo.index++;
+	}
+
+	fifo.stats.samples += count;
+	fifo.stats.batches++;
+	if (count > fifo.stats.max_batch)
+		fifo.stats.max_batch = count;
+
+	if (fifo.cb)
+		fifo.cb(fifo.samples, count, fifo.data);
+}
+
+static void *__fifo_thread(void *data)
+{
+	unsigned long long batch_delay = (fifo.batch - 1) * fifo.period;
+	resource_gpio_line_event_s event;
+	struct pollfd pfd;
+	int edge = 0;
+	int ret = 0;
+
+	_I("Gyro FIFO thread is running...");
+
+	while (!__atomic_load_n(&fifo.stop_requested, __ATOMIC_ACQUIRE)) {
+		if (fifo.int_fd < 0) {
+			__sleep_ns(fifo.batch * fifo.period);
+			__drain_fifo();
+			continue;
+		}
+
+		pfd.fd = fifo.int_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		ret = poll(&pfd, 1, GYRO_FIFO_POLL_TIMEOUT);
+		if (ret < 0 && errno == EINTR)
+			continue;
+
+		edge = 0;
+		while (resource_read_gpio_line_event(fifo.int_fd, &event) == 1) {
+			if (!edge)
+				__follow_edge(event.timestamp);
+			edge = 1;
+		}
+
+		/* Let the FIFO gather the batch, the pin stays latched meanwhile */
+		if (edge && batch_delay)
+			__sleep_ns(batch_delay);
+
+		__drain_fifo();
+	}
+
+	_I("Gyro FIFO thread is finishing...");
+
+	return NULL;
+}
+
+static void __restore_registers(void)
+{
+	__write_register(INT_ENABLE, 0);
+	__write_register(FIFO_EN, 0);
+	__write_register(USER_CTRL, 0);
+	__write_register(INT_PIN_CFG, 0);
+	__write_register(SMPLRT_DIV, 7);
+	__write_register(CONFIG, 0);
+	__write_register(INT_ENABLE, 1);
+}
+
+int resource_start_gyro_sensor_fifo(int int_pin_num, unsigned int rate, unsigned int batch,
+	resource_gyro_batch_cb cb, void *data)
+{
+	struct sched_param param;
+	unsigned int div = 0;
+	int ret = 0;
+
+	retv_if(rate < GYRO_FIFO_RATE_MIN || rate > GYRO_FIFO_RATE_MAX, -1);
+	retv_if(batch == 0 || batch > GYRO_FIFO_SAMPLE_MAX, -1);
+
+	if (fifo.running) {
+		_D("gyro FIFO is already running");
+		return 0;
+	}
 
 	ret = resource_gyro_sensor_init();
+	retv_if(ret < 0, -1);
+
+	div = MPU6050_GYRO_RATE_DLPF / rate - 1;
+	fifo.rate = MPU6050_GYRO_RATE_DLPF / (div + 1);
+	fifo.period = 1000000000ULL / fifo.rate;
+	fifo.batch = batch;
+	fifo.cb = cb;
+	fifo.data = data;
+	memset(&fifo.stats, 0, sizeof(fifo.stats));
+	fifo.stats.rate = fifo.rate;
+
+	if (__write_register(INT_ENABLE, 0) < 0
+		|| __write_register(CONFIG, CONFIG_DLPF_188HZ) < 0
+		|| __write_register(SMPLRT_DIV, div) < 0
+		|| __write_register(INT_PIN_CFG, INT_PIN_CFG_LATCH) < 0
+		|| __write_register(FIFO_EN, FIFO_EN_ACCEL_GYRO) < 0
+		|| __reset_fifo() < 0
+		|| __write_register(INT_ENABLE, INT_DATA_RDY | INT_FIFO_OFLOW) < 0) {
+		_E("Failed to configure gyro FIFO");
+		__restore_registers();
+		return -1;
+	}
 
-	Acc_x = read_raw_data(ACCEL_XOUT_H);
-	Acc_y = read_raw_data(ACCEL_YOUT_H);
-	Acc_z = read_raw_data(ACCEL_ZOUT_H);
+	fifo.int_fd = -1;
+	if (int_pin_num >= 0 && resource_open_gpio_line_event(int_pin_num, PERIPHERAL_GPIO_EDGE_RISING, &fifo.int_fd) < 0) {
+		_W("No interrupt from gpio[%d], draining the gyro FIFO periodically", int_pin_num);
+		fifo.int_fd = -1;
+	}
 
-	Gyro_x = read_raw_data(GYRO_XOUT_H);
-	Gyro_y = read_raw_data(GYRO_YOUT_H);
-	Gyro_z = read_raw_data(GYRO_ZOUT_H);
+	fifo.stop_requested = 0;
+	ret = pthread_create(&fifo.thread, NULL, __fifo_thread, NULL);
+	if (ret != 0) {
+		_E("Failed to create gyro FIFO thread[%d]", ret);
+		if (fifo.int_fd >= 0) {
+			resource_close_gpio_line_event(fifo.int_fd);
+			fifo.int_fd = -1;
+		}
+		__restore_registers();
+		return -1;
+	}
 
-	Ax = Acc_x/16384.0;
-	Ay = Acc_y/16384.0;
-	Az = Acc_z/16384.0;
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = GYRO_FIFO_THREAD_PRIORITY;
+	ret = pthread_setschedparam(fifo.thread, SCHED_FIFO, &param);
+	if (ret != 0)
+		_W("Gyro FIFO thread runs without real-time priority[%d]", ret);
 
-	Gx = Gyro_x/131;
-	Gy = Gyro_y/131;
-	Gz = Gyro_z/131;
+	fifo.running = 1;
 
+	_I("Gyro FIFO is running - rate[%u Hz], batch[%u]", fifo.rate, batch);
 
-	_D("\n Gx=%d °/s\tGy=%.3f °/s\tGz=%.3f °/s", (int)Gx+1, Gy+1, Gz);
-	_D("\n Ax=%.1f g\tAy=%.1f g\tAz=%.1f g \n", Ax, Ay, Az);
+	return 0;
+}
+
+void resource_stop_gyro_sensor_fifo(void)
+{
+	if (!fifo.running)
+		return;
+
+	__atomic_store_n(&fifo.stop_requested, 1, __ATOMIC_RELEASE);
+	pthread_join(fifo.thread, NULL);
+	fifo.running = 0;
+
+	if (fifo.int_fd >= 0) {
+		resource_close_gpio_line_event(fifo.int_fd);
+		fifo.int_fd = -1;
+	}
+
+	__restore_registers();
+
+	_I("Gyro FIFO - samples[%llu] batches[%llu] overflows[%llu] max batch[%u]",
+		fifo.stats.samples, fifo.stats.batches, fifo.stats.overflows, fifo.stats.max_batch);
+}
 
-	*tilt= resource_calculate_tilt((int)Gx+1, interval);
+int resource_get_gyro_sensor_fifo_stats(resource_gyro_fifo_stats_s *stats)
+{
+	retv_if(!stats, -1);
 
+	*stats = fifo.stats;
 
 	return 0;
+}
 
+/* Mean and standard deviation of stationary samples, uncalibrated */
+typedef struct _calibration_stats_s {
+	double gyro_mean[3];
+	double gyro_stddev[3];
+	double accel_mean[3];
+	double accel_norm_stddev;
+} calibration_stats_s;
+
+static int __collect_calibration_stats(unsigned int count, calibration_stats_s *stats)
+{
+	resource_gyro_raw_s raw;
+	double gyro_sq[3] = {0.0, };
+	double norm_sum = 0.0;
+	double norm_sq = 0.0;
+	unsigned int i = 0;
+	int k = 0;
+
+	memset(stats, 0, sizeof(calibration_stats_s));
+
+	for (i = 0; i < count; i++) {
+		double norm = 0.0;
+
+		retv_if(resource_read_gyro_sensor_raw(&raw) < 0, -1);
+
+		for (k = 0; k < 3; k++) {
+			double g = raw.gyro[k] / GYRO_SENSITIVITY;
+			double a = raw.accel[k] / ACCEL_SENSITIVITY;
+
+			stats->gyro_mean[k] += g;
+			gyro_sq[k] += g * g;
+			stats->accel_mean[k] += a;
+			norm += a * a;
+		}
+		norm = sqrt(norm);
+		norm_sum += norm;
+		norm_sq += norm * norm;
+
+		__sleep_ns(CALIBRATION_SAMPLE_INTERVAL);
+	}
+
+	for (k = 0; k < 3; k++) {
+		stats->gyro_mean[k] /= count;
+		stats->accel_mean[k] /= count;
+		stats->gyro_stddev[k] = sqrt(fmax(gyro_sq[k] / count - stats->gyro_mean[k] * stats->gyro_mean[k], 0.0));
+	}
+	norm_sum /= count;
+	stats->accel_norm_stddev = sqrt(fmax(norm_sq / count - norm_sum * norm_sum, 0.0));
+
+	return 0;
+}
+
+static int __is_stationary(const calibration_stats_s *stats)
+{
+	int k = 0;
+
+	for (k = 0; k < 3; k++) {
+		if (stats->gyro_stddev[k] > CALIBRATION_STATIONARY_GYRO_STDDEV)
+			return 0;
+	}
+
+	return stats->accel_norm_stddev <= CALIBRATION_STATIONARY_ACCEL_STDDEV;
+}
+
+static int __get_calibration_path(char *path, size_t size)
+{
+	char *prefix = NULL;
+
+	prefix = app_get_data_path();
+	retv_if(!prefix, -1);
+	snprintf(path, size, "%s%s", prefix, CALIBRATION_FILE_NAME);
+	free(prefix);
+
+	return 0;
 }
 
+static int __load_list(GKeyFile *gkf, const char *key, float *values)
+{
+	gdouble *list = NULL;
+	gsize length = 0;
+	int k = 0;
+
+	list = g_key_file_get_double_list(gkf, CALIBRATION_GROUP_NAME, key, &length, NULL);
+	retvm_if(!list, -1, "could not get the key %s", key);
 
+	if (length != 3) {
+		_E("key %s has %u values", key, (unsigned int)length);
+		g_free(list);
+		return -1;
+	}
+
+	for (k = 0; k < 3; k++)
+		values[k] = list[k];
+	g_free(list);
 
+	return 0;
+}
+
+static void __save_list(GKeyFile *gkf, const char *key, const float *values)
+{
+	gdouble list[3];
+	int k = 0;
+
+	for (k = 0; k < 3; k++)
+		list[k] = values[k];
+
+	g_key_file_set_double_list(gkf, CALIBRATION_GROUP_NAME, key, list, 3);
+}
+
+static int __load_calibration(resource_gyro_calibration_s *out)
+{
+	char path[PATH_MAX] = {0, };
+	resource_gyro_calibration_s loaded;
+	GError *error = NULL;
+	GKeyFile *gkf = NULL;
+	int ret = 0;
+
+	retv_if(__get_calibration_path(path, sizeof(path)) < 0, -1);
+
+	gkf = g_key_file_new();
+	retv_if(!gkf, -1);
+
+	if (!g_key_file_load_from_file(gkf, path, G_KEY_FILE_NONE, NULL)) {
+		_I("no gyro calibration in %s", path);
+		g_key_file_free(gkf);
+		return -1;
+	}
+
+	ret = __load_list(gkf, CALIBRATION_KEY_GYRO_BIAS, loaded.gyro_bias);
+	loaded.accel_scale = g_key_file_get_double(gkf, CALIBRATION_GROUP_NAME, CALIBRATION_KEY_ACCEL_SCALE, &error);
+	if (error) {
+		_E("could not get the key %s - %s", CALIBRATION_KEY_ACCEL_SCALE, error->message);
+		g_error_free(error);
+		ret = -1;
+	}
+	g_key_file_free(gkf);
+	retv_if(ret != 0, -1);
+
+	*out = loaded;
+
+	return 0;
+}
+
+static int __save_calibration(const resource_gyro_calibration_s *in)
+{
+	char path[PATH_MAX] = {0, };
+	GKeyFile *gkf = NULL;
+	gboolean saved = FALSE;
+
+	retv_if(__get_calibration_path(path, sizeof(path)) < 0, -1);
+
+	gkf = g_key_file_new();
+	retv_if(!gkf, -1);
+
+	__save_list(gkf, CALIBRATION_KEY_GYRO_BIAS, in->gyro_bias);
+	g_key_file_set_double(gkf, CALIBRATION_GROUP_NAME, CALIBRATION_KEY_ACCEL_SCALE, in->accel_scale);
+
+	saved = g_key_file_save_to_file(gkf, path, NULL);
+	g_key_file_free(gkf);
+	retvm_if(!saved, -1, "could not save gyro calibration to %s", path);
+
+	return 0;
+}
+
+int resource_calibrate_gyro_sensor(unsigned int count, resource_gyro_calibration_s *out)
+{
+	calibration_stats_s stats;
+	resource_gyro_calibration_s result;
+	double norm = 0.0;
+	int k = 0;
+
+	retv_if(count < CALIBRATION_VALIDATION_SAMPLES, -1);
+
+	retv_if(__collect_calibration_stats(count, &stats) < 0, -1);
+	retvm_if(!__is_stationary(&stats), -1, "the device moved while calibrating the gyro");
+
+	for (k = 0; k < 3; k++) {
+		result.gyro_bias[k] = stats.gyro_mean[k];
+		norm += stats.accel_mean[k] * stats.accel_mean[k];
+	}
+
+	/* At rest the accelerometer must read 1 g whatever the orientation is */
+	norm = sqrt(norm);
+	retvm_if(norm < 0.5 || norm > 1.5, -1, "accelerometer reads %.3f g at rest", norm);
+	result.accel_scale = 1.0 / norm;
+
+	calibration = result;
+	if (out)
+		*out = result;
+
+	_I("gyro calibrated - bias[%.3f %.3f %.3f] deg/s, accel scale[%.4f]",
+		result.gyro_bias[0], result.gyro_bias[1], result.gyro_bias[2], result.accel_scale);
+
+	/* The calibration is in use already, it is only measured again on the next start */
+	if (__save_calibration(&result) < 0)
+		_W("gyro calibration is not saved, it is redone on the next start");
+
+	return 0;
+}
+
+int resource_init_gyro_sensor_calibration(unsigned int count)
+{
+	resource_gyro_calibration_s loaded;
+	calibration_stats_s stats;
+	unsigned long long start = _get_timestamp_ns();
+	int valid = 1;
+	int ret = 0;
+	int k = 0;
+
+	if (__load_calibration(&loaded) == 0) {
+		/* A quick look at the residual bias instead of a full calibration */
+		ret = __collect_calibration_stats(CALIBRATION_VALIDATION_SAMPLES, &stats);
+		retv_if(ret < 0, -1);
+
+		if (__is_stationary(&stats)) {
+			for (k = 0; k < 3; k++) {
+				if (fabs(stats.gyro_mean[k] - loaded.gyro_bias[k]) > CALIBRATION_VALID_GYRO_BIAS)
+					valid = 0;
+			}
+		} else {
+			/* The bias cannot be checked while moving, keep the saved one anyway */
+			calibration = loaded;
+			_W("device is moving, saved gyro calibration is accepted unverified - bias[%.3f %.3f %.3f] deg/s",
+				loaded.gyro_bias[0], loaded.gyro_bias[1], loaded.gyro_bias[2]);
+			return 0;
+		}
+
+		if (valid) {
+			calibration = loaded;
+			_I("gyro calibration loaded and validated in %llu ms", (_get_timestamp_ns() - start) / 1000000);
+			return 0;
+		}
+
+		_W("saved gyro calibration is stale, recalibrating");
+	} else {
+		/* A moving device fails the full calibration anyway, find it out in a few samples */
+		ret = __collect_calibration_stats(CALIBRATION_VALIDATION_SAMPLES, &stats);
+		retv_if(ret < 0, -1);
+		retvm_if(!__is_stationary(&stats), -1, "device is moving, gyro is not calibrated");
+	}
+
+	ret = resource_calibrate_gyro_sensor(count, NULL);
+	retv_if(ret < 0, -1);
+
+	_I("gyro calibrated in %llu ms", (_get_timestamp_ns() - start) / 1000000);
+
+	return 0;
+}
@@ -21,53 +21,194 @@
 
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
 #include <peripheral_io.h>
 #include <sys/time.h>
+#include <Ecore.h>
 
 #include "log.h"
 #include "resource_internal.h"
+#include "resource/resource_illuminance_sensor.h"
 
 #define I2C_PIN_MAX 28
 /* I2C */
 #define GY30_ADDR 0x23 /* Address of GY30 light sensor */
+#define GY30_POWER_ON 0x01 /* Waiting for a measurement command */
 #define GY30_CONT_HIGH_RES_MODE 0x10 /* Start measurement at 11x resolution. Measurement time is approx 120mx */
+#define GY30_ONE_TIME_HIGH_RES_MODE 0x20 /* Measures once at 11x resolution, then powers down */
+#define GY30_MEASUREMENT_TIME 180000 /* us, the longest conversion of the high resolution modes */
 #define GY30_CONSTANT_NUM (1.2)
 
 static struct {
 	int opened;
 	peripheral_i2c_h sensor_h;
+	resource_illuminance_mode_e mode;
+	unsigned long long ready_time; /* us, when the current conversion completes */
+	Ecore_Timer *timer;
+	resource_read_cb cb;
+	void *data;
 } resource_sensor_s;
 
+static unsigned long long _get_timestamp(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec) / 1000;
+}
+
 void resource_close_illuminance_sensor(void)
 {
 	if (!resource_sensor_s.opened) return;
 
 	_I("Illuminance Sensor is finishing...");
+
+	if (resource_sensor_s.timer) {
+		ecore_timer_del(resource_sensor_s.timer);
+		resource_sensor_s.timer = NULL;
+	}
+
 	peripheral_i2c_close(resource_sensor_s.sensor_h);
+	resource_sensor_s.sensor_h = NULL;
 	resource_sensor_s.opened = 0;
 }
 
-int resource_read_illuminance_sensor(int i2c_bus, uint32_t *out_value)
+static int __write_command(unsigned char command)
 {
 	int ret = PERIPHERAL_ERROR_NONE;
-	unsigned char buf[10] = { 0, };
 
-	if (!resource_sensor_s.opened) {
-		ret = peripheral_i2c_open(i2c_bus, GY30_ADDR, &resource_sensor_s.sensor_h);
-		retv_if(!resource_sensor_s.sensor_h, -1);
-		resource_sensor_s.opened = 1;
+	ret = peripheral_i2c_write(resource_sensor_s.sensor_h, &command, 1);
+	retvm_if(ret < 0, -1, "Failed to write command[0x%02x]", command);
+
+	return 0;
+}
+
+/* Starts a conversion in the given mode, the continuous mode keeps converting without further commands */
+static int __set_mode(resource_illuminance_mode_e mode)
+{
+	if (mode == ILLUMINANCE_MODE_CONTINUOUS) {
+		if (resource_sensor_s.mode == ILLUMINANCE_MODE_CONTINUOUS)
+			return 0;
+
+		/* Wakes up from the power down of a one time measurement */
+		retv_if(__write_command(GY30_POWER_ON) < 0, -1);
+		retv_if(__write_command(GY30_CONT_HIGH_RES_MODE) < 0, -1);
+	} else {
+		retv_if(__write_command(GY30_ONE_TIME_HIGH_RES_MODE) < 0, -1);
 	}
 
-	buf[0] = GY30_CONT_HIGH_RES_MODE;
-	ret = peripheral_i2c_write(resource_sensor_s.sensor_h, buf, 1);
-	retv_if(ret < 0, -1);
+	resource_sensor_s.mode = mode;
+	resource_sensor_s.ready_time = _get_timestamp() + GY30_MEASUREMENT_TIME;
+
+	return 0;
+}
+
+static int __open(int i2c_bus)
+{
+	int ret = PERIPHERAL_ERROR_NONE;
+
+	if (resource_sensor_s.opened)
+		return 0;
+
+	ret = peripheral_i2c_open(i2c_bus, GY30_ADDR, &resource_sensor_s.sensor_h);
+	retv_if(!resource_sensor_s.sensor_h, -1);
+	resource_sensor_s.opened = 1;
+
+	/* Not in any mode yet, so that the continuous mode is set once here */
+	resource_sensor_s.mode = ILLUMINANCE_MODE_ONE_TIME;
+	ret = __set_mode(ILLUMINANCE_MODE_CONTINUOUS);
+	if (ret < 0) {
+		resource_close_illuminance_sensor();
+		return -1;
+	}
+
+	return 0;
+}
+
+static int __read_value(uint32_t *out_value)
+{
+	int ret = PERIPHERAL_ERROR_NONE;
+	unsigned char buf[2] = { 0, };
 
 	ret = peripheral_i2c_read(resource_sensor_s.sensor_h, buf, 2);
 	retv_if(ret < 0, -1);
 
 	*out_value = (buf[0] << 8 | buf[1]) / GY30_CONSTANT_NUM; // Just Sum High 8bit and Low 8bit
 
+	return 0;
+}
+
+int resource_read_illuminance_sensor(int i2c_bus, uint32_t *out_value)
+{
+	unsigned long long now = 0;
+	int ret = 0;
+
+	retv_if(!out_value, -1);
+	retvm_if(resource_sensor_s.timer, -1, "an asynchronous read is pending");
+
+	ret = __open(i2c_bus);
+	retv_if(ret < 0, -1);
+
+	ret = __set_mode(ILLUMINANCE_MODE_CONTINUOUS);
+	retv_if(ret < 0, -1);
+
+	/* Only right after the mode is set, later reads return the latest conversion at once */
+	now = _get_timestamp();
+	if (now < resource_sensor_s.ready_time)
+		usleep(resource_sensor_s.ready_time - now);
+
+	ret = __read_value(out_value);
+	retv_if(ret < 0, -1);
+
 	_I("Illuminance Sensor Value : %d", *out_value);
 
 	return 0;
 }
+
+static Eina_Bool __conversion_done_cb(void *data)
+{
+	resource_read_cb cb = resource_sensor_s.cb;
+	void *cb_data = resource_sensor_s.data;
+	uint32_t value = 0;
+	double result = -1;
+
+	resource_sensor_s.timer = NULL;
+
+	if (__read_value(&value) == 0)
+		result = value;
+	else
+		_E("Failed to read illuminance sensor");
+
+	if (cb)
+		cb(result, cb_data);
+
+	return ECORE_CALLBACK_CANCEL;
+}
+
+int resource_read_illuminance_sensor_async(int i2c_bus, resource_illuminance_mode_e mode,
+	resource_read_cb cb, void *data)
+{
+	unsigned long long now = 0;
+	double delay = 0.0;
+	int ret = 0;
+
+	retv_if(!cb, -1);
+	retv_if(mode != ILLUMINANCE_MODE_CONTINUOUS && mode != ILLUMINANCE_MODE_ONE_TIME, -1);
+	retvm_if(resource_sensor_s.timer, -1, "an asynchronous read is pending");
+
+	ret = __open(i2c_bus);
+	retv_if(ret < 0, -1);
+
+	ret = __set_mode(mode);
+	retv_if(ret < 0, -1);
+
+	now = _get_timestamp();
+	if (now < resource_sensor_s.ready_time)
+		delay = (resource_sensor_s.ready_time - now) / 1000000.0;
+
+	resource_sensor_s.cb = cb;
+	resource_sensor_s.data = data;
+	resource_sensor_s.timer = ecore_timer_add(delay, __conversion_done_cb, NULL);
+	retvm_if(!resource_sensor_s.timer, -1, "Failed to add illuminance timer");
+
+	return 0;
+}
@@ -27,11 +27,14 @@
 #include "log.h"
 #include "resource_internal.h"
 
+#define INFRARED_OBSTACLE_AVOIDANCE_SENSOR_DEBOUNCE_MS 10
+
 void resource_close_infrared_obstacle_avoidance_sensor(int pin_num)
 {
 	if (!resource_get_info(pin_num)->opened) return;
 
 	_I("Infrared Obstacle Avoidance Sensor is finishing...");
+	resource_unsubscribe_gpio_event(pin_num);
 	peripheral_gpio_close(resource_get_info(pin_num)->sensor_h);
 	resource_get_info(pin_num)->opened = 0;
 }
@@ -54,9 +57,15 @@ int resource_read_infrared_obstacle_avoidance_sensor(int pin_num, uint32_t *out_
 	ret = peripheral_gpio_read(resource_get_info(pin_num)->sensor_h, out_value);
 	retv_if(ret < 0, -1);
 
-	_I("Infrared Obstacle Avoidance Sensor Value : %d", *out_value);
+	_D("Infrared Obstacle Avoidance Sensor Value : %d", *out_value);
 
 	*out_value = !*out_value;
 
 	return 0;
 }
+
+int resource_subscribe_infrared_obstacle_avoidance_sensor(int pin_num, resource_gpio_event_cb cb, void *data)
+{
+	return resource_subscribe_gpio_event(pin_num, PERIPHERAL_GPIO_EDGE_BOTH, INFRARED_OBSTACLE_AVOIDANCE_SENSOR_DEBOUNCE_MS,
+			cb, data, resource_close_infrared_obstacle_avoidance_sensor);
+}
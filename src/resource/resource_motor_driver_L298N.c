@@ -17,6 +17,11 @@
  */
 
 #include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
 #include <peripheral_io.h>
 #include "log.h"
 #include "resource/resource_PCA9685.h"
@@ -28,6 +33,7 @@ typedef enum {
 	MOTOR_STATE_STOP,
 	MOTOR_STATE_FORWARD,
 	MOTOR_STATE_BACKWARD,
+	MOTOR_STATE_BRAKE, /* pins equal and enable high, the driver shorts the motor */
 } motor_state_e;
 
 typedef struct __motor_driver_s {
@@ -37,6 +43,7 @@ typedef struct __motor_driver_s {
 	motor_state_e motor_state;
 	peripheral_gpio_h pin1_h;
 	peripheral_gpio_h pin2_h;
+	int command; /* the speed last asked for, before the speed limit */
 } motor_driver_s;
 
 static motor_driver_s g_md_h[MOTOR_ID_MAX] = {
@@ -44,6 +51,54 @@ static motor_driver_s g_md_h[MOTOR_ID_MAX] = {
 };
 
 
+/*
+ * Motor commands may come from worker threads, one command is applied at a time.
+ * The safety brake takes it from a real-time thread, so a holder on the main loop or
+ * the acquisition thread inherits its priority instead of being preempted for long.
+ */
+static pthread_mutex_t motor_lock;
+
+__attribute__((constructor))
+static void __init_motor_lock(void)
+{
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setprotocol(&attr, PTHREAD_PRIO_INHERIT);
+	pthread_mutex_init(&motor_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static resource_motor_drive_config_s drive_config = {
+	.left_motors = DEFAULT_DRIVE_LEFT_MOTORS,
+	.right_motors = DEFAULT_DRIVE_RIGHT_MOTORS,
+	.track_width = DEFAULT_DRIVE_TRACK_WIDTH,
+	.max_wheel_speed = DEFAULT_DRIVE_MAX_WHEEL_SPEED,
+};
+
+static resource_motor_drive_stats_s drive_stats;
+
+/* Set by the safety brake, every command but a stop is refused until it is released */
+static bool brake_engaged = false;
+
+/* Set by the speed governor, commands going forward are scaled down to it */
+static int speed_limit = MOTOR_DRIVER_L298N_SPEED_MAX;
+
+/* Set by the hill-hold, the torque against the slope and the ramp-in of commands from rest */
+static struct {
+	int feedforward;
+	double ramp_time; /* s, 0 to apply commands at once */
+	unsigned long long ramp_start[MOTOR_ID_MAX]; /* us, 0 when not ramping */
+} hold;
+
+static unsigned long long _get_timestamp(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)(t.tv_sec)*1000000LL + t.tv_nsec/1000;
+}
+
+
 /* see Principle section in http://wiki.sunfounder.cc/index.php?title=Motor_Driver_Module-L298N */
 
 static int __motor_brake_n_stop_by_id(motor_id_e id)
@@ -216,15 +271,20 @@ ERROR:
 
 void resource_close_motor_driver_L298N(motor_id_e id)
 {
+	pthread_mutex_lock(&motor_lock);
 	__fini_motor_by_id(id);
+	pthread_mutex_unlock(&motor_lock);
 	return;
 }
 
 void resource_close_motor_driver_L298N_all(void)
 {
 	int i;
+
+	pthread_mutex_lock(&motor_lock);
 	for (i = MOTOR_ID_1; i < MOTOR_ID_MAX; i++)
 		__fini_motor_by_id(i);
+	pthread_mutex_unlock(&motor_lock);
 
 	return;
 }
@@ -232,10 +292,14 @@ void resource_close_motor_driver_L298N_all(void)
 int resource_set_motor_driver_L298N_configuration(motor_id_e id,
 	unsigned int pin1, unsigned int pin2, unsigned en_ch)
 {
+	retv_if(id >= MOTOR_ID_MAX, -1);
+
+	pthread_mutex_lock(&motor_lock);
 
 	if (g_md_h[id].motor_state > MOTOR_STATE_CONFIGURED) {
 		_E("cannot set configuration motor[%d] in this state[%d]",
 			id, g_md_h[id].motor_state);
+		pthread_mutex_unlock(&motor_lock);
 		return -1;
 	}
 
@@ -244,90 +308,419 @@ int resource_set_motor_driver_L298N_configuration(motor_id_e id,
 	g_md_h[id].en_ch = en_ch;
 	g_md_h[id].motor_state = MOTOR_STATE_CONFIGURED;
 
+	pthread_mutex_unlock(&motor_lock);
+
 	return 0;
 }
 
-int resource_set_motor_driver_L298N_speed(motor_id_e id, int speed)
+static int __write_pins(motor_id_e id, int motor_v_1, int motor_v_2)
 {
-	int ret = 0;
-	const int value_max = 4095;
-	int value = 0;
-	int e_state = MOTOR_STATE_NONE;
-	int motor_v_1 = 0;
-	int motor_v_2 = 0;
+	int ret = PERIPHERAL_ERROR_NONE;
 
-	if (g_md_h[id].motor_state <= MOTOR_STATE_CONFIGURED) {
-		ret = __init_motor_by_id(id);
-		if (ret) {
-			_E("failed to __init_motor_by_id()");
-			return -1;
-		}
+	ret = peripheral_gpio_write(g_md_h[id].pin1_h, motor_v_1);
+	if (ret != PERIPHERAL_ERROR_NONE) {
+		_E("failed to set value[%d] Motor[%d] pin 1", motor_v_1, id);
+		return -1;
 	}
 
-	value = abs(speed);
+	ret = peripheral_gpio_write(g_md_h[id].pin2_h, motor_v_2);
+	if (ret != PERIPHERAL_ERROR_NONE) {
+		_E("failed to set value[%d] Motor[%d] pin 2", motor_v_2, id);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int __ramp_command(motor_id_e id, int previous, int speed, unsigned long long now)
+{
+	double progress = 0.0;
 
-	if (value > value_max) {
-		value = value_max;
-		_D("max speed is %d", value_max);
+	if (hold.ramp_time <= 0.0 || speed == 0) {
+		hold.ramp_start[id] = 0;
+		return speed;
 	}
-	_D("set speed %d", value);
 
-	if (speed == 0) {
-		/* brake and stop */
-		ret = __motor_brake_n_stop_by_id(id);
-		if (ret) {
-			_E("failed to stop motor[%d]", id);
-			return -1;
-		}
-		return 0; /* done */
+	if (previous == 0)
+		hold.ramp_start[id] = now;
+	else if (!hold.ramp_start[id])
+		return speed;
+
+	progress = (now - hold.ramp_start[id]) / (hold.ramp_time * 1000000.0);
+	if (progress >= 1.0) {
+		hold.ramp_start[id] = 0;
+		return speed;
 	}
 
-	if (speed > 0)
-		e_state = MOTOR_STATE_FORWARD; /* will be set forward */
-	else
-		e_state = MOTOR_STATE_BACKWARD; /* will be set backward */
+	return (int)(speed * progress);
+}
 
-	if (g_md_h[id].motor_state == e_state)
-		goto SET_SPEED;
-	else {
-		/* brake and stop */
-		ret = __motor_brake_n_stop_by_id(id);
-		if (ret) {
-			_E("failed to stop motor[%d]", id);
+/*
+ * Disables the motors which change direction in one PCA9685 transaction,
+ * sets their direction pins, then sets all the enable channels in one transaction,
+ * so that the motors change speed together. Pins are only written when the direction changes.
+ */
+static int __apply_speeds(const int *speeds, unsigned int motor_mask)
+{
+	resource_pca9685_value_s values[MOTOR_ID_MAX];
+	resource_pca9685_value_s stops[MOTOR_ID_MAX];
+	motor_state_e e_state[MOTOR_ID_MAX];
+	unsigned long long now = _get_timestamp();
+	unsigned int stop_count = 0;
+	unsigned int count = 0;
+	int previous = 0;
+	int speed = 0;
+	int value = 0;
+	int peak = 0;
+	int ret = 0;
+	int id = 0;
+
+	for (id = MOTOR_ID_1; id < MOTOR_ID_MAX; id++) {
+		if (!(motor_mask & (1U << id)))
+			continue;
+
+		if (brake_engaged && speeds[id] != 0) {
+			_E("brake is engaged, motor[%d] can't be started", id);
 			return -1;
 		}
+
+		/* The limit comes from the obstacles ahead, backing away is never limited */
+		if (speeds[id] > peak)
+			peak = speeds[id];
 	}
 
-	switch (e_state) {
-	case MOTOR_STATE_FORWARD:
-		motor_v_1 = 1;
-		motor_v_2 = 0;
-		break;
-	case MOTOR_STATE_BACKWARD:
-		motor_v_1 = 0;
-		motor_v_2 = 1;
-		break;
+	if (peak > MOTOR_DRIVER_L298N_SPEED_MAX)
+		peak = MOTOR_DRIVER_L298N_SPEED_MAX;
+
+	for (id = MOTOR_ID_1; id < MOTOR_ID_MAX; id++) {
+		if (!(motor_mask & (1U << id)))
+			continue;
+
+		if (g_md_h[id].motor_state <= MOTOR_STATE_CONFIGURED) {
+			ret = __init_motor_by_id(id);
+			if (ret) {
+				_E("failed to __init_motor_by_id()");
+				return -1;
+			}
+		}
+
+		previous = g_md_h[id].command;
+		g_md_h[id].command = speeds[id];
+
+		speed = speeds[id];
+		if (speed > MOTOR_DRIVER_L298N_SPEED_MAX) {
+			speed = MOTOR_DRIVER_L298N_SPEED_MAX;
+			_D("max speed is %d", MOTOR_DRIVER_L298N_SPEED_MAX);
+		} else if (speed < -MOTOR_DRIVER_L298N_SPEED_MAX) {
+			speed = -MOTOR_DRIVER_L298N_SPEED_MAX;
+			_D("max speed is %d", MOTOR_DRIVER_L298N_SPEED_MAX);
+		}
+
+		/* Every motor of the command is scaled by the same factor, a turn stays the same turn */
+		if (peak > speed_limit)
+			speed = (int)((long long)speed * speed_limit / peak);
+
+		/*
+		 * While braked or stopped by the governor, a stopped motor is held by the brake of the driver.
+		 * The hold is open-loop, it must not push a stroller nobody is holding.
+		 */
+		if (speed == 0 && (brake_engaged || speed_limit == 0)) {
+			hold.ramp_start[id] = 0;
+			e_state[id] = MOTOR_STATE_BRAKE;
+			values[count].channel = g_md_h[id].en_ch;
+			values[count].on = 0;
+			values[count].off = MOTOR_DRIVER_L298N_SPEED_MAX;
+			count++;
+			continue;
+		}
+
+		/* The hold torque stays on the motor while a command from rest is ramped in over it */
+		speed = __ramp_command(id, previous, speed, now) + hold.feedforward;
+		if (speed > MOTOR_DRIVER_L298N_SPEED_MAX)
+			speed = MOTOR_DRIVER_L298N_SPEED_MAX;
+		else if (speed < -MOTOR_DRIVER_L298N_SPEED_MAX)
+			speed = -MOTOR_DRIVER_L298N_SPEED_MAX;
+
+		value = abs(speed);
+
+		if (speed == 0)
+			e_state[id] = MOTOR_STATE_STOP;
+		else if (speed > 0)
+			e_state[id] = MOTOR_STATE_FORWARD;
+		else
+			e_state[id] = MOTOR_STATE_BACKWARD;
+
+		values[count].channel = g_md_h[id].en_ch;
+		values[count].on = 0;
+		values[count].off = value;
+		count++;
 	}
-	ret = peripheral_gpio_write(g_md_h[id].pin1_h, motor_v_1);
-	if (ret != PERIPHERAL_ERROR_NONE) {
-		_E("failed to set value[%d] Motor[%d] pin 1", motor_v_1, id);
-		return -1;
+
+	/* Enabled motors leaving their state are disabled first, pins never change under a duty */
+	for (id = MOTOR_ID_1; id < MOTOR_ID_MAX; id++) {
+		if (!(motor_mask & (1U << id)) || g_md_h[id].motor_state == e_state[id])
+			continue;
+
+		if (g_md_h[id].motor_state <= MOTOR_STATE_STOP)
+			continue;
+
+		stops[stop_count].channel = g_md_h[id].en_ch;
+		stops[stop_count].on = 0;
+		stops[stop_count].off = 0;
+		stop_count++;
 	}
 
-	ret = peripheral_gpio_write(g_md_h[id].pin2_h, motor_v_2);
-	if (ret != PERIPHERAL_ERROR_NONE) {
-		_E("failed to set value[%d] Motor[%d] pin 2", motor_v_2, id);
-		return -1;
+	if (stop_count) {
+		ret = resource_pca9685_set_values(stops, stop_count);
+		retvm_if(ret, -1, "failed to stop motors[0x%x] before changing direction", motor_mask);
 	}
 
-SET_SPEED:
-	ret = resource_pca9685_set_value_to_channel(g_md_h[id].en_ch, 0, value);
-	if (ret) {
-		_E("failed to set speed - %d", speed);
-		return -1;
+	for (id = MOTOR_ID_1; id < MOTOR_ID_MAX; id++) {
+		if (!(motor_mask & (1U << id)) || g_md_h[id].motor_state == e_state[id])
+			continue;
+
+		/* brake first, see Principle section of the L298N */
+		if (g_md_h[id].motor_state == MOTOR_STATE_FORWARD)
+			ret = __write_pins(id, 0, 0);
+		else if (g_md_h[id].motor_state == MOTOR_STATE_BACKWARD)
+			ret = __write_pins(id, 1, 1);
+		retv_if(ret, -1);
+		g_md_h[id].motor_state = MOTOR_STATE_STOP;
+
+		if (e_state[id] == MOTOR_STATE_FORWARD)
+			ret = __write_pins(id, 1, 0);
+		else if (e_state[id] == MOTOR_STATE_BACKWARD)
+			ret = __write_pins(id, 0, 1);
+		else if (e_state[id] == MOTOR_STATE_BRAKE)
+			ret = __write_pins(id, 0, 0);
+		retv_if(ret, -1);
+		g_md_h[id].motor_state = e_state[id];
 	}
 
-	g_md_h[id].motor_state = e_state;
+	ret = resource_pca9685_set_values(values, count);
+	retvm_if(ret, -1, "failed to set speed of motors[0x%x]", motor_mask);
 
 	return 0;
 }
+
+int resource_set_motor_driver_L298N_speed(motor_id_e id, int speed)
+{
+	int speeds[MOTOR_ID_MAX] = {0, };
+	int ret = 0;
+
+	retv_if(id >= MOTOR_ID_MAX, -1);
+
+	_D("set speed %d", speed);
+
+	speeds[id] = speed;
+
+	pthread_mutex_lock(&motor_lock);
+	ret = __apply_speeds(speeds, 1U << id);
+	pthread_mutex_unlock(&motor_lock);
+
+	return ret;
+}
+
+int resource_set_motor_driver_L298N_drive_config(const resource_motor_drive_config_s *config)
+{
+	retv_if(config == NULL, -1);
+	retv_if((config->left_motors | config->right_motors) >> MOTOR_ID_MAX, -1);
+	retv_if(config->left_motors & config->right_motors, -1);
+	retv_if(config->track_width <= 0.0 || config->max_wheel_speed <= 0.0, -1);
+
+	pthread_mutex_lock(&motor_lock);
+	drive_config = *config;
+	pthread_mutex_unlock(&motor_lock);
+
+	return 0;
+}
+
+int resource_set_motor_driver_L298N_drive(double linear, double angular)
+{
+	int speeds[MOTOR_ID_MAX] = {0, };
+	unsigned long long start = _get_timestamp();
+	unsigned long long latency = 0;
+	double v_left = 0.0;
+	double v_right = 0.0;
+	double peak = 0.0;
+	int left = 0;
+	int right = 0;
+	int ret = 0;
+	int id = 0;
+
+	pthread_mutex_lock(&motor_lock);
+
+	v_left = linear - angular * drive_config.track_width / 2.0;
+	v_right = linear + angular * drive_config.track_width / 2.0;
+
+	/* Scale both wheels down together to keep the turning radius */
+	peak = fmax(fabs(v_left), fabs(v_right));
+	if (peak > drive_config.max_wheel_speed) {
+		v_left *= drive_config.max_wheel_speed / peak;
+		v_right *= drive_config.max_wheel_speed / peak;
+	}
+
+	left = (int)lround(v_left / drive_config.max_wheel_speed * MOTOR_DRIVER_L298N_SPEED_MAX);
+	right = (int)lround(v_right / drive_config.max_wheel_speed * MOTOR_DRIVER_L298N_SPEED_MAX);
+
+	for (id = MOTOR_ID_1; id < MOTOR_ID_MAX; id++) {
+		if (drive_config.left_motors & (1U << id))
+			speeds[id] = left;
+		else if (drive_config.right_motors & (1U << id))
+			speeds[id] = right;
+	}
+
+	ret = __apply_speeds(speeds, drive_config.left_motors | drive_config.right_motors);
+
+	latency = _get_timestamp() - start;
+	drive_stats.commands++;
+	if (ret)
+		drive_stats.failures++;
+	drive_stats.last_latency = latency;
+	drive_stats.total_latency += latency;
+	if (latency > drive_stats.max_latency)
+		drive_stats.max_latency = latency;
+
+	pthread_mutex_unlock(&motor_lock);
+
+	_D("drive - v[%.3f], w[%.3f] -> left[%d], right[%d], %llu us", linear, angular, left, right, latency);
+
+	return ret;
+}
+
+/*
+ * Every open motor goes through __apply_speeds() with a stop command, which
+ * leaves it in MOTOR_STATE_BRAKE until the brake is released and a new command comes.
+ */
+int resource_brake_motor_driver_L298N_all(void)
+{
+	int speeds[MOTOR_ID_MAX] = {0, };
+	unsigned int running = 0;
+	int ret = 0;
+	int id = 0;
+
+	pthread_mutex_lock(&motor_lock);
+
+	brake_engaged = true;
+
+	for (id = MOTOR_ID_1; id < MOTOR_ID_MAX; id++) {
+		if (g_md_h[id].motor_state > MOTOR_STATE_CONFIGURED)
+			running |= 1U << id;
+	}
+
+	if (running)
+		ret = __apply_speeds(speeds, running);
+
+	pthread_mutex_unlock(&motor_lock);
+
+	return ret;
+}
+
+/* Applies the last commands of the open motors again, after the limit or the hold has changed */
+static int __reapply_commands(void)
+{
+	int commands[MOTOR_ID_MAX] = {0, };
+	unsigned int running = 0;
+	int id = 0;
+
+	for (id = MOTOR_ID_1; id < MOTOR_ID_MAX; id++) {
+		if (g_md_h[id].motor_state <= MOTOR_STATE_CONFIGURED)
+			continue;
+
+		commands[id] = g_md_h[id].command;
+		running |= 1U << id;
+	}
+
+	if (!running)
+		return 0;
+
+	return __apply_speeds(commands, running);
+}
+
+void resource_release_motor_driver_L298N_brake(void)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&motor_lock);
+
+	brake_engaged = false;
+
+	/* The braked motors leave the brake of the driver and get the hold torque back, still stopped */
+	ret = __reapply_commands();
+	if (ret < 0)
+		_E("failed to reapply commands after releasing the brake");
+
+	pthread_mutex_unlock(&motor_lock);
+}
+
+int resource_set_motor_driver_L298N_speed_limit(int limit)
+{
+	int ret = 0;
+
+	retv_if(limit < 0, -1);
+
+	if (limit > MOTOR_DRIVER_L298N_SPEED_MAX)
+		limit = MOTOR_DRIVER_L298N_SPEED_MAX;
+
+	pthread_mutex_lock(&motor_lock);
+
+	if (limit == speed_limit) {
+		pthread_mutex_unlock(&motor_lock);
+		return 0;
+	}
+	speed_limit = limit;
+
+	/* Moving motors follow the new limit right away, and get their speed back when it rises */
+	ret = __reapply_commands();
+
+	pthread_mutex_unlock(&motor_lock);
+
+	return ret;
+}
+
+int resource_set_motor_driver_L298N_hold(int feedforward, double ramp_time)
+{
+	bool ramping = false;
+	int ret = 0;
+	int id = 0;
+
+	retv_if(ramp_time < 0.0, -1);
+
+	if (feedforward > MOTOR_DRIVER_L298N_SPEED_MAX)
+		feedforward = MOTOR_DRIVER_L298N_SPEED_MAX;
+	else if (feedforward < -MOTOR_DRIVER_L298N_SPEED_MAX)
+		feedforward = -MOTOR_DRIVER_L298N_SPEED_MAX;
+
+	pthread_mutex_lock(&motor_lock);
+
+	for (id = MOTOR_ID_1; id < MOTOR_ID_MAX; id++) {
+		if (hold.ramp_start[id])
+			ramping = true;
+	}
+
+	/* Called at the IMU rate, which is also what moves a ramp forward */
+	if (!ramping && feedforward == hold.feedforward && ramp_time == hold.ramp_time) {
+		pthread_mutex_unlock(&motor_lock);
+		return 0;
+	}
+
+	hold.feedforward = feedforward;
+	hold.ramp_time = ramp_time;
+	if (ramp_time == 0.0)
+		memset(hold.ramp_start, 0, sizeof(hold.ramp_start));
+
+	ret = __reapply_commands();
+
+	pthread_mutex_unlock(&motor_lock);
+
+	return ret;
+}
+
+void resource_get_motor_driver_L298N_drive_stats(resource_motor_drive_stats_s *out)
+{
+	ret_if(out == NULL);
+
+	pthread_mutex_lock(&motor_lock);
+	*out = drive_stats;
+	pthread_mutex_unlock(&motor_lock);
+}
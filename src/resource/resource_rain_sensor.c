@@ -25,11 +25,14 @@
 #include "log.h"
 #include "resource_internal.h"
 
+#define RAIN_SENSOR_DEBOUNCE_MS 50
+
 void resource_close_rain_sensor(int pin_num)
 {
 	if (!resource_get_info(pin_num)->opened) return;
 
 	_I("Rain Sensor is finishing...");
+	resource_unsubscribe_gpio_event(pin_num);
 	peripheral_gpio_close(resource_get_info(pin_num)->sensor_h);
 	resource_get_info(pin_num)->opened = 0;
 }
@@ -59,3 +62,9 @@ int resource_read_rain_sensor(int pin_num, uint32_t *out_value)
 
 	return 0;
 }
+
+int resource_subscribe_rain_sensor(int pin_num, resource_gpio_event_cb cb, void *data)
+{
+	return resource_subscribe_gpio_event(pin_num, PERIPHERAL_GPIO_EDGE_BOTH, RAIN_SENSOR_DEBOUNCE_MS,
+			cb, data, resource_close_rain_sensor);
+}
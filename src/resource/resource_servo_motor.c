@@ -16,13 +16,315 @@
  * limitations under the License.
  */
 
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/timerfd.h>
+
 #include "log.h"
 #include "resource/resource_PCA9685.h"
+#include "resource/resource_servo_motor.h"
 
 #define SERVO_MOTOR_MAX PCA9685_CH_MAX
 
+/* Setpoints are streamed at the PWM frequency, the servo can't see anything faster */
+#define SERVO_PROFILE_RATE 60
+#define SERVO_PROFILE_THREAD_PRIORITY 40
+
+typedef struct {
+	int moving;
+	int position_known;
+	double position; /* last setpoint written */
+	double start;
+	double distance; /* signed */
+	double peak_velocity;
+	double ramp_time;
+	double cruise_time;
+	int target;
+	resource_servo_profile_e type;
+	unsigned long long start_time; /* ns */
+	int pending; /* a target that waits for the servo to come to rest */
+	int pending_target;
+	resource_servo_profile_s pending_profile;
+} servo_profile_s;
+
 static int servo_motor_index[SERVO_MOTOR_MAX + 1] = {0, };
 
+/*
+ * The lock covers the profiles and is held across the PCA9685 update of a tick,
+ * so that a channel can't be closed between planning and writing it.
+ * The start lock covers the thread, it is taken before the lock and never by the thread itself,
+ * so that the thread can be joined while holding it.
+ */
+static struct {
+	pthread_mutex_t lock;
+	pthread_mutex_t start_lock;
+	int running;
+	int stop_requested;
+	int failed; /* the thread has exited on its own and needs to be joined */
+	int timer_fd;
+	pthread_t thread;
+	servo_profile_s ch[SERVO_MOTOR_MAX + 1];
+} profiler = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.start_lock = PTHREAD_MUTEX_INITIALIZER,
+	.timer_fd = -1,
+};
+
+static unsigned long long _get_timestamp_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+/* Distance covered while accelerating from 0 to the peak velocity, t in [0, ramp_time] */
+static double __ramp_distance(const servo_profile_s *p, double t)
+{
+	if (p->type == SERVO_PROFILE_S_CURVE)
+		return p->peak_velocity / 2.0 * (t - p->ramp_time / M_PI * sin(M_PI * t / p->ramp_time));
+
+	return p->peak_velocity / p->ramp_time * t * t / 2.0;
+}
+
+static double __profile_duration(const servo_profile_s *p)
+{
+	return 2.0 * p->ramp_time + p->cruise_time;
+}
+
+static double __profile_position(const servo_profile_s *p, double t)
+{
+	double total = __profile_duration(p);
+	double s = 0.0;
+
+	if (t >= total)
+		s = fabs(p->distance);
+	else if (t < p->ramp_time)
+		s = __ramp_distance(p, t);
+	else if (t < p->ramp_time + p->cruise_time)
+		s = __ramp_distance(p, p->ramp_time) + p->peak_velocity * (t - p->ramp_time);
+	else
+		s = fabs(p->distance) - __ramp_distance(p, total - t);
+
+	return p->start + copysign(s, p->distance);
+}
+
+/*
+ * Trapezoidal : constant acceleration, ramp distance v^2 / 2a.
+ * S-curve : raised-cosine velocity ramp, the acceleration peaks at a in the
+ * middle of the ramp and is zero at both ends, ramp distance pi v^2 / 4a.
+ * A move too short to reach max_velocity peaks lower instead.
+ * Every move starts and ends at rest.
+ */
+static void __plan_profile(servo_profile_s *p, int target, const resource_servo_profile_s *profile)
+{
+	double v = profile->max_velocity;
+	double a = profile->acceleration;
+	double ramp_k = (profile->type == SERVO_PROFILE_S_CURVE) ? M_PI / (4.0 * a) : 1.0 / (2.0 * a);
+	double d = 0.0;
+
+	p->type = profile->type;
+	p->start = p->position;
+	p->distance = target - p->position;
+	p->target = target;
+
+	d = fabs(p->distance);
+	if (2.0 * ramp_k * v * v > d)
+		v = sqrt(d / (2.0 * ramp_k));
+
+	p->peak_velocity = v;
+	p->ramp_time = 2.0 * ramp_k * v;
+	p->cruise_time = (d - 2.0 * ramp_k * v * v) / v;
+	if (p->cruise_time < 0.0)
+		p->cruise_time = 0.0;
+
+	p->start_time = _get_timestamp_ns();
+	p->moving = 1;
+}
+
+/* Called with the lock held, the timer only ticks while a servo is moving */
+static int __arm_profile_timer(int arm)
+{
+	struct itimerspec period;
+
+	memset(&period, 0, sizeof(period));
+	if (arm) {
+		period.it_interval.tv_nsec = 1000000000L / SERVO_PROFILE_RATE;
+		period.it_value = period.it_interval;
+	}
+
+	retvm_if(timerfd_settime(profiler.timer_fd, 0, &period, NULL) < 0, -1,
+		"Failed to %s servo profile timer[%s]", arm ? "arm" : "disarm", strerror(errno));
+
+	return 0;
+}
+
+static void __profile_tick(void)
+{
+	resource_pca9685_value_s values[SERVO_MOTOR_MAX + 1];
+	unsigned long long now = _get_timestamp_ns();
+	unsigned int count = 0;
+	servo_profile_s *p = NULL;
+	double t = 0.0;
+	int moving = 0;
+	int i = 0;
+
+	pthread_mutex_lock(&profiler.lock);
+
+	for (i = 0; i <= SERVO_MOTOR_MAX; i++) {
+		p = &profiler.ch[i];
+		if (!p->moving)
+			continue;
+
+		t = (now - p->start_time) / 1000000000.0;
+		if (t >= __profile_duration(p)) {
+			p->position = p->target;
+			p->moving = 0;
+			if (p->pending) {
+				/* At rest now, so the queued move starts without a jump in velocity */
+				p->pending = 0;
+				if (lround(p->position) != p->pending_target) {
+					__plan_profile(p, p->pending_target, &p->pending_profile);
+					moving = 1;
+				}
+			}
+		} else {
+			p->position = __profile_position(p, t);
+			moving = 1;
+		}
+
+		values[count].channel = i;
+		values[count].on = 0;
+		values[count].off = (int)lround(p->position);
+		count++;
+	}
+
+	/* Every servo moves in the same I2C frame, unchanged channels are dropped by the driver */
+	if (count)
+		resource_pca9685_set_values(values, count);
+
+	/* Every servo has settled, sleep until the next move */
+	if (!moving)
+		__arm_profile_timer(0);
+
+	pthread_mutex_unlock(&profiler.lock);
+}
+
+static void *__profile_thread(void *data)
+{
+	uint64_t expirations = 0;
+	ssize_t len = 0;
+	int i = 0;
+
+	_I("Servo profile thread is running...");
+
+	while (!__atomic_load_n(&profiler.stop_requested, __ATOMIC_ACQUIRE)) {
+		/* Positions are computed from the clock, so missed expirations need no catch-up */
+		len = read(profiler.timer_fd, &expirations, sizeof(expirations));
+		if (len != sizeof(expirations)) {
+			if (len < 0 && errno == EINTR)
+				continue;
+			_E("Failed to read servo profile timer[%s]", strerror(errno));
+			break;
+		}
+
+		__profile_tick();
+	}
+
+	if (!__atomic_load_n(&profiler.stop_requested, __ATOMIC_ACQUIRE)) {
+		/* Nothing moves the servos anymore, the next move restarts the thread */
+		pthread_mutex_lock(&profiler.lock);
+		for (i = 0; i <= SERVO_MOTOR_MAX; i++) {
+			profiler.ch[i].moving = 0;
+			profiler.ch[i].pending = 0;
+		}
+		pthread_mutex_unlock(&profiler.lock);
+
+		__atomic_store_n(&profiler.failed, 1, __ATOMIC_RELEASE);
+	}
+
+	_I("Servo profile thread is finishing...");
+
+	return NULL;
+}
+
+static void __join_profile_thread(void)
+{
+	pthread_join(profiler.thread, NULL);
+	profiler.running = 0;
+
+	close(profiler.timer_fd);
+	profiler.timer_fd = -1;
+}
+
+/* Called with the start lock held, but not the lock, the failed thread takes it on its way out */
+static int __start_profile_thread(void)
+{
+	struct sched_param param;
+	int ret = 0;
+
+	if (profiler.running && __atomic_load_n(&profiler.failed, __ATOMIC_ACQUIRE)) {
+		_W("Servo profile thread has failed, restarting it");
+		__join_profile_thread();
+	}
+
+	if (profiler.running)
+		return 0;
+
+	/* Created disarmed, a move arms it */
+	profiler.timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+	retvm_if(profiler.timer_fd < 0, -1, "Failed to create servo profile timer[%s]", strerror(errno));
+
+	profiler.stop_requested = 0;
+	profiler.failed = 0;
+
+	ret = pthread_create(&profiler.thread, NULL, __profile_thread, NULL);
+	if (ret != 0) {
+		_E("Failed to create servo profile thread[%d]", ret);
+		goto ERROR;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = SERVO_PROFILE_THREAD_PRIORITY;
+	ret = pthread_setschedparam(profiler.thread, SCHED_FIFO, &param);
+	if (ret != 0)
+		_W("Servo profile thread runs without real-time priority[%d]", ret);
+
+	profiler.running = 1;
+
+	return 0;
+
+ERROR:
+	close(profiler.timer_fd);
+	profiler.timer_fd = -1;
+	return -1;
+}
+
+static void __stop_profile_thread(void)
+{
+	pthread_mutex_lock(&profiler.start_lock);
+
+	if (!profiler.running) {
+		pthread_mutex_unlock(&profiler.start_lock);
+		return;
+	}
+
+	/* The timer may be disarmed, expire it once so that the thread notices */
+	__atomic_store_n(&profiler.stop_requested, 1, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&profiler.lock);
+	__arm_profile_timer(1);
+	pthread_mutex_unlock(&profiler.lock);
+
+	__join_profile_thread();
+
+	pthread_mutex_unlock(&profiler.start_lock);
+}
+
 static int resource_servo_motor_init(unsigned int ch)
 {
 	int ret = 0;
@@ -38,10 +340,17 @@ static int resource_servo_motor_init(unsigned int ch)
 
 void resource_close_servo_motor(unsigned int ch)
 {
+	if (ch > SERVO_MOTOR_MAX)
+		return;
+
+	pthread_mutex_lock(&profiler.lock);
+	memset(&profiler.ch[ch], 0, sizeof(servo_profile_s));
+
 	if (servo_motor_index[ch] == 1) {
 		resource_pca9685_fini(ch);
 		servo_motor_index[ch] = 0;
 	}
+	pthread_mutex_unlock(&profiler.lock);
 
 	return;
 }
@@ -50,6 +359,8 @@ void resource_close_servo_motor_all(void)
 {
 	unsigned int i;
 
+	__stop_profile_thread();
+
 	for (i = 0 ; i <= SERVO_MOTOR_MAX; i++)
 		resource_close_servo_motor(i);
 
@@ -58,6 +369,7 @@ void resource_close_servo_motor_all(void)
 
 int resource_set_servo_motor_value(unsigned int motor_id, int value)
 {
+	servo_profile_s *p = NULL;
 	int ret = 0;
 
 	if (motor_id > SERVO_MOTOR_MAX)
@@ -69,7 +381,90 @@ int resource_set_servo_motor_value(unsigned int motor_id, int value)
 			return -1;
 	}
 
+	pthread_mutex_lock(&profiler.lock);
+
 	ret = resource_pca9685_set_value_to_channel(motor_id, 0, value);
+	if (!ret) {
+		/* A direct value cancels a move in progress */
+		p = &profiler.ch[motor_id];
+		p->moving = 0;
+		p->pending = 0;
+		p->position = value;
+		p->position_known = 1;
+	}
+
+	pthread_mutex_unlock(&profiler.lock);
 
 	return ret;
 }
+
+int resource_move_servo_motor(unsigned int motor_id, int target, const resource_servo_profile_s *profile)
+{
+	servo_profile_s *p = NULL;
+	int ret = 0;
+
+	retv_if(motor_id > SERVO_MOTOR_MAX, -1);
+	retv_if(profile == NULL, -1);
+	retv_if(profile->type != SERVO_PROFILE_TRAPEZOIDAL && profile->type != SERVO_PROFILE_S_CURVE, -1);
+	retvm_if(profile->max_velocity <= 0.0 || profile->acceleration <= 0.0, -1,
+		"Invalid profile - velocity[%f], acceleration[%f]", profile->max_velocity, profile->acceleration);
+
+	if (servo_motor_index[motor_id] == 0) {
+		ret = resource_servo_motor_init(motor_id);
+		retv_if(ret, -1);
+	}
+
+	pthread_mutex_lock(&profiler.start_lock);
+
+	ret = __start_profile_thread();
+	if (ret < 0) {
+		pthread_mutex_unlock(&profiler.start_lock);
+		return -1;
+	}
+
+	pthread_mutex_lock(&profiler.lock);
+
+	/* Where the servo is isn't known until we've driven it once */
+	if (!profiler.ch[motor_id].position_known) {
+		pthread_mutex_unlock(&profiler.lock);
+		pthread_mutex_unlock(&profiler.start_lock);
+		_W("Position of servo[%u] is unknown, setting it directly", motor_id);
+		return resource_set_servo_motor_value(motor_id, target);
+	}
+
+	/*
+	 * A move is planned from rest, so a servo in motion finishes its move first
+	 * instead of stopping dead, the latest target waits for it.
+	 */
+	p = &profiler.ch[motor_id];
+	if (p->moving) {
+		p->pending = 1;
+		p->pending_target = target;
+		p->pending_profile = *profile;
+	} else if (lround(p->position) == target) {
+		p->moving = 0;
+	} else {
+		__plan_profile(p, target, profile);
+		__arm_profile_timer(1);
+	}
+
+	pthread_mutex_unlock(&profiler.lock);
+	pthread_mutex_unlock(&profiler.start_lock);
+
+	_D("servo[%u] moves to %d", motor_id, target);
+
+	return 0;
+}
+
+int resource_is_servo_motor_moving(unsigned int motor_id)
+{
+	int moving = 0;
+
+	retv_if(motor_id > SERVO_MOTOR_MAX, -1);
+
+	pthread_mutex_lock(&profiler.lock);
+	moving = profiler.ch[motor_id].moving;
+	pthread_mutex_unlock(&profiler.lock);
+
+	return moving;
+}
@@ -0,0 +1,352 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SOUND_LEVEL_X86 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SOUND_LEVEL_NEON 1
+#endif
+
+#include "log.h"
+#include "resource/resource_sound_level_dsp.h"
+
+#define SOUND_LEVEL_FULL_SCALE_RMS 362.038672 /* a sine of 512 counts amplitude around the mid scale */
+
+/* Everything the level is computed from, gathered in a single pass */
+typedef struct _sound_level_acc_s {
+	unsigned long long sum;
+	unsigned long long sum_sq;
+	unsigned int min;
+	unsigned int max;
+} sound_level_acc_s;
+
+typedef void (*sound_level_kernel_fn)(const unsigned short *x, unsigned int n, sound_level_acc_s *acc);
+
+static const char *kernel_name[SOUND_LEVEL_KERNEL_MAX] = {
+	"auto", "scalar", "sse2", "avx2", "neon",
+};
+
+static void __accumulate_scalar(const unsigned short *x, unsigned int n, sound_level_acc_s *acc)
+{
+	unsigned int i = 0;
+
+	for (i = 0; i < n; i++) {
+		unsigned int v = x[i];
+
+		acc->sum += v;
+		acc->sum_sq += v * v;
+		if (v < acc->min)
+			acc->min = v;
+		if (v > acc->max)
+			acc->max = v;
+	}
+}
+
+#ifdef SOUND_LEVEL_X86
+/* Samples are below 32768, so the signed 16-bit instructions are exact */
+__attribute__((target("sse2")))
+static void __accumulate_sse2(const unsigned short *x, unsigned int n, sound_level_acc_s *acc)
+{
+	__m128i vmin = _mm_set1_epi16(0x7fff);
+	__m128i vmax = _mm_setzero_si128();
+	__m128i vsum = _mm_setzero_si128();
+	__m128i vsq = _mm_setzero_si128();
+	__m128i zero = _mm_setzero_si128();
+	__m128i ones = _mm_set1_epi16(1);
+	unsigned short min[8];
+	unsigned short max[8];
+	unsigned int sum[4];
+	unsigned long long sq[2];
+	unsigned int i = 0;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(x + i));
+		__m128i s = _mm_madd_epi16(v, v);
+
+		vmin = _mm_min_epi16(vmin, v);
+		vmax = _mm_max_epi16(vmax, v);
+		vsum = _mm_add_epi32(vsum, _mm_madd_epi16(v, ones));
+		vsq = _mm_add_epi64(vsq, _mm_unpacklo_epi32(s, zero));
+		vsq = _mm_add_epi64(vsq, _mm_unpackhi_epi32(s, zero));
+	}
+
+	_mm_storeu_si128((__m128i *)min, vmin);
+	_mm_storeu_si128((__m128i *)max, vmax);
+	_mm_storeu_si128((__m128i *)sum, vsum);
+	_mm_storeu_si128((__m128i *)sq, vsq);
+
+	if (i) {
+		int k = 0;
+
+		for (k = 0; k < 8; k++) {
+			if (min[k] < acc->min)
+				acc->min = min[k];
+			if (max[k] > acc->max)
+				acc->max = max[k];
+		}
+		acc->sum += (unsigned long long)sum[0] + sum[1] + sum[2] + sum[3];
+		acc->sum_sq += sq[0] + sq[1];
+	}
+
+	__accumulate_scalar(x + i, n - i, acc);
+}
+
+__attribute__((target("avx2")))
+static void __accumulate_avx2(const unsigned short *x, unsigned int n, sound_level_acc_s *acc)
+{
+	__m256i vmin = _mm256_set1_epi16(0x7fff);
+	__m256i vmax = _mm256_setzero_si256();
+	__m256i vsum = _mm256_setzero_si256();
+	__m256i vsq = _mm256_setzero_si256();
+	__m256i zero = _mm256_setzero_si256();
+	__m256i ones = _mm256_set1_epi16(1);
+	unsigned short min[16];
+	unsigned short max[16];
+	unsigned int sum[8];
+	unsigned long long sq[4];
+	unsigned int i = 0;
+
+	for (i = 0; i + 16 <= n; i += 16) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(x + i));
+		__m256i s = _mm256_madd_epi16(v, v);
+
+		vmin = _mm256_min_epi16(vmin, v);
+		vmax = _mm256_max_epi16(vmax, v);
+		vsum = _mm256_add_epi32(vsum, _mm256_madd_epi16(v, ones));
+		vsq = _mm256_add_epi64(vsq, _mm256_unpacklo_epi32(s, zero));
+		vsq = _mm256_add_epi64(vsq, _mm256_unpackhi_epi32(s, zero));
+	}
+
+	_mm256_storeu_si256((__m256i *)min, vmin);
+	_mm256_storeu_si256((__m256i *)max, vmax);
+	_mm256_storeu_si256((__m256i *)sum, vsum);
+	_mm256_storeu_si256((__m256i *)sq, vsq);
+
+	if (i) {
+		int k = 0;
+
+		for (k = 0; k < 16; k++) {
+			if (min[k] < acc->min)
+				acc->min = min[k];
+			if (max[k] > acc->max)
+				acc->max = max[k];
+		}
+		for (k = 0; k < 8; k++)
+			acc->sum += sum[k];
+		acc->sum_sq += sq[0] + sq[1] + sq[2] + sq[3];
+	}
+
+	__accumulate_scalar(x + i, n - i, acc);
+}
+#endif /* SOUND_LEVEL_X86 */
+
+#ifdef SOUND_LEVEL_NEON
+static void __accumulate_neon(const unsigned short *x, unsigned int n, sound_level_acc_s *acc)
+{
+	uint16x8_t vmin = vdupq_n_u16(0xffff);
+	uint16x8_t vmax = vdupq_n_u16(0);
+	uint32x4_t vsum = vdupq_n_u32(0);
+	uint64x2_t vsq = vdupq_n_u64(0);
+	unsigned short min[8];
+	unsigned short max[8];
+	unsigned int sum[4];
+	unsigned long long sq[2];
+	unsigned int i = 0;
+
+	for (i = 0; i + 8 <= n; i += 8) {
+		uint16x8_t v = vld1q_u16(x + i);
+		uint32x4_t s = vmull_u16(vget_low_u16(v), vget_low_u16(v));
+
+		s = vmlal_u16(s, vget_high_u16(v), vget_high_u16(v));
+		vmin = vminq_u16(vmin, v);
+		vmax = vmaxq_u16(vmax, v);
+		vsum = vpadalq_u16(vsum, v);
+		vsq = vpadalq_u32(vsq, s);
+	}
+
+	vst1q_u16(min, vmin);
+	vst1q_u16(max, vmax);
+	vst1q_u32(sum, vsum);
+	vst1q_u64(sq, vsq);
+
+	if (i) {
+		int k = 0;
+
+		for (k = 0; k < 8; k++) {
+			if (min[k] < acc->min)
+				acc->min = min[k];
+			if (max[k] > acc->max)
+				acc->max = max[k];
+		}
+		acc->sum += (unsigned long long)sum[0] + sum[1] + sum[2] + sum[3];
+		acc->sum_sq += sq[0] + sq[1];
+	}
+
+	__accumulate_scalar(x + i, n - i, acc);
+}
+#endif /* SOUND_LEVEL_NEON */
+
+static sound_level_kernel_fn __get_kernel(resource_sound_level_kernel_e kernel)
+{
+	switch (kernel) {
+	case SOUND_LEVEL_KERNEL_AUTO:
+#ifdef SOUND_LEVEL_NEON
+		return __accumulate_neon;
+#elif defined(SOUND_LEVEL_X86)
+		if (__builtin_cpu_supports("avx2"))
+			return __accumulate_avx2;
+		if (__builtin_cpu_supports("sse2"))
+			return __accumulate_sse2;
+		return __accumulate_scalar;
+#else
+		return __accumulate_scalar;
+#endif
+	case SOUND_LEVEL_KERNEL_SCALAR:
+		return __accumulate_scalar;
+#ifdef SOUND_LEVEL_X86
+	case SOUND_LEVEL_KERNEL_SSE2:
+		return __builtin_cpu_supports("sse2") ? __accumulate_sse2 : NULL;
+	case SOUND_LEVEL_KERNEL_AVX2:
+		return __builtin_cpu_supports("avx2") ? __accumulate_avx2 : NULL;
+#endif
+#ifdef SOUND_LEVEL_NEON
+	case SOUND_LEVEL_KERNEL_NEON:
+		return __accumulate_neon;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+static void __compute_level(const sound_level_acc_s *acc, unsigned int count, resource_sound_level_s *level)
+{
+	double mean = (double)acc->sum / count;
+	double var = (double)acc->sum_sq / count - mean * mean;
+
+	level->mean = mean;
+	level->rms = var > 0.0 ? sqrt(var) : 0.0;
+	level->peak = acc->max - mean > mean - acc->min ? acc->max - mean : mean - acc->min;
+
+	if (level->rms > 0.0) {
+		level->crest = level->peak / level->rms;
+		level->db = 20.0 * log10(level->rms / SOUND_LEVEL_FULL_SCALE_RMS);
+	} else {
+		level->crest = 0.0;
+		level->db = SOUND_LEVEL_DB_FLOOR;
+	}
+}
+
+int resource_compute_sound_level_with_kernel(resource_sound_level_kernel_e kernel,
+	const unsigned short *samples, unsigned int count, resource_sound_level_s *level)
+{
+	sound_level_kernel_fn fn = NULL;
+	sound_level_acc_s acc = { 0, 0, 0xffff, 0 };
+
+	retv_if(!samples, -1);
+	retv_if(!level, -1);
+	retv_if(count == 0 || count > SOUND_LEVEL_COUNT_MAX, -1);
+
+	fn = __get_kernel(kernel);
+	retv_if(!fn, -1);
+
+	fn(samples, count, &acc);
+	__compute_level(&acc, count, level);
+
+	return 0;
+}
+
+int resource_compute_sound_level(const unsigned short *samples, unsigned int count, resource_sound_level_s *level)
+{
+	static sound_level_kernel_fn fn = NULL;
+	sound_level_acc_s acc = { 0, 0, 0xffff, 0 };
+
+	retv_if(!samples, -1);
+	retv_if(!level, -1);
+	retv_if(count == 0 || count > SOUND_LEVEL_COUNT_MAX, -1);
+
+	if (!fn)
+		fn = __get_kernel(SOUND_LEVEL_KERNEL_AUTO);
+
+	fn(samples, count, &acc);
+	__compute_level(&acc, count, level);
+
+	return 0;
+}
+
+static unsigned long long _get_timestamp_ns(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec;
+}
+
+int resource_benchmark_sound_level(unsigned int count, unsigned int iterations)
+{
+	resource_sound_level_s reference;
+	resource_sound_level_s level;
+	unsigned short *samples = NULL;
+	unsigned long long start = 0;
+	unsigned long long elapsed = 0;
+	double scalar_ns = 0.0;
+	unsigned int i = 0;
+	int kernel = 0;
+
+	retv_if(count == 0 || count > SOUND_LEVEL_COUNT_MAX, -1);
+	retv_if(iterations == 0, -1);
+
+	samples = malloc(sizeof(unsigned short) * count);
+	retv_if(!samples, -1);
+
+	/* A noisy tone around the mid scale, like a real microphone window */
+	srand(1);
+	for (i = 0; i < count; i++)
+		samples[i] = 512 + (int)(300.0 * sin(i * 0.07)) + rand() % 64 - 32;
+
+	resource_compute_sound_level_with_kernel(SOUND_LEVEL_KERNEL_SCALAR, samples, count, &reference);
+
+	for (kernel = SOUND_LEVEL_KERNEL_SCALAR; kernel < SOUND_LEVEL_KERNEL_MAX; kernel++) {
+		double ns = 0.0;
+
+		if (!__get_kernel(kernel)) {
+			_I("sound level kernel[%s] is not supported", kernel_name[kernel]);
+			continue;
+		}
+
+		start = _get_timestamp_ns();
+		for (i = 0; i < iterations; i++)
+			resource_compute_sound_level_with_kernel(kernel, samples, count, &level);
+		elapsed = _get_timestamp_ns() - start;
+
+		ns = (double)elapsed / ((double)count * iterations);
+		if (kernel == SOUND_LEVEL_KERNEL_SCALAR)
+			scalar_ns = ns;
+
+		if (level.rms != reference.rms || level.peak != reference.peak)
+			_E("sound level kernel[%s] disagrees with the scalar kernel", kernel_name[kernel]);
+
+		_I("sound level kernel[%s] : %.3f ns/sample, x%.2f of scalar",
+			kernel_name[kernel], ns, ns > 0.0 ? scalar_ns / ns : 0.0);
+	}
+
+	free(samples);
+
+	return 0;
+}
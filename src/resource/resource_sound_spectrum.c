@@ -0,0 +1,202 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "log.h"
+#include "resource/resource_sound_spectrum.h"
+
+#define FFT_MIN 64
+#define Q15_ONE 32767
+#define SAMPLE_SHIFT 5 /* a 10-bit sample around the DC level fills Q15 */
+
+static struct {
+	int initialized;
+	unsigned int window_size;
+	short cos_table[SOUND_SPECTRUM_FFT_MAX / 2];
+	short sin_table[SOUND_SPECTRUM_FFT_MAX / 2];
+	short window[SOUND_SPECTRUM_FFT_MAX];
+	short re[SOUND_SPECTRUM_FFT_MAX];
+	short im[SOUND_SPECTRUM_FFT_MAX];
+	double power[SOUND_SPECTRUM_FFT_MAX / 2 + 1];
+} spectrum_ctx;
+
+static void __init_tables(unsigned int count)
+{
+	unsigned int i = 0;
+
+	if (!spectrum_ctx.initialized) {
+		for (i = 0; i < SOUND_SPECTRUM_FFT_MAX / 2; i++) {
+			spectrum_ctx.cos_table[i] = (short)lrint(Q15_ONE * cos(2.0 * M_PI * i / SOUND_SPECTRUM_FFT_MAX));
+			spectrum_ctx.sin_table[i] = (short)lrint(Q15_ONE * sin(2.0 * M_PI * i / SOUND_SPECTRUM_FFT_MAX));
+		}
+		spectrum_ctx.initialized = 1;
+	}
+
+	if (spectrum_ctx.window_size == count)
+		return;
+
+	for (i = 0; i < count; i++)
+		spectrum_ctx.window[i] = (short)lrint(Q15_ONE * 0.5 * (1.0 - cos(2.0 * M_PI * i / (count - 1))));
+	spectrum_ctx.window_size = count;
+}
+
+static inline int __is_power_of_2(unsigned int n)
+{
+	return n && !(n & (n - 1));
+}
+
+/* In-place radix-2 decimation-in-time FFT in Q15, every stage is scaled by 1/2 so nothing overflows */
+static void __fft_q15(short *re, short *im, unsigned int n)
+{
+	unsigned int size = 0;
+	unsigned int i = 0;
+	unsigned int j = 0;
+	unsigned int k = 0;
+	unsigned int bit = 0;
+
+	for (i = 1, j = 0; i < n; i++) {
+		for (bit = n >> 1; j & bit; bit >>= 1)
+			j ^= bit;
+		j |= bit;
+
+		if (i < j) {
+			short t = re[i];
+			re[i] = re[j];
+			re[j] = t;
+			t = im[i];
+			im[i] = im[j];
+			im[j] = t;
+		}
+	}
+
+	for (size = 2; size <= n; size <<= 1) {
+		unsigned int half = size >> 1;
+		unsigned int step = SOUND_SPECTRUM_FFT_MAX / size;
+
+		for (i = 0; i < n; i += size) {
+			for (k = 0; k < half; k++) {
+				int wr = spectrum_ctx.cos_table[k * step];
+				int wi = spectrum_ctx.sin_table[k * step];
+				unsigned int a = i + k;
+				unsigned int b = a + half;
+				/* (re[b] + j im[b]) * e^(-j 2 pi k / size) */
+				int tr = (wr * re[b] + wi * im[b]) >> 15;
+				int ti = (wr * im[b] - wi * re[b]) >> 15;
+
+				re[b] = (short)((re[a] - tr) >> 1);
+				im[b] = (short)((im[a] - ti) >> 1);
+				re[a] = (short)((re[a] + tr) >> 1);
+				im[a] = (short)((im[a] + ti) >> 1);
+			}
+		}
+	}
+}
+
+static unsigned int __bin_of(double freq, unsigned int count, unsigned int rate)
+{
+	double bin = freq * count / rate;
+
+	if (bin > count / 2)
+		return count / 2;
+
+	return (unsigned int)bin;
+}
+
+static double __peak_around(unsigned int bin, unsigned int last)
+{
+	double peak = 0.0;
+	unsigned int i = 0;
+
+	for (i = bin > 1 ? bin - 1 : 1; i <= bin + 1 && i <= last; i++) {
+		if (spectrum_ctx.power[i] > peak)
+			peak = spectrum_ctx.power[i];
+	}
+
+	return peak;
+}
+
+int resource_analyze_sound_spectrum(const unsigned short *samples, unsigned int count,
+	unsigned int rate, double mean, resource_sound_spectrum_s *spectrum)
+{
+	unsigned int edge[SOUND_SPECTRUM_BAND_MAX + 1];
+	unsigned int last = count / 2;
+	unsigned int pitch_bin = 0;
+	double pitch_power = 0.0;
+	double harmonic = 0.0;
+	int dc = (int)lrint(mean);
+	unsigned int i = 0;
+	int band = 0;
+
+	retv_if(!samples, -1);
+	retv_if(!spectrum, -1);
+	retv_if(rate == 0, -1);
+	retv_if(!__is_power_of_2(count) || count < FFT_MIN || count > SOUND_SPECTRUM_FFT_MAX, -1);
+
+	__init_tables(count);
+
+	for (i = 0; i < count; i++) {
+		int x = ((int)samples[i] - dc) << SAMPLE_SHIFT;
+
+		if (x > Q15_ONE)
+			x = Q15_ONE;
+		else if (x < -Q15_ONE)
+			x = -Q15_ONE;
+
+		spectrum_ctx.re[i] = (short)((x * spectrum_ctx.window[i]) >> 15);
+		spectrum_ctx.im[i] = 0;
+	}
+
+	__fft_q15(spectrum_ctx.re, spectrum_ctx.im, count);
+
+	for (i = 0; i <= last; i++) {
+		int re = spectrum_ctx.re[i];
+		int im = spectrum_ctx.im[i];
+
+		spectrum_ctx.power[i] = (double)(re * re + im * im);
+	}
+
+	edge[SOUND_SPECTRUM_BAND_LOW] = 1;
+	edge[SOUND_SPECTRUM_BAND_PITCH] = __bin_of(SOUND_SPECTRUM_PITCH_MIN, count, rate);
+	edge[SOUND_SPECTRUM_BAND_HARMONIC] = __bin_of(SOUND_SPECTRUM_PITCH_MAX, count, rate);
+	edge[SOUND_SPECTRUM_BAND_HIGH] = __bin_of(SOUND_SPECTRUM_HARMONIC_MAX, count, rate);
+	edge[SOUND_SPECTRUM_BAND_MAX] = last + 1;
+
+	memset(spectrum, 0, sizeof(resource_sound_spectrum_s));
+	for (band = 0; band < SOUND_SPECTRUM_BAND_MAX; band++) {
+		for (i = edge[band]; i < edge[band + 1]; i++)
+			spectrum->band[band] += spectrum_ctx.power[i];
+		spectrum->total += spectrum->band[band];
+	}
+
+	for (i = edge[SOUND_SPECTRUM_BAND_PITCH]; i < edge[SOUND_SPECTRUM_BAND_HARMONIC]; i++) {
+		if (spectrum_ctx.power[i] > pitch_power) {
+			pitch_power = spectrum_ctx.power[i];
+			pitch_bin = i;
+		}
+	}
+
+	if (pitch_bin == 0 || spectrum->total <= 0.0)
+		return 0;
+
+	spectrum->pitch = (double)pitch_bin * rate / count;
+	if (spectrum->band[SOUND_SPECTRUM_BAND_PITCH] > 0.0)
+		spectrum->pitch_prominence = pitch_power * (edge[SOUND_SPECTRUM_BAND_HARMONIC] - edge[SOUND_SPECTRUM_BAND_PITCH])
+			/ spectrum->band[SOUND_SPECTRUM_BAND_PITCH];
+
+	harmonic = (__peak_around(pitch_bin * 2, last) + __peak_around(pitch_bin * 3, last)) / 2.0;
+	spectrum->harmonic_ratio = harmonic * last / spectrum->total;
+
+	return 0;
+}
@@ -0,0 +1,411 @@
+/*
+ *
+ *
+ * Ewha Womans University, Computer Science & Engineering
+ *
+ * 1515029 Jeong-min Seo <chersoul@gmail.com>
+ * 1515013 Seung-Yun Kim <fic1214@gmail.com>
+ *
+ *
+ */
+
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "log.h"
+#include "resource_internal.h"
+#include "resource/resource_ultrasonic_array.h"
+
+#define ULTRASONIC_ARRAY_STALE_TIME 500000 /* us, an older distance is not published */
+#define ULTRASONIC_ARRAY_FILTER_WINDOW 5
+#define ULTRASONIC_ARRAY_FILTER_MAX_RATE 400.0 /* cm/s, the stroller and a walking person closing in */
+#define ULTRASONIC_ARRAY_FILTER_HOLD_TIME 0.3 /* s */
+/* Below the safety loop and the IMU, ahead of everything on the main loop */
+#define ULTRASONIC_ARRAY_THREAD_PRIORITY 45
+
+typedef struct _array_sensor_s {
+	int trig_pin;
+	int echo_pin;
+	resource_ultrasonic_sector_e sector;
+	resource_filter_s *filter;
+	double distance;
+	unsigned long long timestamp;
+} array_sensor_s;
+
+/*
+ * The sensors are fired, dispatched and published on the array thread, off the main loop,
+ * so that an upload can't hold back the distance the speed governor brakes on.
+ * The lock covers the measurements, the gpio fallback of the echo completes them on the main loop.
+ */
+static struct {
+	int running;
+	int stop_requested;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	int measuring;
+	unsigned long long next_fire; /* us */
+	unsigned int count;
+	array_sensor_s sensors[ULTRASONIC_SENSOR_MAX];
+	unsigned int order_count;
+	int order[ULTRASONIC_ARRAY_ORDER_MAX];
+	unsigned int order_pos;
+	double guard_interval;
+	double publish_interval;
+	int filter_enabled;
+	resource_filter_config_s filter_config;
+	resource_ultrasonic_obstacle_cb cb;
+	void *data;
+} array = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.filter_enabled = 1,
+	.filter_config = {
+		.window = ULTRASONIC_ARRAY_FILTER_WINDOW,
+		.max_rate = ULTRASONIC_ARRAY_FILTER_MAX_RATE,
+		.hold_time = ULTRASONIC_ARRAY_FILTER_HOLD_TIME,
+	},
+};
+
+static unsigned long long _get_timestamp(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return ((unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec) / 1000;
+}
+
+static void __read_cb(double value, void *data)
+{
+	array_sensor_s *sensor = data;
+	resource_ultrasonic_quality_s quality;
+	unsigned long long timestamp = 0;
+	double filtered = 0.0;
+
+	if (resource_get_ultrasonic_sensor_quality(sensor->echo_pin, &quality) == 0 && quality.timestamp)
+		timestamp = quality.timestamp;
+	else
+		timestamp = _get_timestamp();
+
+	pthread_mutex_lock(&array.lock);
+
+	sensor->timestamp = timestamp;
+	if (sensor->filter) {
+		if (resource_filter_update(sensor->filter, value, value >= 0, sensor->timestamp, &filtered) == 1)
+			sensor->distance = filtered;
+		else
+			sensor->distance = -1;
+	} else {
+		sensor->distance = value;
+	}
+
+	array.measuring = 0;
+	array.next_fire = _get_timestamp() + (unsigned long long)(array.guard_interval * 1000000.0);
+
+	pthread_mutex_unlock(&array.lock);
+}
+
+static void __fire_next(void)
+{
+	array_sensor_s *sensor = NULL;
+	int ret = 0;
+
+	pthread_mutex_lock(&array.lock);
+	sensor = &array.sensors[array.order[array.order_pos]];
+	array.order_pos = (array.order_pos + 1) % array.order_count;
+	array.measuring = 1;
+	pthread_mutex_unlock(&array.lock);
+
+	ret = resource_read_ultrasonic_sensor_polled(sensor->trig_pin, sensor->echo_pin, __read_cb, sensor);
+	if (ret < 0) {
+		_E("Failed to fire ultrasonic sensor[%d]", sensor->echo_pin);
+		pthread_mutex_lock(&array.lock);
+		array.measuring = 0;
+		array.next_fire = _get_timestamp() + (unsigned long long)(array.guard_interval * 1000000.0);
+		pthread_mutex_unlock(&array.lock);
+	}
+}
+
+static void __publish(void)
+{
+	resource_ultrasonic_obstacle_s obstacle;
+	unsigned long long now = _get_timestamp();
+	unsigned int i = 0;
+	int sector = 0;
+
+	for (sector = 0; sector < ULTRASONIC_SECTOR_MAX; sector++) {
+		obstacle.distance[sector] = -1;
+		obstacle.timestamp[sector] = 0;
+	}
+
+	pthread_mutex_lock(&array.lock);
+
+	for (i = 0; i < array.count; i++) {
+		array_sensor_s *sensor = &array.sensors[i];
+
+		if (sensor->timestamp == 0 || now - sensor->timestamp > ULTRASONIC_ARRAY_STALE_TIME)
+			continue;
+
+		sector = sensor->sector;
+		if (sensor->distance < 0) {
+			/* Nothing in range, still tells how fresh the sector is */
+			if (obstacle.distance[sector] < 0 && sensor->timestamp > obstacle.timestamp[sector])
+				obstacle.timestamp[sector] = sensor->timestamp;
+			continue;
+		}
+
+		if (obstacle.distance[sector] < 0 || sensor->distance < obstacle.distance[sector]) {
+			obstacle.distance[sector] = sensor->distance;
+			obstacle.timestamp[sector] = sensor->timestamp;
+		}
+	}
+
+	pthread_mutex_unlock(&array.lock);
+
+	if (array.cb)
+		array.cb(&obstacle, array.data);
+}
+
+/* Waits for the sensors until the deadline and dispatches the ready ones */
+static int __poll_sensors(unsigned long long deadline)
+{
+	struct pollfd pfds[ULTRASONIC_SENSOR_MAX * 2];
+	int echo_pins[ULTRASONIC_SENSOR_MAX * 2];
+	unsigned long long now = _get_timestamp();
+	unsigned int count = 0;
+	unsigned int i = 0;
+	int timer_fd = -1;
+	int echo_fd = -1;
+	int timeout = 0;
+	int ret = 0;
+
+	for (i = 0; i < array.count; i++) {
+		/* The fds are opened on the first fire of the sensor */
+		if (resource_get_ultrasonic_sensor_fds(array.sensors[i].echo_pin, &timer_fd, &echo_fd) < 0)
+			continue;
+
+		if (timer_fd >= 0) {
+			pfds[count].fd = timer_fd;
+			pfds[count].events = POLLIN;
+			pfds[count].revents = 0;
+			echo_pins[count++] = array.sensors[i].echo_pin;
+		}
+
+		if (echo_fd >= 0) {
+			pfds[count].fd = echo_fd;
+			pfds[count].events = POLLIN;
+			pfds[count].revents = 0;
+			echo_pins[count++] = array.sensors[i].echo_pin;
+		}
+	}
+
+	if (deadline > now)
+		timeout = (int)((deadline - now + 999) / 1000);
+
+	ret = poll(pfds, count, timeout);
+	if (ret < 0) {
+		if (errno != EINTR)
+			_E("Failed to poll ultrasonic sensors[%d]", errno);
+		return ret;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (pfds[i].revents & (POLLIN | POLLERR))
+			resource_dispatch_ultrasonic_sensor(echo_pins[i]);
+	}
+
+	return ret;
+}
+
+static void *__array_thread(void *data)
+{
+	unsigned long long publish_period = (unsigned long long)(array.publish_interval * 1000000.0);
+	unsigned long long next_publish = _get_timestamp() + publish_period;
+	unsigned long long deadline = 0;
+	unsigned long long now = 0;
+	int fire = 0;
+
+	_I("Ultrasonic array thread is running...");
+
+	while (!__atomic_load_n(&array.stop_requested, __ATOMIC_ACQUIRE)) {
+		now = _get_timestamp();
+		if (now >= next_publish) {
+			__publish();
+			next_publish += publish_period;
+			if (next_publish <= now)
+				next_publish = now + publish_period;
+		}
+
+		pthread_mutex_lock(&array.lock);
+		fire = !array.measuring && now >= array.next_fire;
+		pthread_mutex_unlock(&array.lock);
+
+		if (fire)
+			__fire_next();
+
+		/* While measuring, the timer of the sensor wakes us up for the echo timeout */
+		deadline = next_publish;
+		pthread_mutex_lock(&array.lock);
+		if (!array.measuring && array.next_fire < deadline)
+			deadline = array.next_fire;
+		pthread_mutex_unlock(&array.lock);
+
+		__poll_sensors(deadline);
+	}
+
+	_I("Ultrasonic array thread is finishing...");
+
+	return NULL;
+}
+
+int resource_add_ultrasonic_array_sensor(int trig_pin_num, int echo_pin_num, resource_ultrasonic_sector_e sector)
+{
+	array_sensor_s *sensor = NULL;
+
+	retvm_if(array.running, -1, "cannot add a sensor while running");
+	retv_if(array.count >= ULTRASONIC_SENSOR_MAX, -1);
+	retv_if(sector < ULTRASONIC_SECTOR_FRONT || sector >= ULTRASONIC_SECTOR_MAX, -1);
+	retv_if(trig_pin_num < 0 || trig_pin_num >= PIN_MAX, -1);
+	retv_if(echo_pin_num < 0 || echo_pin_num >= PIN_MAX, -1);
+
+	sensor = &array.sensors[array.count];
+	sensor->trig_pin = trig_pin_num;
+	sensor->echo_pin = echo_pin_num;
+	sensor->sector = sector;
+	sensor->filter = NULL;
+	sensor->distance = -1;
+	sensor->timestamp = 0;
+
+	return array.count++;
+}
+
+int resource_set_ultrasonic_array_order(const int *indices, unsigned int count)
+{
+	unsigned int i = 0;
+
+	retvm_if(array.running, -1, "cannot set the order while running");
+	retv_if(!indices, -1);
+	retv_if(count == 0 || count > ULTRASONIC_ARRAY_ORDER_MAX, -1);
+
+	for (i = 0; i < count; i++)
+		retvm_if(indices[i] < 0 || indices[i] >= (int)array.count, -1, "unknown sensor index[%d]", indices[i]);
+
+	memcpy(array.order, indices, sizeof(int) * count);
+	array.order_count = count;
+
+	return 0;
+}
+
+int resource_set_ultrasonic_array_filter(const resource_filter_config_s *config)
+{
+	retvm_if(array.running, -1, "cannot set the filter while running");
+
+	if (!config) {
+		array.filter_enabled = 0;
+		return 0;
+	}
+
+	retv_if(config->window < 1 || config->window > RESOURCE_FILTER_WINDOW_MAX, -1);
+	retv_if(config->max_rate < 0.0 || config->hold_time < 0.0, -1);
+
+	array.filter_config = *config;
+	array.filter_enabled = 1;
+
+	return 0;
+}
+
+static void __destroy_filters(void)
+{
+	unsigned int i = 0;
+
+	for (i = 0; i < array.count; i++) {
+		resource_filter_destroy(array.sensors[i].filter);
+		array.sensors[i].filter = NULL;
+	}
+}
+
+int resource_start_ultrasonic_array(double guard_interval, double publish_interval,
+	resource_ultrasonic_obstacle_cb cb, void *data)
+{
+	struct sched_param param;
+	unsigned int i = 0;
+	int ret = 0;
+
+	retv_if(array.count == 0, -1);
+	retv_if(guard_interval < 0.0, -1);
+	retv_if(publish_interval <= 0.0, -1);
+
+	if (array.running) {
+		_D("ultrasonic array is already running");
+		return 0;
+	}
+
+	if (array.order_count == 0) {
+		for (i = 0; i < array.count; i++)
+			array.order[i] = i;
+		array.order_count = array.count;
+	}
+
+	for (i = 0; i < array.count; i++) {
+		array_sensor_s *sensor = &array.sensors[i];
+
+		sensor->distance = -1;
+		sensor->timestamp = 0;
+		if (!array.filter_enabled)
+			continue;
+
+		sensor->filter = resource_filter_create(&array.filter_config);
+		if (!sensor->filter) {
+			_E("Failed to create the filter of sensor[%u]", i);
+			__destroy_filters();
+			return -1;
+		}
+	}
+
+	array.order_pos = 0;
+	array.measuring = 0;
+	array.next_fire = 0;
+	array.guard_interval = guard_interval;
+	array.publish_interval = publish_interval;
+	array.cb = cb;
+	array.data = data;
+	array.stop_requested = 0;
+
+	ret = pthread_create(&array.thread, NULL, __array_thread, NULL);
+	if (ret != 0) {
+		_E("Failed to create ultrasonic array thread[%d]", ret);
+		__destroy_filters();
+		return -1;
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = ULTRASONIC_ARRAY_THREAD_PRIORITY;
+	ret = pthread_setschedparam(array.thread, SCHED_FIFO, &param);
+	if (ret != 0)
+		_W("Ultrasonic array thread runs without real-time priority[%d]", ret);
+
+	array.running = 1;
+
+	_I("Ultrasonic array is running - %u sensors, guard[%.3f] publish[%.3f]",
+		array.count, guard_interval, publish_interval);
+
+	return 0;
+}
+
+void resource_stop_ultrasonic_array(void)
+{
+	if (!array.running)
+		return;
+
+	/* The thread notices within the publish interval */
+	__atomic_store_n(&array.stop_requested, 1, __ATOMIC_RELEASE);
+	pthread_join(array.thread, NULL);
+	array.running = 0;
+
+	/* A measurement of the gpio fallback may still complete on the main loop */
+	pthread_mutex_lock(&array.lock);
+	__destroy_filters();
+	pthread_mutex_unlock(&array.lock);
+}
@@ -20,91 +20,506 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <errno.h>
 #include <peripheral_io.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <pthread.h>
 #include <gio/gio.h>
+#include <Ecore.h>
 
 #include "log.h"
 #include "resource_internal.h"
+#include "resource/resource_gpio_chardev.h"
+#include "resource/resource_ultrasonic_sensor.h"
+
+#define TRIGGER_PULSE_WIDTH 10 /* us */
+#define ECHO_TIMEOUT 40000 /* us, the sensor keeps echo high for about 38ms when nothing returns */
+#define ECHO_WIDTH_MIN 150 /* us */
+#define ECHO_WIDTH_MAX 25000 /* us */
+#define JITTER_WEIGHT 0.125
+
+typedef enum {
+	ULTRASONIC_STATE_IDLE,
+	ULTRASONIC_STATE_TRIGGERING,
+	ULTRASONIC_STATE_WAIT_ECHO,
+	ULTRASONIC_STATE_ECHO_HIGH,
+} ultrasonic_state_e;
+
+typedef struct _ultrasonic_s {
+	int used;
+	int trig_pin;
+	int echo_pin;
+	int polled; /* dispatched by resource_dispatch_ultrasonic_sensor(), not by the main loop */
+	ultrasonic_state_e state;
+	int trig_high;
+	unsigned long long triggered_time;
+	int timer_fd;
+	Ecore_Fd_Handler *timer_fd_handler;
+	int echo_fd;
+	Ecore_Fd_Handler *echo_fd_handler;
+	resource_read_cb cb;
+	void *data;
+	int done; /* the result waits to be passed to the callback */
+	float result;
+	resource_ultrasonic_quality_s quality;
+} ultrasonic_s;
 
-static resource_read_s *resource_read_info = NULL;
-static unsigned long long triggered_time = 0;
+/*
+ * The sensors may be dispatched on another thread than the main loop, where the interrupt
+ * of the gpio fallback comes in, so the lock covers every instance.
+ * Callbacks are called without it, they may fire the sensor again.
+ */
+static pthread_mutex_t ultrasonic_lock = PTHREAD_MUTEX_INITIALIZER;
+static ultrasonic_s ultrasonic_info[ULTRASONIC_SENSOR_MAX];
+
+static ultrasonic_s *__find_by_trig(int trig_pin_num)
+{
+	int i = 0;
+
+	for (i = 0; i < ULTRASONIC_SENSOR_MAX; i++) {
+		if (ultrasonic_info[i].used && ultrasonic_info[i].trig_pin == trig_pin_num)
+			return &ultrasonic_info[i];
+	}
+
+	return NULL;
+}
+
+static ultrasonic_s *__find_by_echo(int echo_pin_num)
+{
+	int i = 0;
+
+	for (i = 0; i < ULTRASONIC_SENSOR_MAX; i++) {
+		if (ultrasonic_info[i].used && ultrasonic_info[i].echo_pin == echo_pin_num)
+			return &ultrasonic_info[i];
+	}
+
+	return NULL;
+}
+
+static void __release_if_unused(ultrasonic_s *info)
+{
+	if (info->timer_fd >= 0 || info->echo_fd_handler || resource_get_info(info->echo_pin)->opened)
+		return;
+
+	memset(info, 0, sizeof(ultrasonic_s));
+}
 
 void resource_close_ultrasonic_sensor_trig(int trig_pin_num)
 {
+	ultrasonic_s *info = NULL;
+
 	if (!resource_get_info(trig_pin_num)->opened) return;
 
 	_I("Ultrasonic sensor's trig is finishing...");
 
+	pthread_mutex_lock(&ultrasonic_lock);
+
+	info = __find_by_trig(trig_pin_num);
+
 	peripheral_gpio_close(resource_get_info(trig_pin_num)->sensor_h);
 	resource_get_info(trig_pin_num)->opened = 0;
+
+	if (!info) {
+		pthread_mutex_unlock(&ultrasonic_lock);
+		return;
+	}
+
+	if (info->timer_fd_handler) {
+		ecore_main_fd_handler_del(info->timer_fd_handler);
+		info->timer_fd_handler = NULL;
+	}
+
+	if (info->timer_fd >= 0) {
+		close(info->timer_fd);
+		info->timer_fd = -1;
+	}
+
+	info->state = ULTRASONIC_STATE_IDLE;
+	info->trig_high = 0;
+	__release_if_unused(info);
+
+	pthread_mutex_unlock(&ultrasonic_lock);
 }
 
 void resource_close_ultrasonic_sensor_echo(int echo_pin_num)
 {
+	ultrasonic_s *info = NULL;
+
 	if (!resource_get_info(echo_pin_num)->opened) return;
 
 	_I("Ultrasonic sensor's echo is finishing...");
 
-	peripheral_gpio_close(resource_get_info(echo_pin_num)->sensor_h);
+	pthread_mutex_lock(&ultrasonic_lock);
+
+	info = __find_by_echo(echo_pin_num);
+
+	if (info && info->echo_fd_handler) {
+		ecore_main_fd_handler_del(info->echo_fd_handler);
+		info->echo_fd_handler = NULL;
+	}
+
+	if (info && info->echo_fd >= 0) {
+		resource_close_gpio_line_event(info->echo_fd);
+		info->echo_fd = -1;
+	} else {
+		peripheral_gpio_close(resource_get_info(echo_pin_num)->sensor_h);
+	}
+
+	resource_get_info(echo_pin_num)->sensor_h = NULL;
 	resource_get_info(echo_pin_num)->opened = 0;
-	free(resource_read_info);
-	resource_read_info = NULL;
+
+	if (!info) {
+		pthread_mutex_unlock(&ultrasonic_lock);
+		return;
+	}
+
+	info->state = ULTRASONIC_STATE_IDLE;
+	__release_if_unused(info);
+
+	pthread_mutex_unlock(&ultrasonic_lock);
 }
 
 static unsigned long long _get_timestamp(void)
 {
 	struct timespec t;
-	clock_gettime(CLOCK_REALTIME, &t);
+	clock_gettime(CLOCK_MONOTONIC, &t);
 	return ((unsigned long long)(t.tv_sec)*1000000000LL + t.tv_nsec) / 1000;
 }
 
-static void _resource_read_ultrasonic_sensor_cb(peripheral_gpio_h gpio, peripheral_error_e error, void *user_data)
+static int __arm_timer(ultrasonic_s *info, unsigned long long usec)
+{
+	struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+	int ret = 0;
+
+	spec.it_value.tv_sec = usec / 1000000;
+	spec.it_value.tv_nsec = (usec % 1000000) * 1000;
+
+	ret = timerfd_settime(info->timer_fd, 0, &spec, NULL);
+	retvm_if(ret < 0, -1, "failed to arm timer[%d]", errno);
+
+	return 0;
+}
+
+static void __complete(ultrasonic_s *info, float dist, unsigned long long timestamp)
 {
+	__arm_timer(info, 0);
+	if (info->trig_high) {
+		peripheral_gpio_write(resource_get_info(info->trig_pin)->sensor_h, 0);
+		info->trig_high = 0;
+	}
+
+	info->state = ULTRASONIC_STATE_IDLE;
+	info->triggered_time = 0;
+	info->quality.timestamp = timestamp;
+
+	info->result = dist;
+	info->done = 1;
+}
+
+/* Called with the lock held */
+static void __unlock_and_notify(ultrasonic_s *info)
+{
+	resource_read_cb cb = NULL;
+	void *data = NULL;
 	float dist = 0;
-	uint32_t value;
-	unsigned long long returned_time = 0;
-	resource_read_s *resource_read_info = user_data;
 
-	ret_if(!resource_read_info);
-	ret_if(!resource_read_info->cb);
+	if (info->done) {
+		info->done = 0;
+		cb = info->cb;
+		data = info->data;
+		dist = info->result;
+	}
+
+	pthread_mutex_unlock(&ultrasonic_lock);
+
+	if (cb)
+		cb(dist, data);
+}
+
+static void __report_echo(ultrasonic_s *info, unsigned long long rising_time, unsigned long long falling_time)
+{
+	float dist = 0;
 
-	peripheral_gpio_read(gpio, &value);
+	dist = falling_time - rising_time;
+	info->quality.echo_width = falling_time - rising_time;
 
-	if (value == 1) {
-		triggered_time = _get_timestamp();
-	} else if (value == 0) {
-		returned_time = _get_timestamp();
+	if (dist < ECHO_WIDTH_MIN || dist > ECHO_WIDTH_MAX) {
+		dist = -1;
+	} else {
+		dist = (dist * 34300) / 2000000;
+	}
+
+	__complete(info, dist, falling_time);
+}
+
+static void __update_quality(ultrasonic_s *info, unsigned long long edge_time, unsigned long long handled_time)
+{
+	resource_ultrasonic_quality_s *quality = &info->quality;
+	unsigned long long latency = handled_time > edge_time ? handled_time - edge_time : 0;
+	double deviation = 0.0;
+
+	/* How long the echo waited for us, this is the error the user-space timestamp would have had */
+	deviation = (double)latency - (double)quality->latency;
+	if (deviation < 0.0)
+		deviation = -deviation;
+
+	quality->jitter += (deviation - quality->jitter) * JITTER_WEIGHT;
+	quality->latency = latency;
+	if (latency > quality->max_latency)
+		quality->max_latency = latency;
+}
+
+static void __handle_echo_edge(ultrasonic_s *info, int rising, unsigned long long edge_time)
+{
+	if (rising) {
+		/* The trigger timer may be handled after the sensor already answered */
+		if (info->state == ULTRASONIC_STATE_TRIGGERING || info->state == ULTRASONIC_STATE_WAIT_ECHO) {
+			info->triggered_time = edge_time;
+			info->state = ULTRASONIC_STATE_ECHO_HIGH;
+		}
+		return;
 	}
 
-	if (triggered_time > 0 && value == 0) {
-		dist = returned_time - triggered_time;
-		if (dist < 150 || dist > 25000) {
-			dist = -1;
-		} else {
-			dist = (dist * 34300) / 2000000;
+	if (info->state != ULTRASONIC_STATE_ECHO_HIGH)
+		return;
+
+	if (info->echo_fd >= 0)
+		__update_quality(info, edge_time, _get_timestamp());
+
+	__report_echo(info, info->triggered_time, edge_time);
+}
+
+/* Called with the lock held */
+static void __handle_timer(ultrasonic_s *info)
+{
+	uint64_t expirations = 0;
+	ssize_t size = 0;
+	int ret = 0;
+
+	if (info->timer_fd < 0)
+		return;
+
+	size = read(info->timer_fd, &expirations, sizeof(expirations));
+	if (size != sizeof(expirations))
+		return;
+
+	if (info->trig_high) {
+		info->trig_high = 0;
+		ret = peripheral_gpio_write(resource_get_info(info->trig_pin)->sensor_h, 0);
+		if (ret < 0) {
+			_E("failed to end the trigger pulse");
+			__complete(info, -1, _get_timestamp());
+			return;
 		}
 
-		resource_read_info->cb(dist, resource_read_info->data);
+		/* Echo may already be high if this timer was handled late */
+		if (info->state == ULTRASONIC_STATE_TRIGGERING)
+			info->state = ULTRASONIC_STATE_WAIT_ECHO;
+		__arm_timer(info, ECHO_TIMEOUT);
+		return;
+	}
+
+	if (info->state != ULTRASONIC_STATE_IDLE) {
+		_D("echo[%d] timed out in state[%d]", info->echo_pin, info->state);
+		__complete(info, -1, _get_timestamp());
 	}
 }
 
-int resource_read_ultrasonic_sensor(int trig_pin_num, int echo_pin_num, resource_read_cb cb, void *data)
+/* Called with the lock held */
+static void __handle_echo_events(ultrasonic_s *info)
 {
+	resource_gpio_line_event_s event;
 	int ret = 0;
 
-	triggered_time = 0;
+	if (info->echo_fd < 0)
+		return;
 
-	if (resource_read_info == NULL) {
-		resource_read_info = calloc(1, sizeof(resource_read_s));
-		retv_if(!resource_read_info, -1);
-	} else {
-		peripheral_gpio_unset_interrupted_cb(resource_get_info(resource_read_info->pin_num)->sensor_h);
+	while ((ret = resource_read_gpio_line_event(info->echo_fd, &event)) > 0)
+		__handle_echo_edge(info, event.rising, event.timestamp / 1000);
+
+	if (ret < 0)
+		_E("failed to read echo[%d] event", info->echo_pin);
+}
+
+static Eina_Bool _resource_ultrasonic_sensor_timer_cb(void *data, Ecore_Fd_Handler *fd_handler)
+{
+	ultrasonic_s *info = data;
+
+	pthread_mutex_lock(&ultrasonic_lock);
+	__handle_timer(info);
+	__unlock_and_notify(info);
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+static Eina_Bool _resource_read_ultrasonic_sensor_event_cb(void *data, Ecore_Fd_Handler *fd_handler)
+{
+	ultrasonic_s *info = data;
+
+	pthread_mutex_lock(&ultrasonic_lock);
+	__handle_echo_events(info);
+	__unlock_and_notify(info);
+
+	return ECORE_CALLBACK_RENEW;
+}
+
+static void _resource_read_ultrasonic_sensor_cb(peripheral_gpio_h gpio, peripheral_error_e error, void *user_data)
+{
+	ultrasonic_s *info = user_data;
+	uint32_t value;
+	unsigned long long timestamp = _get_timestamp();
+
+	ret_if(!info);
+	ret_if(peripheral_gpio_read(gpio, &value) != PERIPHERAL_ERROR_NONE);
+
+	pthread_mutex_lock(&ultrasonic_lock);
+	__handle_echo_edge(info, value == 1, timestamp);
+	__unlock_and_notify(info);
+}
+
+static int __open_trig_timer(ultrasonic_s *info)
+{
+	info->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	retvm_if(info->timer_fd < 0, -1, "failed to create timer[%d]", errno);
+
+	if (info->polled)
+		return 0;
+
+	info->timer_fd_handler = ecore_main_fd_handler_add(info->timer_fd, ECORE_FD_READ,
+			_resource_ultrasonic_sensor_timer_cb, info, NULL, NULL);
+	if (!info->timer_fd_handler) {
+		_E("Failed to add timer fd handler");
+		close(info->timer_fd);
+		info->timer_fd = -1;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int __open_echo_line_event(ultrasonic_s *info)
+{
+	int ret = 0;
+
+	ret = resource_open_gpio_line_event(info->echo_pin, PERIPHERAL_GPIO_EDGE_BOTH, &info->echo_fd);
+	if (ret < 0) {
+		info->echo_fd = -1;
+		return -1;
+	}
+
+	info->quality.kernel_timestamp = 1;
+
+	if (info->polled)
+		return 0;
+
+	info->echo_fd_handler = ecore_main_fd_handler_add(info->echo_fd, ECORE_FD_READ,
+			_resource_read_ultrasonic_sensor_event_cb, info, NULL, NULL);
+	if (!info->echo_fd_handler) {
+		_E("Failed to add echo fd handler");
+		resource_close_gpio_line_event(info->echo_fd);
+		info->echo_fd = -1;
+		info->quality.kernel_timestamp = 0;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int __open_echo_gpio(ultrasonic_s *info)
+{
+	int echo_pin_num = info->echo_pin;
+	int ret = 0;
+
+	ret = peripheral_gpio_open(echo_pin_num, &resource_get_info(echo_pin_num)->sensor_h);
+	retv_if(!resource_get_info(echo_pin_num)->sensor_h, -1);
+
+	ret = peripheral_gpio_set_direction(resource_get_info(echo_pin_num)->sensor_h, PERIPHERAL_GPIO_DIRECTION_IN);
+	retv_if(ret != 0, -1);
+
+	ret = peripheral_gpio_set_edge_mode(resource_get_info(echo_pin_num)->sensor_h, PERIPHERAL_GPIO_EDGE_BOTH);
+	retv_if(ret != 0, -1);
+
+	ret = peripheral_gpio_set_interrupted_cb(resource_get_info(echo_pin_num)->sensor_h, _resource_read_ultrasonic_sensor_cb, info);
+	retv_if(ret != 0, -1);
+
+	info->quality.kernel_timestamp = 0;
+
+	return 0;
+}
+
+static ultrasonic_s *__get_instance(int trig_pin_num, int echo_pin_num, int polled)
+{
+	ultrasonic_s *info = __find_by_echo(echo_pin_num);
+	int i = 0;
+
+	if (info) {
+		retvm_if(info->trig_pin != trig_pin_num, NULL,
+			"echo[%d] is already paired with trig[%d]", echo_pin_num, info->trig_pin);
+		retvm_if(info->polled != polled, NULL,
+			"echo[%d] is already dispatched by the %s", echo_pin_num, info->polled ? "caller" : "main loop");
+		return info;
+	}
+
+	for (i = 0; i < ULTRASONIC_SENSOR_MAX; i++) {
+		if (!ultrasonic_info[i].used)
+			break;
 	}
-	resource_read_info->cb = cb;
-	resource_read_info->data = data;
-	resource_read_info->pin_num = echo_pin_num;
+	retvm_if(i == ULTRASONIC_SENSOR_MAX, NULL, "too many ultrasonic sensors[%d]", i);
+
+	info = &ultrasonic_info[i];
+	memset(info, 0, sizeof(ultrasonic_s));
+	info->used = 1;
+	info->trig_pin = trig_pin_num;
+	info->echo_pin = echo_pin_num;
+	info->polled = polled;
+	info->timer_fd = -1;
+	info->echo_fd = -1;
+
+	return info;
+}
+
+int resource_get_ultrasonic_sensor_quality(int echo_pin_num, resource_ultrasonic_quality_s *out_quality)
+{
+	ultrasonic_s *info = NULL;
+
+	retv_if(!out_quality, -1);
+
+	pthread_mutex_lock(&ultrasonic_lock);
+
+	info = __find_by_echo(echo_pin_num);
+	if (!info) {
+		pthread_mutex_unlock(&ultrasonic_lock);
+		_E("unknown echo[%d]", echo_pin_num);
+		return -1;
+	}
+
+	*out_quality = info->quality;
+
+	pthread_mutex_unlock(&ultrasonic_lock);
+
+	return 0;
+}
+
+/* Called with the lock held */
+static int __read_ultrasonic_sensor(int trig_pin_num, int echo_pin_num, resource_read_cb cb, void *data, int polled)
+{
+	ultrasonic_s *info = NULL;
+	int ret = 0;
+
+	retv_if(trig_pin_num < 0 || trig_pin_num >= PIN_MAX, -1);
+	retv_if(echo_pin_num < 0 || echo_pin_num >= PIN_MAX, -1);
+
+	info = __get_instance(trig_pin_num, echo_pin_num, polled);
+	retv_if(!info, -1);
+
+	retvm_if(info->state != ULTRASONIC_STATE_IDLE, -1, "ultrasonic sensor[%d] is measuring now", echo_pin_num);
+
+	info->cb = cb;
+	info->data = data;
 
 	if (!resource_get_info(trig_pin_num)->opened) {
 		_I("Ultrasonic sensor's trig is initializing...");
@@ -119,39 +534,103 @@ int resource_read_ultrasonic_sensor(int trig_pin_num, int echo_pin_num, resource
 		resource_get_info(trig_pin_num)->close = resource_close_ultrasonic_sensor_trig;
 	}
 
+	if (info->timer_fd < 0) {
+		ret = __open_trig_timer(info);
+		retv_if(ret != 0, -1);
+	}
+
 	if (!resource_get_info(echo_pin_num)->opened) {
 		_I("Ultrasonic sensor's echo is initializing...");
 
-		ret = peripheral_gpio_open(echo_pin_num, &resource_get_info(echo_pin_num)->sensor_h);
-		retv_if(!resource_get_info(echo_pin_num)->sensor_h, -1);
-
-		ret = peripheral_gpio_set_direction(resource_get_info(echo_pin_num)->sensor_h, PERIPHERAL_GPIO_DIRECTION_IN);
-		retv_if(ret != 0, -1);
-
-		ret = peripheral_gpio_set_edge_mode(resource_get_info(echo_pin_num)->sensor_h, PERIPHERAL_GPIO_EDGE_BOTH);
-		retv_if(ret != 0, -1);
+		/* Prefers the kernel timestamps of the edges, the callback jitter becomes distance error otherwise */
+		ret = __open_echo_line_event(info);
+		if (ret < 0) {
+			_W("Kernel timestamp is not available, falls back to gpio interrupt");
+			ret = __open_echo_gpio(info);
+			retv_if(ret != 0, -1);
+		}
 
 		resource_get_info(echo_pin_num)->opened = 1;
 		resource_get_info(echo_pin_num)->close = resource_close_ultrasonic_sensor_echo;
 	}
 
-	if (resource_get_info(echo_pin_num)->sensor_h) {
-		ret = peripheral_gpio_set_interrupted_cb(resource_get_info(echo_pin_num)->sensor_h, _resource_read_ultrasonic_sensor_cb, resource_read_info);
-		retv_if(ret != 0, -1);
+	/* Starts the trigger pulse, the timer ends it and the echo edges complete the measurement */
+	ret = peripheral_gpio_write(resource_get_info(trig_pin_num)->sensor_h, 1);
+	retv_if(ret < 0, -1);
+
+	info->state = ULTRASONIC_STATE_TRIGGERING;
+	info->trig_high = 1;
+	info->triggered_time = 0;
+
+	ret = __arm_timer(info, TRIGGER_PULSE_WIDTH);
+	if (ret < 0) {
+		peripheral_gpio_write(resource_get_info(trig_pin_num)->sensor_h, 0);
+		info->state = ULTRASONIC_STATE_IDLE;
+		info->trig_high = 0;
+		return -1;
 	}
 
-	ret = peripheral_gpio_write(resource_get_info(trig_pin_num)->sensor_h, 0);
-	retv_if(ret < 0, -1);
+	return 0;
+}
+
+int resource_read_ultrasonic_sensor(int trig_pin_num, int echo_pin_num, resource_read_cb cb, void *data)
+{
+	int ret = 0;
 
-	usleep(20000);
+	pthread_mutex_lock(&ultrasonic_lock);
+	ret = __read_ultrasonic_sensor(trig_pin_num, echo_pin_num, cb, data, 0);
+	pthread_mutex_unlock(&ultrasonic_lock);
 
-	ret = peripheral_gpio_write(resource_get_info(trig_pin_num)->sensor_h, 1);
-	retv_if(ret < 0, -1);
+	return ret;
+}
 
-	usleep(20000);
+int resource_read_ultrasonic_sensor_polled(int trig_pin_num, int echo_pin_num, resource_read_cb cb, void *data)
+{
+	int ret = 0;
 
-	ret = peripheral_gpio_write(resource_get_info(trig_pin_num)->sensor_h, 0);
-	retv_if(ret < 0, -1);
+	pthread_mutex_lock(&ultrasonic_lock);
+	ret = __read_ultrasonic_sensor(trig_pin_num, echo_pin_num, cb, data, 1);
+	pthread_mutex_unlock(&ultrasonic_lock);
+
+	return ret;
+}
+
+int resource_get_ultrasonic_sensor_fds(int echo_pin_num, int *out_timer_fd, int *out_echo_fd)
+{
+	ultrasonic_s *info = NULL;
+
+	retv_if(!out_timer_fd || !out_echo_fd, -1);
+
+	pthread_mutex_lock(&ultrasonic_lock);
+
+	info = __find_by_echo(echo_pin_num);
+	if (!info) {
+		pthread_mutex_unlock(&ultrasonic_lock);
+		return -1;
+	}
+
+	*out_timer_fd = info->timer_fd;
+	*out_echo_fd = info->echo_fd;
+
+	pthread_mutex_unlock(&ultrasonic_lock);
 
 	return 0;
 }
+
+void resource_dispatch_ultrasonic_sensor(int echo_pin_num)
+{
+	ultrasonic_s *info = NULL;
+
+	pthread_mutex_lock(&ultrasonic_lock);
+
+	info = __find_by_echo(echo_pin_num);
+	if (!info || !info->polled) {
+		pthread_mutex_unlock(&ultrasonic_lock);
+		return;
+	}
+
+	/* Both fds are non-blocking, whatever is not ready is skipped */
+	__handle_echo_events(info);
+	__handle_timer(info);
+	__unlock_and_notify(info);
+}